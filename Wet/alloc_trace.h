@@ -0,0 +1,119 @@
+#ifndef ALLOC_TRACE_H
+#define ALLOC_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Binary allocation trace written by smalloc_trace_start() and replayed by tools/alloc_trace_replay.
+A header is followed by variable length records, every number is a LEB128 varint:
+    op (byte) | time since the previous record in ns | operands
+    SMALLOC:  size
+    SCALLOC:  num, size
+    SREALLOC: old id, size
+    SFREE:    id
+Every successful allocation gets the next id (starting at 1) implicitly, so ids are stored as the
+distance back from the next id to be handed out: short lived blocks cost a byte. Id 0 (distance 0)
+is a NULL pointer or a block allocated before the trace started.
+A failed allocation has ALLOC_TRACE_FAILED set in its op and doesn't get an id.
+*/
+
+#define ALLOC_TRACE_MAGIC 0x52544d53 // "SMTR"
+#define ALLOC_TRACE_VERSION 1
+#define ALLOC_TRACE_FAILED 0x80
+#define ALLOC_TRACE_MAX_RECORD 32 // bytes
+
+enum alloc_trace_op
+{
+    ALLOC_TRACE_SMALLOC = 1,
+    ALLOC_TRACE_SCALLOC = 2,
+    ALLOC_TRACE_SREALLOC = 3,
+    ALLOC_TRACE_SFREE = 4
+};
+
+struct alloc_trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct alloc_trace_record
+{
+    uint8_t op;
+    bool failed;
+    uint64_t time_delta; // ns
+    uint64_t id_distance;
+    uint64_t num;
+    uint64_t size;
+};
+
+static inline size_t allocTracePutVarint(uint8_t* buffer, uint64_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80)
+    {
+        buffer[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t)value;
+    return length;
+}
+
+// returns the bytes read, 0 if the varint is truncated or too long.
+static inline size_t allocTraceGetVarint(const uint8_t* buffer, size_t length, uint64_t* value)
+{
+    *value = 0;
+    for (size_t i = 0; i < length && i < 10; i++)
+    {
+        *value |= (uint64_t)(buffer[i] & 0x7f) << (7 * i);
+        if ((buffer[i] & 0x80) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// returns the bytes read, 0 if the record is truncated or malformed.
+static inline size_t allocTraceDecode(const uint8_t* buffer, size_t length, struct alloc_trace_record* record)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+    record->op = buffer[0] & ~ALLOC_TRACE_FAILED;
+    record->failed = (buffer[0] & ALLOC_TRACE_FAILED) != 0;
+    record->id_distance = 0;
+    record->num = 1;
+    record->size = 0;
+    size_t offset = 1;
+    uint64_t* operands[2] = {NULL, NULL};
+    switch (record->op)
+    {
+    case ALLOC_TRACE_SMALLOC:
+        operands[0] = &record->size;
+        break;
+    case ALLOC_TRACE_SCALLOC:
+        operands[0] = &record->num;
+        operands[1] = &record->size;
+        break;
+    case ALLOC_TRACE_SREALLOC:
+        operands[0] = &record->id_distance;
+        operands[1] = &record->size;
+        break;
+    case ALLOC_TRACE_SFREE:
+        operands[0] = &record->id_distance;
+        break;
+    default:
+        return 0;
+    }
+    size_t read = allocTraceGetVarint(buffer + offset, length - offset, &record->time_delta);
+    for (int i = 0; read != 0 && i < 2 && operands[i] != NULL; i++)
+    {
+        offset += read;
+        read = allocTraceGetVarint(buffer + offset, length - offset, operands[i]);
+    }
+    return (read == 0) ? 0 : offset + read;
+}
+
+#endif /* ALLOC_TRACE_H */
@@ -0,0 +1,45 @@
+#ifndef HEAP_SNAPSHOT_H
+#define HEAP_SNAPSHOT_H
+
+#include <stdint.h>
+
+/*
+Binary heap snapshot written by smalloc_snapshot_write() and read by tools/heap_snapshot_view.
+A header is followed by fixed size records: every buddy block in address order (root by root),
+then every mmap()ed chunk, then an end record.
+*/
+
+#define HEAP_SNAPSHOT_MAGIC 0x53484d53 // "SMHS"
+#define HEAP_SNAPSHOT_VERSION 1
+
+enum heap_snapshot_record_type
+{
+    HEAP_SNAPSHOT_BLOCK = 1,
+    HEAP_SNAPSHOT_CHUNK = 2,
+    HEAP_SNAPSHOT_END = 3,
+    HEAP_SNAPSHOT_CORRUPTED = 4 // the walk met a block with bad cookies and stopped
+};
+
+struct heap_snapshot_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_roots;
+    uint32_t root_size;      // bytes, metadata included
+    uint32_t min_block_size; // bytes, metadata included
+    uint32_t meta_data_size;
+    uint64_t region_base;    // address of the first root, 0 if the buddy heap wasn't initialized
+};
+
+struct heap_snapshot_record
+{
+    uint8_t type;
+    uint8_t order;   // buddy blocks only
+    uint8_t is_free;
+    uint8_t reserved;
+    uint32_t requested_size;
+    uint64_t address; // of the metadata
+    uint64_t size;    // payload bytes
+};
+
+#endif /* HEAP_SNAPSHOT_H */
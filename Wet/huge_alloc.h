@@ -0,0 +1,115 @@
+#ifndef HUGE_ALLOC_H
+#define HUGE_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+Huge allocations: with -DMALLOC_HUGE_ALLOCATIONS, malloc_2, malloc_3 and malloc_4 take requests above their
+MAX_SIZE (1e8) up to HUGE_ALLOC_MAX_SIZE here instead of failing them. Every one gets a mapping of its own,
+with MAP_NORESERVE: nothing is committed, or charged against the overcommit limit, until a page is touched,
+so a multi-GB array costs what's used of it. With MALLOC_HUGE_PAGES the mapping is aligned to
+HUGE_ALLOC_HUGE_PAGE and madvise()d for transparent huge pages, which are still faulted in lazily
+(MAP_HUGETLB would take them all up front). A realloc between two huge sizes is an mremap(), the kernel
+moves the pages instead of copying them.
+The implementation's own metadata is at the start of the mapping, a size above MAX_SIZE marks the block as
+huge. Huge blocks are counted in huge_alloc_stats only, apart from the heap's counters.
+*/
+
+#ifndef HUGE_ALLOC_MAX_SIZE
+#define HUGE_ALLOC_MAX_SIZE ((size_t)1 << 40) // 1TB, past it a request is a bug rather than data
+#endif
+#define HUGE_ALLOC_HUGE_PAGE (2*1024*1024)
+
+struct HugeAllocStats
+{
+    size_t num_blocks;   // live
+    size_t num_bytes;    // their payload
+    size_t mapped_bytes; // their mappings, metadata and rounding included
+};
+
+static HugeAllocStats huge_alloc_stats = {0, 0, 0};
+
+// the length of the mapping of size bytes after meta_size bytes of metadata, 0 if size is too large.
+static inline size_t hugeMappingLength(size_t size, size_t meta_size)
+{
+    if (size > HUGE_ALLOC_MAX_SIZE)
+    {
+        return 0;
+    }
+#ifdef MALLOC_HUGE_PAGES
+    size_t granularity = HUGE_ALLOC_HUGE_PAGE;
+#else
+    size_t granularity = sysconf(_SC_PAGESIZE);
+#endif
+    return (size + meta_size + granularity - 1) & ~(granularity - 1);
+}
+
+// a zeroed mapping for size bytes after meta_size bytes of metadata (which go at its start), NULL if it can't be mapped.
+static inline void* hugeMap(size_t size, size_t meta_size)
+{
+    size_t length = hugeMappingLength(size, meta_size);
+    if (length == 0)
+    {
+        return NULL;
+    }
+#ifdef MALLOC_HUGE_PAGES
+    // map an extra huge page and trim the mapping to a HUGE_ALLOC_HUGE_PAGE aligned address.
+    char* raw = (char*)mmap(NULL, length + HUGE_ALLOC_HUGE_PAGE, (PROT_READ | PROT_WRITE),
+                            (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE), -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        return NULL;
+    }
+    char* mapping = (char*)(((uintptr_t)raw + HUGE_ALLOC_HUGE_PAGE - 1) & ~((uintptr_t)HUGE_ALLOC_HUGE_PAGE - 1));
+    size_t head_slack = mapping - raw;
+    if (head_slack > 0)
+    {
+        munmap(raw, head_slack);
+    }
+    munmap(mapping + length, HUGE_ALLOC_HUGE_PAGE - head_slack);
+    madvise(mapping, length, MADV_HUGEPAGE);
+#else
+    void* mapping = mmap(NULL, length, (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE), -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return NULL;
+    }
+#endif
+    huge_alloc_stats.num_blocks++;
+    huge_alloc_stats.num_bytes += size;
+    huge_alloc_stats.mapped_bytes += length;
+    return mapping;
+}
+
+static inline void hugeUnmap(void* mapping, size_t size, size_t meta_size)
+{
+    size_t length = hugeMappingLength(size, meta_size);
+    huge_alloc_stats.num_blocks--;
+    huge_alloc_stats.num_bytes -= size;
+    huge_alloc_stats.mapped_bytes -= length;
+    munmap(mapping, length);
+}
+
+// the mapping resized for size bytes, with its data, wherever the kernel put it. NULL (and untouched) if it can't be.
+static inline void* hugeRemap(void* mapping, size_t old_size, size_t size, size_t meta_size)
+{
+    size_t old_length = hugeMappingLength(old_size, meta_size);
+    size_t length = hugeMappingLength(size, meta_size);
+    if (length == 0)
+    {
+        return NULL;
+    }
+    void* moved = mremap(mapping, old_length, length, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED)
+    {
+        return NULL;
+    }
+    huge_alloc_stats.num_bytes = huge_alloc_stats.num_bytes - old_size + size;
+    huge_alloc_stats.mapped_bytes = huge_alloc_stats.mapped_bytes - old_length + length;
+    return moved;
+}
+
+#endif /* HUGE_ALLOC_H */
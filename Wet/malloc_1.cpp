@@ -1,9 +1,22 @@
 #include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "malloc_1.h"
+#ifdef MALLOC_HUGE_ALLOCATIONS
+#include "huge_alloc.h"
+#endif
 #define MAX_SIZE (1e8)
 
+#ifndef MALLOC_1_BUMP
 // DONE
 void *smalloc(size_t size)
 {
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    if (size > MAX_SIZE)
+    {
+        return hugeMap(size, 0); // never given back, like everything else here
+    }
+#endif
     if ( (size == 0) || (size > MAX_SIZE) )
     {    
             // invalid size
@@ -17,3 +30,205 @@ void *smalloc(size_t size)
     }
     return program_break;
 }
+
+#else
+#include <pthread.h>
+
+/*
+Allocate-only bump mode (MALLOC_1_BUMP), for data that's built once and never freed: every thread carves
+its allocations out of a chunk of its own, a refill takes BUMP_CHUNK_SIZE from sbrk(), or from mmap() when
+another thread is in sbrk() or the break can't move. Allocations are BUMP_ALIGNMENT aligned, the ones above
+BUMP_DIRECT_SIZE get a region of their own so they don't waste the rest of the chunk.
+*/
+
+#define BUMP_CHUNK_SIZE (1024*1024)
+#define BUMP_DIRECT_SIZE (BUMP_CHUNK_SIZE / 8)
+#define BUMP_ALIGNMENT 16
+
+static pthread_mutex_t sbrk_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread char *bump_next = NULL;
+static __thread char *bump_end = NULL;
+
+static size_t alignUp(size_t n)
+{
+    return (n + BUMP_ALIGNMENT - 1) & ~(size_t)(BUMP_ALIGNMENT - 1);
+}
+
+// size bytes, BUMP_ALIGNMENT aligned, NULL if neither sbrk() nor mmap() has them.
+static char *grabRegion(size_t size)
+{
+    if (pthread_mutex_trylock(&sbrk_mutex) == 0)
+    {
+        // the break may be anywhere, the padding puts the region on the alignment.
+        size_t padding = (BUMP_ALIGNMENT - (uintptr_t)sbrk(0) % BUMP_ALIGNMENT) % BUMP_ALIGNMENT;
+        void *program_break = sbrk(padding + size);
+        pthread_mutex_unlock(&sbrk_mutex);
+        if (program_break != (void*)(-1))
+        {
+            return (char*)program_break + padding;
+        }
+    }
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (mapping == MAP_FAILED) ? NULL : (char*)mapping;
+}
+
+void *smalloc(size_t size)
+{
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    if (size > MAX_SIZE)
+    {
+        return hugeMap(size, 0); // never given back, like everything else here
+    }
+#endif
+    if ( (size == 0) || (size > MAX_SIZE) )
+    {
+        return NULL;
+    }
+    size = alignUp(size);
+    if ((size_t)(bump_end - bump_next) >= size)
+    {
+        char *p = bump_next;
+        bump_next += size;
+        return p;
+    }
+    if (size > BUMP_DIRECT_SIZE)
+    {
+        return grabRegion(size);
+    }
+    // what's left of the old chunk is given up, nothing is ever freed anyway.
+    char *chunk = grabRegion(BUMP_CHUNK_SIZE);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    bump_next = chunk + size;
+    bump_end = chunk + BUMP_CHUNK_SIZE;
+    return chunk;
+}
+#endif
+
+// a region's chunks double from REGION_MIN_CHUNK up to REGION_MAX_CHUNK, a larger allocation gets a chunk of its own size.
+#define REGION_MIN_CHUNK (64*1024)
+#define REGION_MAX_CHUNK (64*1024*1024)
+
+struct RegionChunk
+{
+    RegionChunk *next; // the chunks after this one, kept from before a reset or a release
+    size_t size; // mapped bytes, this header included
+};
+
+// lives at the start of its first chunk.
+struct region
+{
+    RegionChunk *first;
+    RegionChunk *current;
+    char *next;
+    char *end;
+};
+
+static RegionChunk *mapChunk(size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size = (size + page_size - 1) & ~(page_size - 1);
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return NULL;
+    }
+    RegionChunk *chunk = (RegionChunk*)mapping;
+    chunk->next = NULL;
+    chunk->size = size;
+    return chunk;
+}
+
+static char *alignPointer(char *p, size_t align)
+{
+    return (char*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+struct region *region_create(size_t initial)
+{
+    if (initial > MAX_SIZE)
+    {
+        return NULL;
+    }
+    size_t size = sizeof(RegionChunk) + sizeof(region) + initial;
+    RegionChunk *chunk = mapChunk((size < REGION_MIN_CHUNK) ? REGION_MIN_CHUNK : size);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    region *r = (region*)(chunk + 1);
+    r->first = chunk;
+    r->current = chunk;
+    r->next = (char*)(r + 1);
+    r->end = (char*)chunk + chunk->size;
+    return r;
+}
+
+void *region_alloc(struct region *r, size_t n, size_t align)
+{
+    align = (align == 0) ? REGION_DEFAULT_ALIGNMENT : align;
+    if (n == 0 || n > MAX_SIZE || (align & (align - 1)) != 0 || align > MAX_SIZE)
+    {
+        return NULL;
+    }
+    char *p = alignPointer(r->next, align);
+    if (p <= r->end && (size_t)(r->end - p) >= n)
+    {
+        r->next = p + n;
+        return p;
+    }
+    // the chunk kept after this one if it's large enough, otherwise a new one goes in before it.
+    size_t needed = sizeof(RegionChunk) + align + n;
+    RegionChunk *chunk = r->current->next;
+    if (chunk == NULL || chunk->size < needed)
+    {
+        size_t size = 2 * r->current->size;
+        size = (size > REGION_MAX_CHUNK) ? REGION_MAX_CHUNK : size;
+        chunk = mapChunk((size < needed) ? needed : size);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+        chunk->next = r->current->next;
+        r->current->next = chunk;
+    }
+    r->current = chunk;
+    p = alignPointer((char*)(chunk + 1), align);
+    r->next = p + n;
+    r->end = (char*)chunk + chunk->size;
+    return p;
+}
+
+struct region_mark region_mark(struct region *r)
+{
+    struct region_mark mark = {r->current, r->next};
+    return mark;
+}
+
+void region_release(struct region *r, struct region_mark mark)
+{
+    r->current = (RegionChunk*)mark.chunk;
+    r->next = mark.next;
+    r->end = (char*)r->current + r->current->size;
+}
+
+void region_reset(struct region *r)
+{
+    r->current = r->first;
+    r->next = (char*)(r + 1);
+    r->end = (char*)r->first + r->first->size;
+}
+
+void region_destroy(struct region *r)
+{
+    RegionChunk *chunk = r->first->next;
+    while (chunk != NULL)
+    {
+        RegionChunk *next = chunk->next;
+        munmap(chunk, chunk->size);
+        chunk = next;
+    }
+    munmap(r->first, r->first->size); // r goes with it
+}
@@ -0,0 +1,49 @@
+#ifndef MALLOC_1_H
+#define MALLOC_1_H
+
+#include <stddef.h>
+
+/*
+Regions (arenas) on malloc_1's bump design, for objects that all die together: allocations are carved out of
+a chain of chunks and never freed one by one.
+    struct region* r = region_create(64 * 1024);
+    node* n = (node*)region_alloc(r, sizeof(node), alignof(node));
+    ...
+    region_reset(r);
+A reset or a release only moves the region back, in O(1). The chunks stay mapped for what's allocated next,
+until region_destroy(): a region holds on to the most it ever needed. Chunks are mmap()ed, they never move
+the program break, and a region isn't thread-safe.
+*/
+
+#define REGION_DEFAULT_ALIGNMENT 16
+
+struct region;
+
+// where a region was, to go back to with region_release(). Marks are released last taken first.
+struct region_mark
+{
+    void* chunk;
+    char* next;
+};
+
+/* initial: bytes the first chunk can hold at least. NULL if it can't be mapped. */
+struct region* region_create(size_t initial);
+
+/*
+n bytes aligned to align (a power of two, 0 for REGION_DEFAULT_ALIGNMENT). The region grows by a chunk
+twice as large as the last one when it's full. NULL for 0 or more than 1e8 bytes, or if no chunk could be mapped.
+*/
+void* region_alloc(struct region* r, size_t n, size_t align);
+
+struct region_mark region_mark(struct region* r);
+
+/* everything allocated since the mark is gone. */
+void region_release(struct region* r, struct region_mark mark);
+
+/* everything allocated from the region is gone. */
+void region_reset(struct region* r);
+
+/* unmaps every chunk, the region itself included. */
+void region_destroy(struct region* r);
+
+#endif /* MALLOC_1_H */
@@ -1,15 +1,69 @@
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "mem_kernels.h"
+#ifdef MALLOC_HUGE_ALLOCATIONS
+#include "huge_alloc.h"
+#endif
 
 #define MAX_SIZE (1e8)
 
+/*
+Two fit policies, picked at build time:
+    first fit (default): size classes of free blocks, the ones past SMALL_CLASS_LIMIT split in NUM_SUB_CLASSES
+        like TLSF's second level. A freed block goes to the front of its list. The front block of the request's
+        own list is taken if it fits, otherwise the front of the next non empty list, where every block fits:
+        both sfree() and smalloc() are O(1).
+    best fit (MALLOC_2_BEST_FIT): one red-black tree of the free blocks by size, ties by address, the smallest
+        block that fits is found in O(log n).
+    simd index (MALLOC_2_SIMD_INDEX): the sizes of the free blocks in one dense array, next to an array of their
+        headers, scanned with AVX2/SSE4.1 compares for the same best fit as the tree. The index is mapped on
+        its own, a block only keeps its place in it.
+*/
+
+#if defined(MALLOC_2_BEST_FIT) && defined(MALLOC_2_SIMD_INDEX)
+#error "MALLOC_2_BEST_FIT and MALLOC_2_SIMD_INDEX are two different fit policies"
+#endif
+#if !defined(MALLOC_2_BEST_FIT) && !defined(MALLOC_2_SIMD_INDEX)
+#define MALLOC_2_FIRST_FIT
+#endif
+
+// free blocks are kept in size classes: SMALL_CLASS_WIDTH wide ones up to SMALL_CLASS_LIMIT, then one per power of two.
+#define SMALL_CLASS_WIDTH 16
+#define SMALL_CLASS_LIMIT 256
+#define NUM_SMALL_CLASSES (SMALL_CLASS_LIMIT / SMALL_CLASS_WIDTH)
+#define NUM_SIZE_CLASSES 48 // fits the bitmap of non empty classes, the last one takes everything above 2^39
+#define SUB_CLASSES_LOG2 3
+#define NUM_SUB_CLASSES (1 << SUB_CLASSES_LOG2) // lists of a power of two class, the small classes only use the first
+// a reused block is split when what's left can hold at least this much past its own metadata.
+#define MIN_SPLIT_SIZE 128
+// entries of the simd index's first mapping, it doubles from there.
+#define INDEX_INITIAL_CAPACITY 512
+#define NOT_INDEXED ((size_t)-1)
+// the index keeps 32 bit sizes, eight to an AVX2 compare. merged blocks can be larger, their entry is capped.
+#define INDEX_SIZE_LIMIT 0xfffffffeu
+#define NO_FIT 0xffffffffu
+
 class MallocMetaData
 {
 public:
     size_t size;
     bool is_free;
-    MallocMetaData* next;
+    bool is_zeroed; // only meaningful while the block is free: every payload page past the first one was never touched.
+    MallocMetaData* next; // every block, in address order
     MallocMetaData* prev;
+#ifdef MALLOC_2_BEST_FIT
+    MallocMetaData* left; // the tree of free blocks
+    MallocMetaData* right;
+    MallocMetaData* parent;
+    bool is_red;
+#elif defined(MALLOC_2_SIMD_INDEX)
+    size_t free_index; // the block's entry in the index, NOT_INDEXED while it has none
+#else
+    MallocMetaData* next_free; // the free blocks of the same list, the last one freed first
+    MallocMetaData* prev_free;
+#endif
     MallocMetaData(size_t size = 0, bool is_free = false, MallocMetaData* next = NULL, MallocMetaData* prev = NULL);
     ~MallocMetaData() = default;
 };
@@ -17,113 +71,881 @@ public:
 MallocMetaData::MallocMetaData(size_t size, bool is_free, MallocMetaData* next, MallocMetaData* prev):
     size(size),
     is_free(is_free),
+    is_zeroed(false),
     next(next),
-    prev(prev)
+    prev(prev),
+#ifdef MALLOC_2_BEST_FIT
+    left(NULL),
+    right(NULL),
+    parent(NULL),
+    is_red(false)
+#elif defined(MALLOC_2_SIMD_INDEX)
+    free_index(NOT_INDEXED)
+#else
+    next_free(NULL),
+    prev_free(NULL)
+#endif
 {}
 
 class FreeList
 {
 public:
     MallocMetaData *head;
+    MallocMetaData *tail;
+#ifdef MALLOC_2_BEST_FIT
+    MallocMetaData *free_root;
+    MallocMetaData *tree_nil; // the black leaf every branch ends with
+#elif defined(MALLOC_2_SIMD_INDEX)
+    uint32_t *free_sizes; // free_sizes[i] is free_blocks[i]->size, capped at INDEX_SIZE_LIMIT, in no particular order
+    MallocMetaData **free_blocks;
+    size_t index_count;
+    size_t index_capacity;
+#else
+    MallocMetaData *free_heads[NUM_SIZE_CLASSES][NUM_SUB_CLASSES];
+    unsigned long long non_empty_classes; // bit i is set while non_empty_subs[i] isn't 0
+    unsigned int non_empty_subs[NUM_SIZE_CLASSES]; // bit j is set while free_heads[i][j] isn't NULL
+#endif
     size_t num_allocated_bytes;
     size_t num_free_bytes;
     size_t num_allocated_blocks;
     size_t num_free_blocks;
-    FreeList(MallocMetaData* head_data);
+    FreeList(MallocMetaData* head_data, MallocMetaData* tree_nil);
     ~FreeList() = default;
     MallocMetaData* SearchBlock(size_t size);
     void AddMetaData_Block(MallocMetaData* data, size_t size);
+    void InsertFreeBlock(MallocMetaData* block);
+    void RemoveFreeBlock(MallocMetaData* block);
+    bool ReserveIndex(size_t num_blocks);
+    void SplitBlock(MallocMetaData* block, size_t size);
+    MallocMetaData* CoalesceBlock(MallocMetaData* block);
+    void AbsorbNextBlock(MallocMetaData* block);
+#ifdef MALLOC_2_BEST_FIT
+private:
+    void RotateLeft(MallocMetaData* block);
+    void RotateRight(MallocMetaData* block);
+    void FixInsertion(MallocMetaData* block);
+    void FixRemoval(MallocMetaData* block);
+    void Transplant(MallocMetaData* old_block, MallocMetaData* new_block);
+#elif defined(MALLOC_2_SIMD_INDEX)
+private:
+    bool GrowIndex();
+#endif
 };
 
-FreeList::FreeList(MallocMetaData* head)
+FreeList::FreeList(MallocMetaData* head, MallocMetaData* tree_nil)
 {
     this->head = head;
+    this->tail = head;
+#ifdef MALLOC_2_BEST_FIT
+    this->tree_nil = tree_nil;
+    this->free_root = tree_nil;
+#elif defined(MALLOC_2_SIMD_INDEX)
+    (void)tree_nil;
+    this->free_sizes = NULL;
+    this->free_blocks = NULL;
+    this->index_count = 0;
+    this->index_capacity = 0;
+#else
+    (void)tree_nil;
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++)
+    {
+        for (int j = 0; j < NUM_SUB_CLASSES; j++)
+        {
+            this->free_heads[i][j] = NULL;
+        }
+        this->non_empty_subs[i] = 0;
+    }
+    this->non_empty_classes = 0;
+#endif
     this->num_free_blocks = 0;
     this->num_allocated_blocks = 0;
     this->num_free_bytes = 0;
     this->num_allocated_bytes = 0;
 }
 
+#ifdef MALLOC_2_FIRST_FIT
+// the lists are ordered by size: every block of a later list is larger than any of an earlier one.
+static void GetSizeClass(size_t size, int* size_class, int* sub_class)
+{
+    if (size <= SMALL_CLASS_LIMIT)
+    {
+        *size_class = (size - 1) / SMALL_CLASS_WIDTH;
+        *sub_class = 0;
+        return;
+    }
+    // 257..512 is the first class past the small ones, then every power of two gets its own.
+    int log2 = 63 - __builtin_clzll(size - 1);
+    *size_class = NUM_SMALL_CLASSES + log2 - 8;
+    *sub_class = ((size - 1) >> (log2 - SUB_CLASSES_LOG2)) & (NUM_SUB_CLASSES - 1);
+    if (*size_class >= NUM_SIZE_CLASSES)
+    {
+        *size_class = NUM_SIZE_CLASSES - 1;
+        *sub_class = NUM_SUB_CLASSES - 1;
+    }
+}
+
 MallocMetaData* FreeList::SearchBlock(size_t size)
 {
-    for ( MallocMetaData *curr = this->head->next; curr != NULL; curr = curr->next)
+    // the request's own list may hold smaller blocks, only its front one is tried.
+    int size_class, sub_class;
+    GetSizeClass(size, &size_class, &sub_class);
+    MallocMetaData* front = this->free_heads[size_class][sub_class];
+    if (front != NULL && front->size >= size)
+    {
+        return front;
+    }
+    // every block of a later list fits, take the front one of the first.
+    unsigned int larger_subs = this->non_empty_subs[size_class] & (~0u << (sub_class + 1));
+    if (larger_subs != 0)
+    {
+        return this->free_heads[size_class][__builtin_ctz(larger_subs)];
+    }
+    unsigned long long larger_classes = (size_class + 1 < NUM_SIZE_CLASSES) ?
+        this->non_empty_classes & (~0ULL << (size_class + 1)) : 0;
+    if (larger_classes == 0)
+    {
+        return NULL;
+    }
+    size_class = __builtin_ctzll(larger_classes);
+    return this->free_heads[size_class][__builtin_ctz(this->non_empty_subs[size_class])];
+}
+
+void FreeList::InsertFreeBlock(MallocMetaData* block)
+{
+    int size_class, sub_class;
+    GetSizeClass(block->size, &size_class, &sub_class);
+    MallocMetaData* next = this->free_heads[size_class][sub_class];
+    block->prev_free = NULL;
+    block->next_free = next;
+    if (next != NULL)
     {
-        if (curr->size >= size && curr->is_free == true)
+        next->prev_free = block;
+    }
+    this->free_heads[size_class][sub_class] = block;
+    this->non_empty_subs[size_class] |= 1u << sub_class;
+    this->non_empty_classes |= 1ULL << size_class;
+}
+
+void FreeList::RemoveFreeBlock(MallocMetaData* block)
+{
+    int size_class, sub_class;
+    GetSizeClass(block->size, &size_class, &sub_class);
+    if (block->prev_free == NULL)
+    {
+        this->free_heads[size_class][sub_class] = block->next_free;
+    }
+    else
+    {
+        block->prev_free->next_free = block->next_free;
+    }
+    if (block->next_free != NULL)
+    {
+        block->next_free->prev_free = block->prev_free;
+    }
+    block->next_free = NULL;
+    block->prev_free = NULL;
+    if (this->free_heads[size_class][sub_class] == NULL)
+    {
+        this->non_empty_subs[size_class] &= ~(1u << sub_class);
+        if (this->non_empty_subs[size_class] == 0)
         {
-            return curr;
-        } 
+            this->non_empty_classes &= ~(1ULL << size_class);
+        }
+    }
+}
+
+#elif defined(MALLOC_2_BEST_FIT)
+// free blocks are ordered by size, then by address.
+static bool IsBefore(MallocMetaData* first, MallocMetaData* second)
+{
+    return first->size < second->size || (first->size == second->size && first < second);
+}
+
+MallocMetaData* FreeList::SearchBlock(size_t size)
+{
+    // the smallest block that fits, the lowest one of them if there are a few.
+    MallocMetaData *best = NULL;
+    MallocMetaData *curr = this->free_root;
+    while (curr != this->tree_nil)
+    {
+        if (curr->size >= size)
+        {
+            best = curr;
+            curr = curr->left;
+        }
+        else
+        {
+            curr = curr->right;
+        }
+    }
+    return best;
+}
+
+void FreeList::RotateLeft(MallocMetaData* block)
+{
+    MallocMetaData *child = block->right;
+    block->right = child->left;
+    if (child->left != this->tree_nil)
+    {
+        child->left->parent = block;
+    }
+    this->Transplant(block, child);
+    child->left = block;
+    block->parent = child;
+}
+
+void FreeList::RotateRight(MallocMetaData* block)
+{
+    MallocMetaData *child = block->left;
+    block->left = child->right;
+    if (child->right != this->tree_nil)
+    {
+        child->right->parent = block;
+    }
+    this->Transplant(block, child);
+    child->right = block;
+    block->parent = child;
+}
+
+// puts new_block where old_block hangs from its parent.
+void FreeList::Transplant(MallocMetaData* old_block, MallocMetaData* new_block)
+{
+    if (old_block->parent == this->tree_nil)
+    {
+        this->free_root = new_block;
+    }
+    else if (old_block == old_block->parent->left)
+    {
+        old_block->parent->left = new_block;
+    }
+    else
+    {
+        old_block->parent->right = new_block;
+    }
+    new_block->parent = old_block->parent;
+}
+
+void FreeList::InsertFreeBlock(MallocMetaData* block)
+{
+    MallocMetaData *parent = this->tree_nil;
+    MallocMetaData *curr = this->free_root;
+    while (curr != this->tree_nil)
+    {
+        parent = curr;
+        curr = IsBefore(block, curr) ? curr->left : curr->right;
+    }
+    block->parent = parent;
+    block->left = this->tree_nil;
+    block->right = this->tree_nil;
+    block->is_red = true;
+    if (parent == this->tree_nil)
+    {
+        this->free_root = block;
+    }
+    else if (IsBefore(block, parent))
+    {
+        parent->left = block;
+    }
+    else
+    {
+        parent->right = block;
+    }
+    this->FixInsertion(block);
+}
+
+// a red block may have a red parent after the insertion, recolor and rotate up the tree.
+void FreeList::FixInsertion(MallocMetaData* block)
+{
+    while (block->parent->is_red)
+    {
+        MallocMetaData *parent = block->parent;
+        MallocMetaData *grandparent = parent->parent;
+        bool parent_is_left = (parent == grandparent->left);
+        MallocMetaData *uncle = parent_is_left ? grandparent->right : grandparent->left;
+        if (uncle->is_red)
+        {
+            parent->is_red = false;
+            uncle->is_red = false;
+            grandparent->is_red = true;
+            block = grandparent;
+            continue;
+        }
+        if (parent_is_left && block == parent->right)
+        {
+            block = parent;
+            this->RotateLeft(block);
+        }
+        else if (!parent_is_left && block == parent->left)
+        {
+            block = parent;
+            this->RotateRight(block);
+        }
+        block->parent->is_red = false;
+        grandparent->is_red = true;
+        if (parent_is_left)
+        {
+            this->RotateRight(grandparent);
+        }
+        else
+        {
+            this->RotateLeft(grandparent);
+        }
+    }
+    this->free_root->is_red = false;
+}
+
+void FreeList::RemoveFreeBlock(MallocMetaData* block)
+{
+    MallocMetaData *moved = block; // the block that really leaves its place in the tree
+    bool moved_was_red = moved->is_red;
+    MallocMetaData *replacement;
+    if (block->left == this->tree_nil)
+    {
+        replacement = block->right;
+        this->Transplant(block, block->right);
+    }
+    else if (block->right == this->tree_nil)
+    {
+        replacement = block->left;
+        this->Transplant(block, block->left);
+    }
+    else
+    {
+        // the successor takes the block's place.
+        moved = block->right;
+        while (moved->left != this->tree_nil)
+        {
+            moved = moved->left;
+        }
+        moved_was_red = moved->is_red;
+        replacement = moved->right;
+        if (moved->parent == block)
+        {
+            replacement->parent = moved;
+        }
+        else
+        {
+            this->Transplant(moved, moved->right);
+            moved->right = block->right;
+            moved->right->parent = moved;
+        }
+        this->Transplant(block, moved);
+        moved->left = block->left;
+        moved->left->parent = moved;
+        moved->is_red = block->is_red;
+    }
+    if (!moved_was_red)
+    {
+        this->FixRemoval(replacement);
+    }
+    block->left = NULL;
+    block->right = NULL;
+    block->parent = NULL;
+}
+
+// a black block left the tree, the branch it was on has one black block too few.
+void FreeList::FixRemoval(MallocMetaData* block)
+{
+    while (block != this->free_root && !block->is_red)
+    {
+        MallocMetaData *parent = block->parent;
+        bool is_left = (block == parent->left);
+        MallocMetaData *sibling = is_left ? parent->right : parent->left;
+        if (sibling->is_red)
+        {
+            sibling->is_red = false;
+            parent->is_red = true;
+            if (is_left)
+            {
+                this->RotateLeft(parent);
+            }
+            else
+            {
+                this->RotateRight(parent);
+            }
+            sibling = is_left ? parent->right : parent->left;
+        }
+        MallocMetaData *near_child = is_left ? sibling->left : sibling->right;
+        MallocMetaData *far_child = is_left ? sibling->right : sibling->left;
+        if (!near_child->is_red && !far_child->is_red)
+        {
+            sibling->is_red = true;
+            block = parent;
+            continue;
+        }
+        if (!far_child->is_red)
+        {
+            near_child->is_red = false;
+            sibling->is_red = true;
+            if (is_left)
+            {
+                this->RotateRight(sibling);
+            }
+            else
+            {
+                this->RotateLeft(sibling);
+            }
+            sibling = is_left ? parent->right : parent->left;
+            far_child = is_left ? sibling->right : sibling->left;
+        }
+        sibling->is_red = parent->is_red;
+        parent->is_red = false;
+        far_child->is_red = false;
+        if (is_left)
+        {
+            this->RotateLeft(parent);
+        }
+        else
+        {
+            this->RotateRight(parent);
+        }
+        block = this->free_root;
+    }
+    block->is_red = false;
+}
+#else
+typedef MallocMetaData* (*ScanIndexKernel)(const uint32_t* sizes, MallocMetaData* const* blocks, size_t count,
+                                           uint32_t size);
+
+// the smallest index entry that fits from begin on, NO_FIT if none does.
+static uint32_t SmallestFit(const uint32_t* sizes, size_t begin, size_t count, uint32_t size, uint32_t smallest)
+{
+    for (size_t i = begin; i < count; i++)
+    {
+        if (sizes[i] >= size && sizes[i] < smallest)
+        {
+            smallest = sizes[i];
+        }
+    }
+    return smallest;
+}
+
+// between two blocks whose entries are equal, the smaller one (past INDEX_SIZE_LIMIT), then the lower one.
+static MallocMetaData* PickBetter(MallocMetaData* block, MallocMetaData* best)
+{
+    if (best == NULL || block->size < best->size || (block->size == best->size && block < best))
+    {
+        return block;
+    }
+    return best;
+}
+
+static MallocMetaData* PickLowest(const uint32_t* sizes, MallocMetaData* const* blocks, size_t begin, size_t count,
+                                  uint32_t smallest, MallocMetaData* best)
+{
+    for (size_t i = begin; i < count; i++)
+    {
+        if (sizes[i] == smallest)
+        {
+            best = PickBetter(blocks[i], best);
+        }
+    }
+    return best;
+}
+
+static MallocMetaData* ScanIndexScalar(const uint32_t* sizes, MallocMetaData* const* blocks, size_t count,
+                                       uint32_t size)
+{
+    uint32_t smallest = SmallestFit(sizes, 0, count, size, NO_FIT);
+    return (smallest == NO_FIT) ? NULL : PickLowest(sizes, blocks, 0, count, smallest, NULL);
+}
+
+#ifdef MEM_KERNELS_X86
+// two passes: the smallest size that fits (an unsigned min of the sizes, with the ones too small masked to
+// NO_FIT), then the blocks of that size, found by compare and movemask, usually only a few.
+__attribute__((target("avx2")))
+static MallocMetaData* ScanIndexAVX2(const uint32_t* sizes, MallocMetaData* const* blocks, size_t count,
+                                     uint32_t size)
+{
+    const __m256i wanted = _mm256_set1_epi32((int)size);
+    const __m256i no_fit = _mm256_set1_epi32(-1);
+    __m256i smallest_lanes = no_fit;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i curr = _mm256_loadu_si256((const __m256i*)(sizes + i));
+        __m256i fits = _mm256_cmpeq_epi32(_mm256_max_epu32(curr, wanted), curr);
+        smallest_lanes = _mm256_min_epu32(smallest_lanes, _mm256_or_si256(curr, _mm256_andnot_si256(fits, no_fit)));
+    }
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, smallest_lanes);
+    uint32_t smallest = SmallestFit(sizes, i, count, size, SmallestFit(lanes, 0, 8, size, NO_FIT));
+    if (smallest == NO_FIT)
+    {
+        return NULL;
+    }
+    const __m256i target = _mm256_set1_epi32((int)smallest);
+    MallocMetaData* best = NULL;
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        __m256i curr = _mm256_loadu_si256((const __m256i*)(sizes + i));
+        unsigned int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(curr, target)));
+        for (; mask != 0; mask &= mask - 1)
+        {
+            best = PickBetter(blocks[i + __builtin_ctz(mask)], best);
+        }
     }
-    return NULL;
+    return PickLowest(sizes, blocks, i, count, smallest, best);
 }
 
+__attribute__((target("sse4.1")))
+static MallocMetaData* ScanIndexSSE41(const uint32_t* sizes, MallocMetaData* const* blocks, size_t count,
+                                      uint32_t size)
+{
+    const __m128i wanted = _mm_set1_epi32((int)size);
+    const __m128i no_fit = _mm_set1_epi32(-1);
+    __m128i smallest_lanes = no_fit;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i curr = _mm_loadu_si128((const __m128i*)(sizes + i));
+        __m128i fits = _mm_cmpeq_epi32(_mm_max_epu32(curr, wanted), curr);
+        smallest_lanes = _mm_min_epu32(smallest_lanes, _mm_or_si128(curr, _mm_andnot_si128(fits, no_fit)));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, smallest_lanes);
+    uint32_t smallest = SmallestFit(sizes, i, count, size, SmallestFit(lanes, 0, 4, size, NO_FIT));
+    if (smallest == NO_FIT)
+    {
+        return NULL;
+    }
+    const __m128i target = _mm_set1_epi32((int)smallest);
+    MallocMetaData* best = NULL;
+    for (i = 0; i + 4 <= count; i += 4)
+    {
+        __m128i curr = _mm_loadu_si128((const __m128i*)(sizes + i));
+        unsigned int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(curr, target)));
+        for (; mask != 0; mask &= mask - 1)
+        {
+            best = PickBetter(blocks[i + __builtin_ctz(mask)], best);
+        }
+    }
+    return PickLowest(sizes, blocks, i, count, smallest, best);
+}
+#endif /* MEM_KERNELS_X86 */
+
+static ScanIndexKernel GetScanIndexKernel()
+{
+    static ScanIndexKernel kernel = NULL;
+    if (kernel == NULL)
+    {
+        kernel = ScanIndexScalar;
+#ifdef MEM_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            kernel = ScanIndexAVX2;
+        }
+        else if (__builtin_cpu_supports("sse4.1"))
+        {
+            kernel = ScanIndexSSE41;
+        }
+#endif
+    }
+    return kernel;
+}
+
+MallocMetaData* FreeList::SearchBlock(size_t size)
+{
+    // size is at most MAX_SIZE, below INDEX_SIZE_LIMIT: a capped entry always fits.
+    return GetScanIndexKernel()(this->free_sizes, this->free_blocks, this->index_count, (uint32_t)size);
+}
+
+// the arrays are mapped, never taken from the heap, and double when they're full.
+bool FreeList::GrowIndex()
+{
+    size_t capacity = (this->index_capacity == 0) ? INDEX_INITIAL_CAPACITY : 2 * this->index_capacity;
+    void* sizes = mmap(NULL, capacity * sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void* blocks = mmap(NULL, capacity * sizeof(MallocMetaData*), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (sizes == MAP_FAILED || blocks == MAP_FAILED)
+    {
+        if (sizes != MAP_FAILED)
+        {
+            munmap(sizes, capacity * sizeof(uint32_t));
+        }
+        if (blocks != MAP_FAILED)
+        {
+            munmap(blocks, capacity * sizeof(MallocMetaData*));
+        }
+        return false;
+    }
+    if (this->index_capacity != 0)
+    {
+        memcpy(sizes, this->free_sizes, this->index_count * sizeof(uint32_t));
+        memcpy(blocks, this->free_blocks, this->index_count * sizeof(MallocMetaData*));
+        munmap(this->free_sizes, this->index_capacity * sizeof(uint32_t));
+        munmap(this->free_blocks, this->index_capacity * sizeof(MallocMetaData*));
+    }
+    this->free_sizes = (uint32_t*)sizes;
+    this->free_blocks = (MallocMetaData**)blocks;
+    this->index_capacity = capacity;
+    return true;
+}
+
+// there's room for every block in the heap, reserved before it was made: freeing one never has to grow the index.
+bool FreeList::ReserveIndex(size_t num_blocks)
+{
+    while (this->index_capacity < num_blocks)
+    {
+        if (!this->GrowIndex())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FreeList::InsertFreeBlock(MallocMetaData* block)
+{
+    block->free_index = this->index_count;
+    this->free_sizes[this->index_count] = (block->size < INDEX_SIZE_LIMIT) ? (uint32_t)block->size : INDEX_SIZE_LIMIT;
+    this->free_blocks[this->index_count] = block;
+    this->index_count++;
+}
+
+void FreeList::RemoveFreeBlock(MallocMetaData* block)
+{
+    // the last entry takes the block's place.
+    size_t index = block->free_index;
+    if (index == NOT_INDEXED)
+    {
+        return;
+    }
+    this->index_count--;
+    MallocMetaData* last = this->free_blocks[this->index_count];
+    this->free_sizes[index] = this->free_sizes[this->index_count];
+    this->free_blocks[index] = last;
+    last->free_index = index;
+    block->free_index = NOT_INDEXED;
+}
+#endif
+#ifndef MALLOC_2_SIMD_INDEX
+// the size classes and the tree are linked through the blocks themselves, there's nothing to reserve.
+bool FreeList::ReserveIndex(size_t num_blocks)
+{
+    (void)num_blocks;
+    return true;
+}
+#endif
+
 void FreeList::AddMetaData_Block(MallocMetaData* data, size_t size)
 {
     data->size = size;
     data->is_free = false;
 
-    for ( MallocMetaData *curr = this->head; curr != NULL; curr = curr->next)
+    this->tail->next = data;
+    data->prev = this->tail;
+    data->next = NULL;
+    this->tail = data;
+}
+
+static char* GetBlockEnd(MallocMetaData* block)
+{
+    return (char*)block + sizeof(MallocMetaData) + block->size;
+}
+
+// the block list is in address order, but something else may have moved the program break in between.
+static bool AreAdjacent(MallocMetaData* first, MallocMetaData* second)
+{
+    return GetBlockEnd(first) == (char*)second;
+}
+
+void FreeList::SplitBlock(MallocMetaData* block, size_t size)
+{
+    // the block is counted, or was a moment ago: the rest is at most the second block past the counters.
+    if (block->size < size + sizeof(MallocMetaData) + MIN_SPLIT_SIZE ||
+        !this->ReserveIndex(this->num_allocated_blocks + this->num_free_blocks + 2))
     {
-        if (curr->next == NULL)
-        {
-            curr->next = data;
-            data->prev = curr;
-            data->next = NULL;
-            break;
-        } 
+        return;
+    }
+    MallocMetaData* rest = (MallocMetaData*)((char*)block + sizeof(MallocMetaData) + size);
+    rest->size = block->size - size - sizeof(MallocMetaData);
+    rest->is_free = true;
+    // past the first page of its payload, the rest is as untouched as the block was.
+    rest->is_zeroed = block->is_zeroed;
+    rest->next = block->next;
+    rest->prev = block;
+    if (block->next == NULL)
+    {
+        this->tail = rest;
+    }
+    else
+    {
+        block->next->prev = rest;
+    }
+    block->next = rest;
+    block->size = size;
+    // a free block's neighbors are never free, the rest doesn't have to be coalesced.
+    this->InsertFreeBlock(rest);
+    this->num_free_blocks++;
+    this->num_free_bytes += rest->size;
+}
+
+// the next block's metadata becomes part of the payload, both have to be out of the size classes.
+void FreeList::AbsorbNextBlock(MallocMetaData* block)
+{
+    MallocMetaData* next = block->next;
+    block->size += sizeof(MallocMetaData) + next->size;
+    block->is_zeroed = false;
+    block->next = next->next;
+    if (next->next == NULL)
+    {
+        this->tail = block;
+    }
+    else
+    {
+        next->next->prev = block;
+    }
+    this->num_free_blocks--;
+    this->num_free_bytes += sizeof(MallocMetaData);
+}
+
+// merges a block that was just freed with its free neighbors, the headers' links are the boundary tags.
+MallocMetaData* FreeList::CoalesceBlock(MallocMetaData* block)
+{
+    MallocMetaData* next = block->next;
+    if (next != NULL && next->is_free && AreAdjacent(block, next))
+    {
+        this->RemoveFreeBlock(next);
+        this->AbsorbNextBlock(block);
+    }
+    MallocMetaData* prev = block->prev;
+    if (prev != this->head && prev->is_free && AreAdjacent(prev, block))
+    {
+        this->RemoveFreeBlock(prev);
+        this->AbsorbNextBlock(prev);
+        block = prev;
     }
+    return block;
 }
 
 static MallocMetaData head_data = MallocMetaData();
-static FreeList free_list = FreeList(&head_data);
+static MallocMetaData tree_nil = MallocMetaData();
+static FreeList free_list = FreeList(&head_data, &tree_nil);
+
+#ifdef MALLOC_HUGE_ALLOCATIONS
+// above MAX_SIZE a block is mapped on its own (see huge_alloc.h), it never joins the heap's lists.
+static void* HugeAllocate(size_t size)
+{
+    MallocMetaData* block = (MallocMetaData*)hugeMap(size, sizeof(MallocMetaData));
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    block->size = size;
+    block->is_free = false;
+    block->is_zeroed = true;
+    block->next = NULL;
+    block->prev = NULL;
+    return (void*)((char*)block + sizeof(MallocMetaData));
+}
+
+static bool IsHugeBlock(MallocMetaData* block)
+{
+    return block->size > MAX_SIZE;
+}
+#endif
 
 void *smalloc(size_t size)
 {
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    if (size > MAX_SIZE)
+    {
+        return HugeAllocate(size);
+    }
+#endif
     if (size <= 0 || size > MAX_SIZE)
     {    
         return NULL;
     }
     MallocMetaData* wanted_block = free_list.SearchBlock(size); 
+    MallocMetaData* last_block = free_list.tail;
+    if (wanted_block == NULL && last_block->is_free && GetBlockEnd(last_block) == sbrk(0))
+    {
+        // wilderness: the free block at the top of the heap only needs the missing part.
+        if (sbrk(size - last_block->size) == (void*)(-1))
+        {
+            return NULL;
+        }
+        free_list.RemoveFreeBlock(last_block);
+        free_list.num_free_blocks--;
+        free_list.num_free_bytes -= last_block->size;
+        last_block->size = size;
+        last_block->is_free = false;
+        free_list.num_allocated_blocks++;
+        free_list.num_allocated_bytes += size;
+        return (void*)((char*)(last_block) + sizeof(MallocMetaData));
+    }
     if(wanted_block == NULL)
     {
         // allocate a proper block
+        if (!free_list.ReserveIndex(free_list.num_allocated_blocks + free_list.num_free_blocks + 1))
+        {
+            return NULL;
+        }
         void *old_porogram_break = sbrk(0);
         void* allocation = sbrk(size + sizeof(MallocMetaData));
-        free_list.num_allocated_bytes += size;
-        free_list.num_allocated_blocks++; 
         if(allocation == (void*)(-1))
         {
             return NULL;
         }
+        free_list.num_allocated_bytes += size;
+        free_list.num_allocated_blocks++; 
 
         free_list.AddMetaData_Block( static_cast<MallocMetaData*>(old_porogram_break) , size);
+        // sbrk() hands out fresh pages, only the page holding the metadata may have been used before.
+        static_cast<MallocMetaData*>(old_porogram_break)->is_zeroed = true;
         return (void*)( (char*)(old_porogram_break) + sizeof(MallocMetaData));
     }
     else
     {
-        // reuse previous block
+        // reuse previous block, what it doesn't need is split off when it's big enough.
+        free_list.RemoveFreeBlock(wanted_block);
         wanted_block->is_free = false;
-        free_list.num_allocated_blocks++;
         free_list.num_free_blocks--;
-        free_list.num_allocated_bytes += wanted_block->size;
         free_list.num_free_bytes -= wanted_block->size;
+        free_list.SplitBlock(wanted_block, size);
+        free_list.num_allocated_blocks++;
+        free_list.num_allocated_bytes += wanted_block->size;
         return (void*) ( (char*)(wanted_block) + sizeof(MallocMetaData));
     }
     
 }
 
+static void zeroAllocation(void* allocation, size_t size)
+{
+    MallocMetaData *p_metadata = (MallocMetaData*)((char*)allocation - sizeof(MallocMetaData));
+    size_t dirty_size = size;
+    if (p_metadata->is_zeroed)
+    {
+        // skip the untouched pages so they're not faulted in, clear only up to the first page boundary.
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t page_offset = (size_t)allocation % page_size;
+        dirty_size = (page_offset == 0) ? 0 : (page_size - page_offset);
+        if (dirty_size > size)
+        {
+            dirty_size = size;
+        }
+    }
+    bulkMemset(allocation, 0, dirty_size);
+}
+
 void *scalloc(size_t num, size_t size)
 {
-    if (num <= 0 || size <= 0 || (size*num) > MAX_SIZE)
+    size_t total;
+    // smalloc() turns down what's too large, an overflowing product would wrap around to a small size.
+    if (num <= 0 || size <= 0 || __builtin_mul_overflow(num, size, &total))
     {
         return NULL;
     }
 
-    void* allocation = smalloc(num*size);
+    void* allocation = smalloc(total);
     if(allocation == NULL)
     {
         return NULL;
     }
-    memset(allocation, 0, num*size);   
+    zeroAllocation(allocation, total);
     return allocation;
 }
 
@@ -135,6 +957,13 @@ void sfree(void* p)
     }
     
     MallocMetaData *p_metadata = (MallocMetaData*)((char*)p - sizeof(MallocMetaData));
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    if (IsHugeBlock(p_metadata))
+    {
+        hugeUnmap(p_metadata, p_metadata->size, sizeof(MallocMetaData));
+        return;
+    }
+#endif
     if(p_metadata->is_free == true)
     {
         return;
@@ -146,12 +975,80 @@ void sfree(void* p)
         free_list.num_allocated_bytes -= p_metadata->size;
         free_list.num_free_bytes += p_metadata->size;
         p_metadata->is_free = true;
+        p_metadata->is_zeroed = false;
+        free_list.InsertFreeBlock(free_list.CoalesceBlock(p_metadata));
     }
 }
 
 
+// grows a used block where it is: into the free block right after it, then past the program break if it's
+// at the top of the heap. The block keeps what it got even if sbrk() fails.
+static bool ExpandInPlace(MallocMetaData* block, size_t size)
+{
+    MallocMetaData* next = block->next;
+    if (next != NULL && next->is_free && AreAdjacent(block, next) &&
+        (block->size + sizeof(MallocMetaData) + next->size >= size ||
+         (next == free_list.tail && GetBlockEnd(next) == sbrk(0))))
+    {
+        size_t absorbed = sizeof(MallocMetaData) + next->size;
+        free_list.RemoveFreeBlock(next);
+        free_list.AbsorbNextBlock(block);
+        free_list.num_free_bytes -= absorbed; // AbsorbNextBlock() counted the header as free
+        free_list.num_allocated_bytes += absorbed;
+    }
+    if (block->size < size && block == free_list.tail && GetBlockEnd(block) == sbrk(0))
+    {
+        if (sbrk(size - block->size) == (void*)(-1))
+        {
+            return false;
+        }
+        free_list.num_allocated_bytes += size - block->size;
+        block->size = size;
+    }
+    if (block->size < size)
+    {
+        return false;
+    }
+    size_t old_size = block->size;
+    free_list.SplitBlock(block, size);
+    free_list.num_allocated_bytes -= old_size - block->size;
+    return true;
+}
+
+#ifdef MALLOC_HUGE_ALLOCATIONS
+// a huge block to or from any size, or a heap block to a huge size.
+static void* HugeReallocate(MallocMetaData* block, size_t size)
+{
+    void* oldp = (void*)((char*)block + sizeof(MallocMetaData));
+    if (IsHugeBlock(block) && size > MAX_SIZE)
+    {
+        MallocMetaData* moved = (MallocMetaData*)hugeRemap(block, block->size, size, sizeof(MallocMetaData));
+        if (moved == NULL)
+        {
+            return NULL;
+        }
+        moved->size = size;
+        return (void*)((char*)moved + sizeof(MallocMetaData));
+    }
+    void* allocation = smalloc(size);
+    if (allocation == NULL)
+    {
+        return NULL;
+    }
+    bulkMemmove(allocation, oldp, (block->size < size) ? block->size : size);
+    sfree(oldp);
+    return allocation;
+}
+#endif
+
 void* srealloc(void* oldp, size_t size)
 {
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    if (size > MAX_SIZE || (oldp != NULL && IsHugeBlock((MallocMetaData*)((char*)oldp - sizeof(MallocMetaData)))))
+    {
+        return (oldp == NULL) ? smalloc(size) : HugeReallocate((MallocMetaData*)((char*)oldp - sizeof(MallocMetaData)), size);
+    }
+#endif
     if (size <= 0 || size > MAX_SIZE)
     {
         return NULL;
@@ -165,15 +1062,16 @@ void* srealloc(void* oldp, size_t size)
     {
         return oldp;
     }
-    void* allocation = smalloc(size);
-    if(allocation == NULL)
+    if (ExpandInPlace(p_metadata, size))
     {
-        return NULL;
+        return oldp;
     }
-    if(memmove(allocation, oldp, p_metadata->size) != allocation) 
+    void* allocation = smalloc(size);
+    if(allocation == NULL)
     {
         return NULL;
     }
+    bulkMemmove(allocation, oldp, p_metadata->size);
     sfree(oldp);
     return allocation;
 }
@@ -206,4 +1104,23 @@ size_t _size_meta_data()
 size_t _num_meta_data_bytes()
 {
     return (_size_meta_data() * _num_allocated_blocks());
+}
+
+// huge allocations (-DMALLOC_HUGE_ALLOCATIONS) aren't counted by the functions above.
+size_t _num_huge_allocations()
+{
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    return huge_alloc_stats.num_blocks;
+#else
+    return 0;
+#endif
+}
+
+size_t _num_huge_allocation_bytes()
+{
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    return huge_alloc_stats.num_bytes;
+#else
+    return 0;
+#endif
 }
\ No newline at end of file
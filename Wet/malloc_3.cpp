@@ -4,14 +4,47 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <cmath> // necessary for calculations
+#include "mem_kernels.h"
+#include "malloc_3.h"
+#include "heap_snapshot.h"
+#include "alloc_trace.h"
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifdef MALLOC_HEAP_PROFILER
+#include <execinfo.h>
+#endif
+#ifdef MALLOC_HUGE_ALLOCATIONS
+#include "huge_alloc.h"
+#endif
+#if defined(MALLOC_LATENCY_STATS) || defined(MALLOC_TRACE)
+#include <time.h>
+#endif
+#ifdef MALLOC_LATENCY_STATS
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 #define MAX_SIZE (1e8)
+#ifdef MALLOC_HUGE_ALLOCATIONS
+#define SIZE_LIMIT HUGE_ALLOC_MAX_SIZE // past MAX_SIZE, blocks are huge allocations (see huge_alloc.h)
+#else
+#define SIZE_LIMIT MAX_SIZE
+#endif
 #define KB (1024)
+#define MB (1024*KB)
 #define MY_MMAP_THRESHOLD (128*KB)
 #define DEFAULT_BUDDY_BLOCK (128*KB)
 #define MIN_BUDDY_BLOCK (128)
 #define BUDDY_BLOCKS_NUM 32
 #define MAX_ORDER 10
+static_assert(SMALLOC_NUM_ORDERS == MAX_ORDER + 1, "malloc_3.h has to agree on the number of orders");
+#define HUGE_PAGE_SIZE (2*MB)
+#define MIN_ALIGNMENT 16 // of every payload: blocks start at multiples of 128 bytes (or of a page) and the metadata is 48 bytes
+// build with -DMALLOC_HUGE_PAGES to back the buddy region and large (>= HUGE_PAGE_SIZE) mappings with huge pages.
+// build with -DMALLOC_GROWABLE_HEAP to add BUDDY_BLOCKS_NUM more roots at the program break whenever the buddy
+// region is full, instead of failing the request. It only grows while nothing else has moved the break.
 
 void DEBUG_PrintList(); // to remove
 
@@ -19,12 +52,17 @@ class MallocMetaData
 {
 public:
     int cookies; // it's essential that the cookies are placed at the beginning of the block.
+    unsigned int requested_size; // what the user asked for, buddy blocks only (mmap chunks are exactly their size).
     size_t size;
     bool is_free;
+    bool is_huge; // the block lives in huge-page backed memory.
+    bool is_zeroed; // only meaningful while the block is free: every payload page past the first one was never touched.
+    bool is_sampled; // the block was picked by the heap profiler.
+    unsigned int trace_id; // the id the allocation trace knows the block by, 0 when it isn't traced.
     void* addr;
     MallocMetaData* next;
     MallocMetaData* prev;
-    MallocMetaData(int cookies = 0, size_t size = 0, bool is_free = false, MallocMetaData* next = NULL, MallocMetaData* prev = NULL);
+    constexpr MallocMetaData(int cookies = 0, size_t size = 0, bool is_free = false, MallocMetaData* next = NULL, MallocMetaData* prev = NULL);
     ~MallocMetaData() = default;
     bool operator==(MallocMetaData& other);
     bool operator< (MallocMetaData& other);
@@ -33,14 +71,22 @@ public:
     bool operator<=(MallocMetaData& other);
 };
 
-MallocMetaData::MallocMetaData(int cookies, size_t size, bool is_free, MallocMetaData* next, MallocMetaData* prev):
+constexpr MallocMetaData::MallocMetaData(int cookies, size_t size, bool is_free, MallocMetaData* next, MallocMetaData* prev):
     cookies(cookies),
+    requested_size(0),
     size(size),
     is_free(is_free),
+    is_huge(false),
+    is_zeroed(false),
+    is_sampled(false),
+    trace_id(0),
+    addr(NULL),
     next(next),
     prev(prev)
 {}
 
+static_assert(sizeof(MallocMetaData) % MIN_ALIGNMENT == 0, "the metadata mustn't break the payload alignment");
+
 bool MallocMetaData::operator==(MallocMetaData& other)
 {
     return (this->size == other.size && this->addr == other.addr);
@@ -74,56 +120,6 @@ bool MallocMetaData::operator<=(MallocMetaData& other)
     return( !((*this) > other) );
 }
 
-static void Swap(MallocMetaData* A, MallocMetaData* B)
-{
-    if(!A || !B) //sanity check
-        return;
-    
-    if(*A < *B)
-    {
-        MallocMetaData* tmp = A;
-        A = B;
-        B = tmp;
-    }
-
-    MallocMetaData* prevA = A->prev;
-    MallocMetaData* nextA = A->next;
-    MallocMetaData* prevB = B->prev;
-    MallocMetaData* nextB = B->next;
-    
-    if(prevA != NULL)
-    {
-        prevA->next = B;
-    }
-    if(nextA != NULL && nextA != B)
-    {
-        nextA->prev = B;
-    }
-
-    
-    if(nextB != NULL)
-    {
-        nextB->prev = A;
-    }
-    if(prevB != NULL && prevB != A)
-    {
-        prevB->next = A;
-    }
-
-    B->prev = prevA;
-    if(nextA != B)
-        B->next = nextA;
-    else
-        B->next = A;
-
-    A->next = nextB;
-    if(prevB != A)
-        A->prev = prevB;
-    else
-        A->prev = B;
-
-}
-
 static void initializeData(MallocMetaData* head_datas, MallocMetaData* tail_datas)
 {
     for (int i = 0; i < (BUDDY_BLOCKS_NUM+1); i++)
@@ -158,23 +154,26 @@ class MyList
 public:
     MallocMetaData* head;
     MallocMetaData* tail;
-    MyList();
+    size_t num_free_blocks; // kept by insert() and removeBlock(), a block's is_free only changes off the list
+    size_t num_used_blocks;
+    constexpr MyList();
     MyList(MallocMetaData* head_node, MallocMetaData* tail_node);
     ~MyList() = default;
     void insert(MallocMetaData* node);
-    void SortMallocMetaDataList(MallocMetaData* head_node, MallocMetaData* tail_node);
-    MallocMetaData* findBlock(MallocMetaData block);
     int removeBlock(MallocMetaData* block);
 };
 
-MyList::MyList()
-{
-    this->head = NULL;
-    this->tail = NULL;
-}
+constexpr MyList::MyList():
+    head(NULL),
+    tail(NULL),
+    num_free_blocks(0),
+    num_used_blocks(0)
+{}
 
 MyList::MyList(MallocMetaData* head_node, MallocMetaData* tail_node)
 {
+    this->num_free_blocks = 0;
+    this->num_used_blocks = 0;
     this->head = head_node;
     if (this->head)
     {
@@ -187,67 +186,41 @@ MyList::MyList(MallocMetaData* head_node, MallocMetaData* tail_node)
     }
 }
 
+// the free blocks come first, the last one freed at the front, then the used ones: the front block is the one to take.
 void MyList::insert(MallocMetaData* node)
 {
-    node->next = this->tail;
-    node->prev = this->tail->prev;
-    this->tail->prev->next = node;
-    this->tail->prev = node;
-    SortMallocMetaDataList(this->head, this->tail);
-}
-
-void MyList::SortMallocMetaDataList(MallocMetaData* head_node, MallocMetaData* tail_node)
-{
-    size_t list_size = 0;
-    for ( MallocMetaData *curr = this->head->next; curr != tail_node; curr = curr->next)
+    MallocMetaData* prev = (node->is_free) ? this->head : this->tail->prev;
+    node->prev = prev;
+    node->next = prev->next;
+    prev->next->prev = node;
+    prev->next = node;
+    if (node->is_free)
     {
-        list_size++; 
-    }
-    
-    if(list_size <= 1)
-    {
-        return;
+        this->num_free_blocks += 1;
     }
-    
-    for (MallocMetaData *curr = this->head->next; curr != tail_node; curr = curr->next)
+    else
     {
-        for (MallocMetaData *curr_inner = curr->next; curr_inner != tail_node; curr_inner = curr_inner->next )
-        {
-            if ( (*curr_inner) < (*curr) )
-            {
-                Swap(curr_inner ,curr ); 
-                MallocMetaData* tmp = curr_inner;
-                curr_inner = curr;
-                curr = tmp;  
-            }
-        }   
+        this->num_used_blocks += 1;
     }
 }
 
-MallocMetaData* MyList::findBlock(MallocMetaData block)
-{
-    for (MallocMetaData *curr = this->head->next; curr != this->tail; curr = curr->next )
-    {
-        if ( (*curr) == block )
-        {
-            return curr;
-        }
-    } 
-    return NULL;  
-}
-
 int MyList::removeBlock(MallocMetaData* block)
 {
-    MallocMetaData* found = findBlock(*block);
-    if (!found)
+    if (block->prev == NULL || block->next == NULL)
     {
         return -1;
     }
+    block->prev->next = block->next;
+    block->next->prev = block->prev;
+    block->next = NULL;
+    block->prev = NULL;
+    if (block->is_free)
+    {
+        this->num_free_blocks -= 1;
+    }
     else
     {
-        MallocMetaData* tmp = block->prev;
-        block->prev->next = block->next;
-        block->next->prev = tmp;
+        this->num_used_blocks -= 1;
     }
     return 1;
 }
@@ -260,28 +233,35 @@ public:
     MallocMetaData* tail;
     void* wasted_block;
     size_t wasted_block_size;
+    void* buddy_region;
+    size_t num_roots; // of DEFAULT_BUDDY_BLOCK bytes each, back to back from buddy_region
     MyList orders_list[ MAX_ORDER + 1];
 
     size_t num_allocated_bytes;
     size_t num_free_bytes;
     size_t num_allocated_blocks;
     size_t num_free_blocks;
+    size_t num_huge_page_bytes;
+    size_t num_splits;
+    size_t num_merges;
+    size_t num_requested_bytes;
 
-    FreeList(MallocMetaData* head_node, MallocMetaData* tail_node, MallocMetaData* head_datas, MallocMetaData* tail_datas);
+    constexpr FreeList();
     ~FreeList() = default;
+    void initialize(MallocMetaData* head_node, MallocMetaData* tail_node, MallocMetaData* head_datas, MallocMetaData* tail_datas);
     void initializeBuddySystem(MallocMetaData* head_nodes, MallocMetaData* tail_nodes);
-    void SortMallocMetaDataList(MallocMetaData* head_node, MallocMetaData* tail_node);
+    void addRoots(void* roots, int count);
+#ifdef MALLOC_GROWABLE_HEAP
+    bool growBuddySystem();
+#endif
     MallocMetaData* findBlock(size_t required_size);
     MallocMetaData* splitBlock(MallocMetaData* data, size_t min_size);
     MallocMetaData* mergeBlocks(MallocMetaData* prev, MallocMetaData* curr);
-    MallocMetaData* findNextBuddy(MallocMetaData* block);
-    MallocMetaData* findPreviousBuddy(MallocMetaData* block);
-    void insertToFreeList(MallocMetaData* block);
-    void deleteFromFreeList(MallocMetaData* block);
-    void* addMapping(size_t size);
+    MallocMetaData* findBuddy(MallocMetaData* block);
     void* allocateBlock(size_t size);
-    void removeMapping(MallocMetaData* block);
     bool isBlockContainable(MallocMetaData* block, size_t required_size);
+    void setRequestedSize(MallocMetaData* block, size_t requested_size);
+    void setBlockFree(MallocMetaData* block, bool is_free);
 };
 
 void FreeList::initializeBuddySystem(MallocMetaData* head_nodes, MallocMetaData* tail_nodes)
@@ -297,24 +277,82 @@ void FreeList::initializeBuddySystem(MallocMetaData* head_nodes, MallocMetaData*
 
     // allocate the new aray of size (32*128*KB)
     void* new_list = sbrk(32*128*KB);
-    for (int i = 0; i < BUDDY_BLOCKS_NUM; i++)
+    this->buddy_region = new_list;
+    this->addRoots(new_list, BUDDY_BLOCKS_NUM);
+    this->num_allocated_blocks = 0;
+    this->num_allocated_bytes = 0;
+}
+
+// count free roots of order MAX_ORDER from roots on, a multiple of (32*128*KB) bytes past the start of the region.
+void FreeList::addRoots(void* roots, int count)
+{
+    bool is_huge = false;
+#ifdef MALLOC_HUGE_PAGES
+    // the roots are aligned to (32*128*KB), so they're made only of whole huge pages.
+    if (madvise(roots, count*DEFAULT_BUDDY_BLOCK, MADV_HUGEPAGE) == 0)
+    {
+        is_huge = true;
+        this->num_huge_page_bytes += count*DEFAULT_BUDDY_BLOCK;
+    }
+#endif
+    // from the last one down, so the lowest root ends up at the front of its list.
+    for (int i = count - 1; i >= 0; i--)
     {
-        MallocMetaData* curr = (MallocMetaData*)((char*)new_list + (i*DEFAULT_BUDDY_BLOCK));
-        // MallocMetaData* next = (MallocMetaData*)((char*)new_list + ((i+1)*DEFAULT_BUDDY_BLOCK));
-        // MallocMetaData* prev = (MallocMetaData*)((char*)new_list + ((i-1)*DEFAULT_BUDDY_BLOCK));
+        MallocMetaData* curr = (MallocMetaData*)((char*)roots + (i*DEFAULT_BUDDY_BLOCK));
         curr->size = (128*KB) - sizeof(MallocMetaData);
         curr->is_free = true;
+        curr->is_huge = is_huge;
+        curr->is_zeroed = true; // fresh sbrk() pages.
+        curr->is_sampled = false;
+        curr->requested_size = 0;
         curr->cookies = this->cookies;
         curr->addr = (void*)((char*)curr + sizeof(MallocMetaData));
-        this->orders_list[MAX_ORDER].insert(curr); // at the beginning they're all inserted with size = 128KB
+        this->orders_list[MAX_ORDER].insert(curr); // they're all inserted with size = 128KB
         this->num_free_bytes += curr->size;
         this->num_free_blocks += 1;
     }
-    this->num_allocated_blocks = 0;
-    this->num_allocated_bytes = 0;
+    this->num_roots += count;
+}
+
+#ifdef MALLOC_GROWABLE_HEAP
+// the new roots have to follow the last one: a buddy is found by its offset from buddy_region.
+bool FreeList::growBuddySystem()
+{
+    char* region_end = (char*)this->buddy_region + this->num_roots*DEFAULT_BUDDY_BLOCK;
+    if (this->buddy_region == NULL || sbrk(0) != region_end)
+    {
+        return false;
+    }
+    void* new_roots = sbrk(BUDDY_BLOCKS_NUM*DEFAULT_BUDDY_BLOCK);
+    if (new_roots == (void*)(-1))
+    {
+        return false;
+    }
+    this->addRoots(new_roots, BUDDY_BLOCKS_NUM);
+    return true;
 }
+#endif
+
+constexpr FreeList::FreeList():
+    cookies(0),
+    head(NULL),
+    tail(NULL),
+    wasted_block(NULL),
+    wasted_block_size(0),
+    buddy_region(NULL),
+    num_roots(0),
+    orders_list(),
+    num_allocated_bytes(0),
+    num_free_bytes(0),
+    num_allocated_blocks(0),
+    num_free_blocks(0),
+    num_huge_page_bytes(0),
+    num_splits(0),
+    num_merges(0),
+    num_requested_bytes(0)
+{}
 
-FreeList::FreeList(MallocMetaData* head_node, MallocMetaData* tail_node, MallocMetaData* head_datas, MallocMetaData* tail_datas)
+void FreeList::initialize(MallocMetaData* head_node, MallocMetaData* tail_node, MallocMetaData* head_datas, MallocMetaData* tail_datas)
 {
     srand(0);
     this->cookies = rand();
@@ -333,51 +371,31 @@ FreeList::FreeList(MallocMetaData* head_node, MallocMetaData* tail_node, MallocM
     this->num_allocated_blocks = 0;
     this->num_free_bytes = 0;
     this->num_allocated_bytes = 0;
-}
-
-void FreeList::SortMallocMetaDataList(MallocMetaData* head_node, MallocMetaData* tail_node)
-{
-    size_t list_size = 0;
-    for ( MallocMetaData *curr = this->head->next; curr != tail_node; curr = curr->next)
-    {
-        list_size++; 
-    }
-    
-    if(list_size <= 1)
-    {
-        return;
-    }
-    
-    for (MallocMetaData *curr = this->head->next; curr != tail_node; curr = curr->next)
-    {
-        for (MallocMetaData *curr_inner = curr->next; curr_inner != tail_node; curr_inner = curr_inner->next )
-        {
-            if ( (*curr_inner) < (*curr) )
-            {
-                Swap(curr_inner ,curr ); 
-                MallocMetaData* tmp = curr_inner;
-                curr_inner = curr;
-                curr = tmp;  
-            }
-        }   
-    }
+    this->num_huge_page_bytes = 0;
+    this->num_splits = 0;
+    this->num_merges = 0;
+    this->num_requested_bytes = 0;
+    this->buddy_region = NULL;
+    this->num_roots = 0;
 }
 
 MallocMetaData* FreeList::findBlock(size_t required_size)
 {
     for (int i = 0; i < (MAX_ORDER+1); i++)
     {
-        for (MallocMetaData* curr = this->orders_list[i].head->next; curr != this->orders_list[i].tail; curr = curr->next)
+        // every block of an order has the same size, if the front one isn't free none is.
+        MallocMetaData* curr = this->orders_list[i].head->next;
+        if (curr == this->orders_list[i].tail)
         {
-            if (curr->cookies != this->cookies)
-            {
-                exit(0xdeadbeef);
-            }
-            
-            if (curr->size >= required_size && curr->is_free == true)
-            { // since the list is sorted we'll find the smallest size first.
-                return curr;
-            }     
+            continue;
+        }
+        if (curr->cookies != this->cookies)
+        {
+            exit(0xdeadbeef);
+        }
+        if (curr->size >= required_size && curr->is_free == true)
+        { // the orders go up, we'll find the smallest size first.
+            return curr;
         }
     }
     return NULL;
@@ -410,17 +428,22 @@ MallocMetaData* FreeList::splitBlock(MallocMetaData* data, size_t min_size)
             new_block->cookies = curr_block->cookies;
             new_block->size = new_size;
             new_block->is_free = true;
+            new_block->is_huge = curr_block->is_huge;
+            new_block->is_zeroed = curr_block->is_zeroed;
+            new_block->is_sampled = false;
+            new_block->requested_size = 0;
             new_block->addr = (void*)((char*)new_block + sizeof(MallocMetaData));
             int index_old = getOrderFromSize( current_size + sizeof(MallocMetaData) );
             int index_new = getOrderFromSize( new_size + sizeof(MallocMetaData) );
             // int index_old = getOrderFromSize( current_size );
             // int index_new = getOrderFromSize( new_size );
             this->orders_list[index_old].removeBlock(curr_block);
-            this->orders_list[index_new].insert(curr_block);
             this->orders_list[index_new].insert(new_block);
+            this->orders_list[index_new].insert(curr_block); // the lower half goes in front
             current_size = new_size;
             inserted = true;
             this->num_free_blocks += 1; //+2?
+            this->num_splits += 1;
             this->num_free_bytes -= sizeof(MallocMetaData);
         }
         else if(!inserted || current_size <= MIN_BUDDY_BLOCK)
@@ -446,97 +469,50 @@ MallocMetaData* FreeList::mergeBlocks(MallocMetaData* prev, MallocMetaData* curr
     this->orders_list[index_prev].removeBlock(prev);
     this->orders_list[index_curr].removeBlock(curr);
     prev->size += (curr->size + sizeof(MallocMetaData));
+    prev->is_zeroed = false; // curr's metadata is now inside prev's payload.
     int new_index = getOrderFromSize( prev->size + sizeof(MallocMetaData));
     this->orders_list[new_index].insert(prev);
     this->num_free_blocks -= 1;
     this->num_free_bytes += sizeof(MallocMetaData);
+    this->num_merges += 1;
     return prev;
 }
 
-MallocMetaData* FreeList::findNextBuddy(MallocMetaData* block)
+/*
+The buddy of a block is found from its address alone: blocks are aligned to their size relative to the
+start of the region, so flipping the size bit of the offset gives the buddy's metadata.
+Returns NULL unless the buddy is free and whole (not split into smaller blocks).
+*/
+MallocMetaData* FreeList::findBuddy(MallocMetaData* block)
 {
-    if(!block)
+    size_t block_size = block->size + sizeof(MallocMetaData);
+    if (this->buddy_region == NULL || block_size >= DEFAULT_BUDDY_BLOCK)
     {
         return NULL;
     }
-    for (int i = 0; i < (MAX_ORDER + 1); i++)
-    {
-        for (MallocMetaData* curr = this->orders_list[i].head->next; curr != this->orders_list[i].tail; curr = curr->next)
-        {
-            MallocMetaData* end_of_block = (MallocMetaData*)((char*)block + sizeof(MallocMetaData) + block->size );
-            if ( ( end_of_block == curr ) && curr->is_free )
-            {
-                return curr;
-            }  
-        }
-    }
-    return NULL;
-}
-
-MallocMetaData* FreeList::findPreviousBuddy(MallocMetaData* block)
-{
-    for (int i = 0; i < (MAX_ORDER + 1); i++)
-    {
-        for (MallocMetaData* curr = this->orders_list[i].head->next; curr != this->orders_list[i].tail; curr = curr->next)
-        {
-            MallocMetaData* end_of_curr = (MallocMetaData*)((char*)curr + sizeof(MallocMetaData) + curr->size);
-            if ( ( end_of_curr == block ) && curr->is_free )
-            {
-                return curr;
-            }  
-        }
-    }
-    return NULL;
-}
-
-void FreeList::insertToFreeList(MallocMetaData* block)
-{
-    block->next = this->tail;
-    block->prev = this->tail->prev;
-    this->tail->prev = block;
-    this->tail->prev->next = block;
-    SortMallocMetaDataList(this->head, this->tail);
-}
-
-void FreeList::deleteFromFreeList(MallocMetaData* block)
-{
-    for ( MallocMetaData* curr = this->head->next; curr != this->tail; curr = curr->next)
+    size_t offset = (char*)block - (char*)this->buddy_region;
+    MallocMetaData* buddy = (MallocMetaData*)((char*)this->buddy_region + (offset ^ block_size));
+    if (buddy->cookies != this->cookies)
     {
-        if ( curr == block)
-        {
-            (curr->prev)->next = curr->next;
-            (curr->next)->prev = curr->prev;
-        }
-        
+        // an overflow occured and someone used our data.
+        exit(0xdeadbeef);
     }
-    
-}
-
-void* FreeList::addMapping(size_t size)
-{
-    void* allocation = mmap(NULL, (size + sizeof(MallocMetaData)), (PROT_EXEC | PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0); // correct flags / prot?
-    if (allocation == MAP_FAILED)
+    if (!buddy->is_free || buddy->size != block->size)
     {
         return NULL;
     }
-    
-    MallocMetaData* data = (MallocMetaData*)allocation;
-    data->addr = (void*)((char*)allocation + sizeof(MallocMetaData));
-    data->is_free = false;
-    data->size = size;
-    data->cookies = this->cookies;
-    this->insertToFreeList(data);
-
-    // this->num_allocated_bytes += (size + sizeof(MallocMetaData));
-    this->num_allocated_bytes += (size);
-    this->num_allocated_blocks += 1;
-    
-    return data->addr;
+    return buddy;
 }
 
 void* FreeList::allocateBlock(size_t size)
 {
     MallocMetaData* found = this->findBlock(size);
+#ifdef MALLOC_GROWABLE_HEAP
+    if (!found && this->growBuddySystem())
+    {
+        found = this->findBlock(size);
+    }
+#endif
     if (!found)
     {
         // shouldn't allocate more, try looking for a block that's empty and merge it with its buddy.
@@ -557,7 +533,8 @@ void* FreeList::allocateBlock(size_t size)
             /* potential errors*/
             // things to consider: when splitting the blocks I should change the number of free_bytes, block...
             // potential errors: numerical calculations with size, etc.
-            split_block->is_free = false;
+            this->setBlockFree(split_block, false);
+            this->setRequestedSize(split_block, size);
             this->num_free_blocks -= 1;
             this->num_allocated_blocks += 1;
             this->num_free_bytes -= (split_block->size);
@@ -566,7 +543,8 @@ void* FreeList::allocateBlock(size_t size)
         }
         else
         {
-            found->is_free = false;
+            this->setBlockFree(found, false);
+            this->setRequestedSize(found, size);
             this->num_allocated_blocks += 1;
             this->num_allocated_bytes += found->size;
             this->num_free_blocks -= 1;
@@ -577,207 +555,1278 @@ void* FreeList::allocateBlock(size_t size)
     return NULL;
 }
 
-void FreeList::removeMapping(MallocMetaData* block)
+void FreeList::setRequestedSize(MallocMetaData* block, size_t requested_size)
 {
-    for (MallocMetaData* curr = this->head->next; curr != this->tail; curr = curr->next)
-    {
-        if (block == curr)
-        {
-            curr->prev->next = curr->next;
-            curr->next->prev = curr->prev;
-        }
-    }   
+    this->num_requested_bytes -= block->requested_size;
+    block->requested_size = requested_size;
+    this->num_requested_bytes += requested_size;
+}
+
+// the block moves to its side of the order list, the counters are the caller's.
+void FreeList::setBlockFree(MallocMetaData* block, bool is_free)
+{
+    int order = getOrderFromSize(block->size + sizeof(MallocMetaData));
+    this->orders_list[order].removeBlock(block);
+    block->is_free = is_free;
+    this->orders_list[order].insert(block);
 }
 
+// whether merging block with its free buddies (without touching them) would reach required_size.
 bool FreeList::isBlockContainable(MallocMetaData* block, size_t required_size)
 {
-    MallocMetaData* next_buddy = this->findNextBuddy(block);
-    MallocMetaData* prev_buddy = this->findPreviousBuddy(block);
-    size_t accumulated_size = block->size;
-    while ( required_size > accumulated_size )
+    char* start = (char*)block;
+    size_t block_size = block->size + sizeof(MallocMetaData);
+    while ( required_size > (block_size - sizeof(MallocMetaData)) )
     {
-        if ( next_buddy && prev_buddy && (prev_buddy->size <= next_buddy->size) )
-        {
-            accumulated_size += (prev_buddy->size);
-            prev_buddy = this->findPreviousBuddy(prev_buddy);
-        }
-        else if ( next_buddy && prev_buddy && ( prev_buddy->size > next_buddy->size ) )
+        if (block_size >= DEFAULT_BUDDY_BLOCK)
         {
-            accumulated_size += (next_buddy->size);
-            next_buddy = this->findNextBuddy(next_buddy);
+            return false;
         }
-        else if ( next_buddy && (!prev_buddy) )
+        size_t offset = start - (char*)this->buddy_region;
+        MallocMetaData* buddy = (MallocMetaData*)((char*)this->buddy_region + (offset ^ block_size));
+        if (!buddy->is_free || (buddy->size + sizeof(MallocMetaData)) != block_size)
         {
-            accumulated_size += (next_buddy->size);
-            next_buddy = this->findNextBuddy(next_buddy);
-        }
-        else if ( (!next_buddy) && prev_buddy )
-        {
-            accumulated_size += (prev_buddy->size);
-            prev_buddy = this->findPreviousBuddy(prev_buddy);
+            return false;
         }
+        start = ((char*)buddy < start) ? (char*)buddy : start;
+        block_size *= 2;
     }
-    return (accumulated_size >= required_size);
+    return true;
 }
 
-// the following elements are allocated on the stack!
-static MallocMetaData head_datas[BUDDY_BLOCKS_NUM+1];
-static MallocMetaData tail_datas[BUDDY_BLOCKS_NUM+1];
-static MallocMetaData list_head_node = MallocMetaData();
-static MallocMetaData mmap_head_node = MallocMetaData();
-static MallocMetaData list_tail_node = MallocMetaData();
-static MallocMetaData mmap_tail_node = MallocMetaData();
-static FreeList free_list = FreeList(&list_head_node, &list_tail_node, head_datas, tail_datas);
-static FreeList mmap_free_list = FreeList(&mmap_head_node, &mmap_tail_node, head_datas, tail_datas);
-static bool buddy_system_init = false;
+#ifdef MALLOC_PAGE_HEAP
+/*
+Page heap (MALLOC_PAGE_HEAP): chunks of up to PAGE_HEAP_MAX_SPAN bytes are runs of pages (spans) carved out of
+PAGE_HEAP_REGION_SIZE regions, which are reserved once with MAP_NORESERVE so their pages are only committed when
+they're touched. A free span coalesces with its neighbors and is kept in the list of its length, a bitmap over the
+lengths finds the shortest span that fits. Only larger chunks are mmap()ed one by one.
+*/
+#define PAGE_HEAP_PAGE_SIZE (4*KB)
+#define PAGE_HEAP_PAGE_SHIFT 12
+#define PAGE_HEAP_REGION_SIZE (64*MB) // regions are aligned to their size, a page finds its region by masking its address
+#define PAGE_HEAP_REGION_PAGES (PAGE_HEAP_REGION_SIZE / PAGE_HEAP_PAGE_SIZE)
+#define PAGE_HEAP_MAX_SPAN (32*MB)
+#define PAGE_HEAP_LIST_PAGES (PAGE_HEAP_MAX_SPAN / PAGE_HEAP_PAGE_SIZE) // longer free spans share the list at index 0
+#define PAGE_HEAP_BITMAP_WORDS (PAGE_HEAP_LIST_PAGES / 64 + 1)
+
+// only the entries of the first and the last page of a span are valid.
+struct PageSpan
+{
+    PageSpan* next; // in the free list of its length
+    PageSpan* prev;
+    unsigned int first; // page index of the span in its region
+    unsigned int length; // in pages
+    bool is_free;
+    bool is_zeroed; // first page only: none of the span's pages was ever touched.
+};
 
-void *smalloc(size_t size)
+struct PageRegion
 {
-    if (!buddy_system_init)
-    {
-        free_list.initializeBuddySystem(head_datas, tail_datas);
-        buddy_system_init = true;
-    }
-    
-    if (size <= 0 || size > MAX_SIZE)
-    {    
-        /* 
-        potential error:
-            consider checking if size > MAX_SIZE. 
-            is it a case for mmap or is it an error?
-        */
-        return NULL;
-    }
-    if (size >= MY_MMAP_THRESHOLD)
-    {
-        /*
-        potential errors:
-            should we check if (datap->size > MY_MMAP_THRESHOLD) or (datap->size >= MY_MMAP_THRESHOLD)?
-        */
-        return mmap_free_list.addMapping(size);
-    }
-    else
-    {
-        return free_list.allocateBlock(size);
-    }
-    return NULL;
+    PageRegion* next;
+    PageRegion* prev;
+    size_t free_pages;
+    PageSpan spans[PAGE_HEAP_REGION_PAGES];
+};
+
+// the first pages of a region hold its PageRegion.
+#define PAGE_HEAP_FIRST_PAGE ((sizeof(PageRegion) + PAGE_HEAP_PAGE_SIZE - 1) / PAGE_HEAP_PAGE_SIZE)
+
+class PageHeap
+{
+public:
+    PageRegion* regions;
+    PageSpan* free_lists[PAGE_HEAP_LIST_PAGES + 1];
+    unsigned long long lengths_bitmap[PAGE_HEAP_BITMAP_WORDS]; // bit n is set when free_lists[n] isn't empty (n > 0)
+
+    size_t num_regions;
+    size_t num_free_pages;
+    size_t num_span_allocs;
+    size_t num_span_frees;
+
+    constexpr PageHeap();
+    ~PageHeap() = default;
+    static PageRegion* getRegion(void* p);
+    static void* getPageAddress(PageRegion* region, unsigned int page);
+    void setSpan(PageRegion* region, unsigned int first, unsigned int length, bool is_free, bool is_zeroed);
+    void insertSpan(PageSpan* span);
+    void removeSpan(PageSpan* span);
+    PageSpan* findSpan(size_t pages);
+    PageRegion* addRegion();
+    void removeRegion(PageRegion* region);
+    void releasePages(PageRegion* region, unsigned int first, unsigned int length);
+    void* allocateSpan(size_t length, bool* is_zeroed);
+    void freeSpan(void* addr);
+    bool resizeSpan(void* addr, size_t length);
+};
+
+constexpr PageHeap::PageHeap():
+    regions(NULL),
+    free_lists(),
+    lengths_bitmap(),
+    num_regions(0),
+    num_free_pages(0),
+    num_span_allocs(0),
+    num_span_frees(0)
+{}
+
+PageRegion* PageHeap::getRegion(void* p)
+{
+    return (PageRegion*)((size_t)p & ~((size_t)PAGE_HEAP_REGION_SIZE - 1));
 }
 
-void *scalloc(size_t num, size_t size)
+void* PageHeap::getPageAddress(PageRegion* region, unsigned int page)
+{
+    return (char*)region + ((size_t)page << PAGE_HEAP_PAGE_SHIFT);
+}
+
+void PageHeap::setSpan(PageRegion* region, unsigned int first, unsigned int length, bool is_free, bool is_zeroed)
+{
+    PageSpan* head = &region->spans[first];
+    PageSpan* last = &region->spans[first + length - 1];
+    head->first = first;
+    head->length = length;
+    head->is_free = is_free;
+    head->is_zeroed = is_zeroed;
+    last->first = first;
+    last->length = length;
+    last->is_free = is_free;
+}
+
+void PageHeap::insertSpan(PageSpan* span)
 {
-    if (num <= 0 || size <= 0 || (size*num) > MAX_SIZE)
+    unsigned int index = (span->length > PAGE_HEAP_LIST_PAGES) ? 0 : span->length;
+    span->prev = NULL;
+    span->next = this->free_lists[index];
+    if (span->next != NULL)
     {
-        /* 
-        potential error:
-            consider not checking if num*size > MAX_SIZE. 
-            is it a case for mmap or is it an error?
-        */
-        return NULL;
+        span->next->prev = span;
     }
-    void* allocation = smalloc(num*size);
-    if(allocation == NULL)
+    this->free_lists[index] = span;
+    if (index > 0)
     {
-        return NULL;
+        this->lengths_bitmap[index / 64] |= (1ULL << (index % 64));
     }
-    memset(allocation, 0, num*size);
-    return allocation;
+    this->num_free_pages += span->length;
+    getRegion(span)->free_pages += span->length;
 }
 
-void sfree(void* p)
+void PageHeap::removeSpan(PageSpan* span)
 {
-    if (p == NULL)
+    unsigned int index = (span->length > PAGE_HEAP_LIST_PAGES) ? 0 : span->length;
+    if (span->prev != NULL)
     {
-        return;
+        span->prev->next = span->next;
     }
-    MallocMetaData *datap = (MallocMetaData*)((char*)p - sizeof(MallocMetaData));
-    MallocMetaData* merged = datap;
-    if (datap->cookies != free_list.cookies || datap->cookies != mmap_free_list.cookies)
+    else
     {
-        // an overflow occured and someone used our data.
-        exit(0xdeadbeef);
+        this->free_lists[index] = span->next;
     }
-    if (datap->is_free)
+    if (span->next != NULL)
     {
-        return; // block is already free!
+        span->next->prev = span->prev;
     }
-    
-    if (datap->size >= MY_MMAP_THRESHOLD)
+    if (index > 0 && this->free_lists[index] == NULL)
     {
-        /*
-        potential errors:
-            should we check if (datap->size > MY_MMAP_THRESHOLD) or (datap->size >= MY_MMAP_THRESHOLD)?
-            according to the notes in section 3, we shouldn't consider munmapped areas as freed
-        */
-        mmap_free_list.num_allocated_blocks -= 1;
-        mmap_free_list.num_allocated_bytes -= datap->size;
-        datap->is_free = true;
-        MallocMetaData* found = mmap_free_list.findBlock(datap->size);
-        if (found)
-        {
-            mmap_free_list.removeMapping(datap);
-        }
-        munmap(datap, datap->size + sizeof(MallocMetaData));
-        // wasnt very clear on what we should do with unmapped blocks, check it.
+        this->lengths_bitmap[index / 64] &= ~(1ULL << (index % 64));
     }
-    else
-    {
-        merged->is_free = true;
-        free_list.num_free_blocks += 1;
-        free_list.num_free_bytes += merged->size;
-        free_list.num_allocated_blocks -= 1;
-        free_list.num_allocated_bytes -= merged->size;
+    this->num_free_pages -= span->length;
+    getRegion(span)->free_pages -= span->length;
+}
 
-        MallocMetaData *datap_prev = free_list.findPreviousBuddy(merged);
-        MallocMetaData *datap_next = free_list.findNextBuddy(merged);
-        while ( (datap_next || datap_prev) && (merged))
+PageSpan* PageHeap::findSpan(size_t pages)
+{
+    for (size_t word = pages / 64; word < PAGE_HEAP_BITMAP_WORDS; word++)
+    {
+        unsigned long long lengths = this->lengths_bitmap[word];
+        if (word == pages / 64)
         {
-            if (datap->cookies != free_list.cookies ||
-            (datap_prev != NULL && datap_prev->cookies != free_list.cookies) ||
-            (datap_next != NULL && datap_next->cookies != free_list.cookies))
-            {
-                // an overflow occured and someone used our data.
-                exit(0xdeadbeef);
-            }
-            if (datap_prev != NULL)
-            {
-                merged = free_list.mergeBlocks(datap_prev, merged);
-                if (datap_next != NULL)
-                {
-                    merged = free_list.mergeBlocks(merged, datap_next);
-                }
-            }
-            else
-            {
-                if (datap_next != NULL)
-                {
-                    merged = free_list.mergeBlocks(merged, datap_next);
-                }
-            }
-            datap_prev = free_list.findPreviousBuddy(merged);
-            datap_next = free_list.findNextBuddy(merged);
+            lengths &= (~0ULL << (pages % 64));
+        }
+        if (lengths != 0)
+        {
+            return this->free_lists[word * 64 + __builtin_ctzll(lengths)];
         }
     }
+    // the spans of list 0 are longer than any request.
+    return this->free_lists[0];
 }
 
-void* srealloc(void* oldp, size_t size)
+PageRegion* PageHeap::addRegion()
 {
-    if (size <= 0 || size > MAX_SIZE)
+    // map an extra region and trim the mapping to a PAGE_HEAP_REGION_SIZE aligned address.
+    char* raw = (char*)mmap(NULL, 2 * (size_t)PAGE_HEAP_REGION_SIZE, (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE), -1, 0);
+    if (raw == MAP_FAILED)
     {
         return NULL;
     }
-
-    if(oldp == NULL)
+    char* aligned = (char*)((((size_t)raw) + PAGE_HEAP_REGION_SIZE - 1) & ~((size_t)PAGE_HEAP_REGION_SIZE - 1));
+    size_t head_slack = aligned - raw;
+    if (head_slack > 0)
     {
-        return smalloc(size);
+        munmap(raw, head_slack);
     }
-    MallocMetaData *datap = (MallocMetaData*)((char*)oldp - sizeof(MallocMetaData));
-    bool merged_blocks = false;
-    if (datap->cookies != free_list.cookies || datap->cookies != mmap_free_list.cookies)
+    munmap(aligned + PAGE_HEAP_REGION_SIZE, PAGE_HEAP_REGION_SIZE - head_slack);
+
+    PageRegion* region = (PageRegion*)aligned;
+    region->free_pages = 0;
+    region->prev = NULL;
+    region->next = this->regions;
+    if (this->regions != NULL)
+    {
+        this->regions->prev = region;
+    }
+    this->regions = region;
+    this->num_regions += 1;
+    this->setSpan(region, PAGE_HEAP_FIRST_PAGE, PAGE_HEAP_REGION_PAGES - PAGE_HEAP_FIRST_PAGE, true, true);
+    this->insertSpan(&region->spans[PAGE_HEAP_FIRST_PAGE]);
+    return region;
+}
+
+void PageHeap::removeRegion(PageRegion* region)
+{
+    if (region->prev != NULL)
+    {
+        region->prev->next = region->next;
+    }
+    else
+    {
+        this->regions = region->next;
+    }
+    if (region->next != NULL)
+    {
+        region->next->prev = region->prev;
+    }
+    this->num_regions -= 1;
+    munmap(region, PAGE_HEAP_REGION_SIZE);
+}
+
+void PageHeap::releasePages(PageRegion* region, unsigned int first, unsigned int length)
+{
+    unsigned int end = first + length;
+    if (end < PAGE_HEAP_REGION_PAGES && region->spans[end].is_free)
+    {
+        PageSpan* next = &region->spans[end];
+        this->removeSpan(next);
+        end += next->length;
+    }
+    if (first > PAGE_HEAP_FIRST_PAGE && region->spans[first - 1].is_free)
+    {
+        PageSpan* prev = &region->spans[region->spans[first - 1].first];
+        this->removeSpan(prev);
+        first = prev->first;
+    }
+    if (first == PAGE_HEAP_FIRST_PAGE && end == PAGE_HEAP_REGION_PAGES && this->num_regions > 1)
+    {
+        // the whole region is free, the last one is kept for what's allocated next.
+        this->removeRegion(region);
+        return;
+    }
+    // the pages were used, they aren't zeroed anymore.
+    this->setSpan(region, first, end - first, true, false);
+    this->insertSpan(&region->spans[first]);
+}
+
+void* PageHeap::allocateSpan(size_t length, bool* is_zeroed)
+{
+    size_t pages = (length + PAGE_HEAP_PAGE_SIZE - 1) >> PAGE_HEAP_PAGE_SHIFT;
+    PageSpan* span = this->findSpan(pages);
+    if (span == NULL)
+    {
+        if (this->addRegion() == NULL)
+        {
+            return NULL;
+        }
+        span = this->findSpan(pages);
+    }
+    this->removeSpan(span);
+    PageRegion* region = getRegion(span);
+    unsigned int first = span->first;
+    unsigned int span_length = span->length;
+    bool zeroed = span->is_zeroed;
+    if (span_length > pages)
+    {
+        // the rest stays free, right after the allocated pages.
+        this->setSpan(region, first + pages, span_length - pages, true, zeroed);
+        this->insertSpan(&region->spans[first + pages]);
+    }
+    this->setSpan(region, first, pages, false, false);
+    this->num_span_allocs += 1;
+    *is_zeroed = zeroed;
+    return getPageAddress(region, first);
+}
+
+void PageHeap::freeSpan(void* addr)
+{
+    PageRegion* region = getRegion(addr);
+    unsigned int first = ((char*)addr - (char*)region) >> PAGE_HEAP_PAGE_SHIFT;
+    this->num_span_frees += 1;
+    this->releasePages(region, first, region->spans[first].length);
+}
+
+/*
+Resizes the span at addr to length bytes without moving it: a shrinking span gives its tail back, a growing
+one takes the pages of the free span right after it. Returns false if they're not free or not enough.
+*/
+bool PageHeap::resizeSpan(void* addr, size_t length)
+{
+    PageRegion* region = getRegion(addr);
+    unsigned int first = ((char*)addr - (char*)region) >> PAGE_HEAP_PAGE_SHIFT;
+    unsigned int span_length = region->spans[first].length;
+    size_t pages = (length + PAGE_HEAP_PAGE_SIZE - 1) >> PAGE_HEAP_PAGE_SHIFT;
+    if (pages < span_length)
+    {
+        this->setSpan(region, first, pages, false, false);
+        this->releasePages(region, first + pages, span_length - pages);
+    }
+    else if (pages > span_length)
+    {
+        unsigned int end = first + span_length;
+        if (end >= PAGE_HEAP_REGION_PAGES || !region->spans[end].is_free || span_length + region->spans[end].length < pages)
+        {
+            return false;
+        }
+        PageSpan* next = &region->spans[end];
+        unsigned int next_length = next->length;
+        bool zeroed = next->is_zeroed;
+        this->removeSpan(next);
+        if (span_length + next_length > pages)
+        {
+            this->setSpan(region, first + pages, span_length + next_length - pages, true, zeroed);
+            this->insertSpan(&region->spans[first + pages]);
+        }
+        this->setSpan(region, first, pages, false, false);
+    }
+    return true;
+}
+
+// constant-initialized like the rest of the allocator, the first span maps the first region.
+static PageHeap page_heap;
+#endif
+
+/*
+Large (mmap) chunks are kept apart from the buddy orders in an intrusive doubly linked list:
+every chunk carries its own next/prev links in its metadata, so registering and unregistering
+a chunk never walks the list (or the buddy lists) and costs O(1) regardless of how many chunks are live.
+*/
+class MmapRegistry
+{
+public:
+    int cookies;
+    MallocMetaData* head;
+    MallocMetaData* tail;
+
+    size_t num_allocated_bytes;
+    size_t num_allocated_blocks;
+    size_t num_huge_page_bytes;
+    size_t num_mmaps;
+    size_t num_munmaps;
+    size_t mmapped_bytes;
+    size_t munmapped_bytes;
+
+    constexpr MmapRegistry();
+    ~MmapRegistry() = default;
+    void initialize(int cookies, MallocMetaData* head_node, MallocMetaData* tail_node);
+    void registerChunk(MallocMetaData* chunk);
+    void unregisterChunk(MallocMetaData* chunk);
+    bool isHugeChunk(size_t size);
+    bool isSpanChunk(size_t size);
+    size_t getMappingLength(size_t size);
+    void* mapHugeChunk(size_t length, bool* is_huge);
+    void* addMapping(size_t size);
+    void removeMapping(MallocMetaData* chunk);
+    bool resizeMapping(MallocMetaData* chunk, size_t size);
+};
+
+constexpr MmapRegistry::MmapRegistry():
+    cookies(0),
+    head(NULL),
+    tail(NULL),
+    num_allocated_bytes(0),
+    num_allocated_blocks(0),
+    num_huge_page_bytes(0),
+    num_mmaps(0),
+    num_munmaps(0),
+    mmapped_bytes(0),
+    munmapped_bytes(0)
+{}
+
+void MmapRegistry::initialize(int cookies, MallocMetaData* head_node, MallocMetaData* tail_node)
+{
+    this->cookies = cookies;
+    this->head = head_node;
+    this->tail = tail_node;
+    this->head->next = tail_node;
+    this->head->prev = NULL;
+    this->tail->prev = head_node;
+    this->tail->next = NULL;
+    this->head->cookies = this->cookies;
+    this->tail->cookies = this->cookies;
+    this->num_allocated_bytes = 0;
+    this->num_allocated_blocks = 0;
+    this->num_huge_page_bytes = 0;
+    this->num_mmaps = 0;
+    this->num_munmaps = 0;
+    this->mmapped_bytes = 0;
+    this->munmapped_bytes = 0;
+}
+
+void MmapRegistry::registerChunk(MallocMetaData* chunk)
+{
+    // chunks are pushed right after the head, the order of the registry is meaningless.
+    chunk->prev = this->head;
+    chunk->next = this->head->next;
+    this->head->next->prev = chunk;
+    this->head->next = chunk;
+    this->num_allocated_bytes += chunk->size;
+    this->num_allocated_blocks += 1;
+    if (chunk->is_huge)
+    {
+        this->num_huge_page_bytes += this->getMappingLength(chunk->size);
+    }
+}
+
+void MmapRegistry::unregisterChunk(MallocMetaData* chunk)
+{
+    if (chunk->prev == NULL || chunk->next == NULL)
+    {
+        return; // not registered.
+    }
+    chunk->prev->next = chunk->next;
+    chunk->next->prev = chunk->prev;
+    chunk->next = NULL;
+    chunk->prev = NULL;
+    this->num_allocated_bytes -= chunk->size;
+    this->num_allocated_blocks -= 1;
+    if (chunk->is_huge)
+    {
+        this->num_huge_page_bytes -= this->getMappingLength(chunk->size);
+    }
+}
+
+bool MmapRegistry::isHugeChunk(size_t size)
+{
+#ifdef MALLOC_HUGE_PAGES
+    return (size >= HUGE_PAGE_SIZE);
+#else
+    return false;
+#endif
+}
+
+// a span of the page heap rather than a mapping of its own.
+bool MmapRegistry::isSpanChunk(size_t size)
+{
+#ifdef MALLOC_PAGE_HEAP
+    return (!this->isHugeChunk(size) && this->getMappingLength(size) <= PAGE_HEAP_MAX_SPAN);
+#else
+    return false;
+#endif
+}
+
+size_t MmapRegistry::getMappingLength(size_t size)
+{
+    size_t length = size + sizeof(MallocMetaData);
+    if (this->isHugeChunk(size))
+    {
+        // huge chunks are rounded up to whole huge pages, munmap() has to get the same length.
+        length = ((length + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+    }
+    return length;
+}
+
+void* MmapRegistry::mapHugeChunk(size_t length, bool* is_huge)
+{
+    *is_huge = false;
+#ifdef MAP_HUGETLB
+    // use reserved huge pages when there are any (see build_and_run.sh).
+    void* allocation = mmap(NULL, length, (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB), -1, 0);
+    if (allocation != MAP_FAILED)
+    {
+        *is_huge = true;
+        return allocation;
+    }
+#endif
+    // otherwise fall back to transparent huge pages: map an extra huge page, trim the mapping
+    // to a HUGE_PAGE_SIZE aligned address and ask the kernel to back it with huge pages.
+    char* raw = (char*)mmap(NULL, length + HUGE_PAGE_SIZE, (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        return MAP_FAILED;
+    }
+    char* aligned = (char*)((((size_t)raw) + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1));
+    size_t head_slack = aligned - raw;
+    size_t tail_slack = HUGE_PAGE_SIZE - head_slack;
+    if (head_slack > 0)
+    {
+        munmap(raw, head_slack);
+    }
+    if (tail_slack > 0)
+    {
+        munmap(aligned + length, tail_slack);
+    }
+    *is_huge = (madvise(aligned, length, MADV_HUGEPAGE) == 0);
+    return aligned;
+}
+
+void* MmapRegistry::addMapping(size_t size)
+{
+    size_t length = this->getMappingLength(size);
+    bool is_huge = false;
+    void* allocation;
+    bool is_zeroed = true; // mmap() hands out fresh anonymous pages.
+    if (this->isHugeChunk(size))
+    {
+        allocation = this->mapHugeChunk(length, &is_huge);
+    }
+#ifdef MALLOC_PAGE_HEAP
+    else if (this->isSpanChunk(size))
+    {
+        allocation = page_heap.allocateSpan(length, &is_zeroed);
+        allocation = (allocation == NULL) ? MAP_FAILED : allocation;
+    }
+#endif
+    else
+    {
+        allocation = mmap(NULL, length, (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+    }
+    if (allocation == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    MallocMetaData* data = (MallocMetaData*)allocation;
+    data->addr = (void*)((char*)allocation + sizeof(MallocMetaData));
+    data->is_free = false;
+    data->is_huge = is_huge;
+    data->is_zeroed = is_zeroed;
+    data->is_sampled = false;
+    data->size = size;
+    data->cookies = this->cookies;
+    this->registerChunk(data);
+    if (!this->isSpanChunk(size))
+    {
+        this->num_mmaps += 1;
+        this->mmapped_bytes += size;
+    }
+
+    return data->addr;
+}
+
+void MmapRegistry::removeMapping(MallocMetaData* chunk)
+{
+    // according to the notes in section 3, we shouldn't consider munmapped areas as freed
+    chunk->is_free = true;
+    this->unregisterChunk(chunk);
+#ifdef MALLOC_PAGE_HEAP
+    if (this->isSpanChunk(chunk->size))
+    {
+        page_heap.freeSpan(chunk);
+        return;
+    }
+#endif
+    this->num_munmaps += 1;
+    this->munmapped_bytes += chunk->size;
+    munmap(chunk, this->getMappingLength(chunk->size));
+}
+
+// a span is resized where it is when its pages allow it, a mapping of its own never is.
+bool MmapRegistry::resizeMapping(MallocMetaData* chunk, size_t size)
+{
+#ifdef MALLOC_PAGE_HEAP
+    if (this->isSpanChunk(chunk->size) && this->isSpanChunk(size) && page_heap.resizeSpan(chunk, this->getMappingLength(size)))
+    {
+        this->num_allocated_bytes = this->num_allocated_bytes - chunk->size + size;
+        chunk->size = size;
+        return true;
+    }
+#endif
+    return false;
+}
+
+// the following elements are allocated on the stack!
+static MallocMetaData head_datas[BUDDY_BLOCKS_NUM+1];
+static MallocMetaData tail_datas[BUDDY_BLOCKS_NUM+1];
+static MallocMetaData list_head_node = MallocMetaData();
+static MallocMetaData mmap_head_node = MallocMetaData();
+static MallocMetaData list_tail_node = MallocMetaData();
+static MallocMetaData mmap_tail_node = MallocMetaData();
+/*
+The allocator's objects are constant-initialized, so it works before any constructor has run (when it's
+preloaded into a program, libc and libstdc++ allocate while they start up). initializeAllocator() links
+the lists on first use, the buddy region is allocated by the first smalloc().
+*/
+static FreeList free_list;
+static MmapRegistry mmap_registry;
+static bool allocator_init = false;
+static bool buddy_system_init = false;
+static size_t peak_used_bytes = 0;
+static size_t num_failed_allocations = 0;
+
+#ifdef MALLOC_LATENCY_STATS
+#if defined(__x86_64__) || defined(__i386__)
+static unsigned long long readCycles()
+{
+    return __rdtsc();
+}
+#else
+static unsigned long long readCycles()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+#endif
+
+// log-scale buckets: 4 sub-buckets for every power of two.
+#define LATENCY_SUB_BUCKETS 4
+#define LATENCY_BUCKETS (64*LATENCY_SUB_BUCKETS)
+
+static size_t latency_histograms[SMALLOC_NUM_OPS][SMALLOC_NUM_PATHS][LATENCY_BUCKETS];
+static int latency_depth = 0; // srealloc calls smalloc/sfree, only the outermost call is recorded.
+
+class LatencyProbe
+{
+public:
+    unsigned long long start;
+    size_t num_splits;
+    size_t num_merges;
+};
+
+static int getLatencyBucket(unsigned long long cycles)
+{
+    if (cycles < LATENCY_SUB_BUCKETS)
+    {
+        return (int)cycles;
+    }
+    int msb = 63 - __builtin_clzll(cycles);
+    int sub_bucket = (int)((cycles >> (msb - 2)) & (LATENCY_SUB_BUCKETS - 1));
+    return (msb * LATENCY_SUB_BUCKETS) + sub_bucket;
+}
+
+static size_t getLatencyBucketBound(int bucket)
+{
+    int msb = bucket / LATENCY_SUB_BUCKETS;
+    size_t sub_bucket = bucket % LATENCY_SUB_BUCKETS;
+    if (msb < 2)
+    {
+        return bucket;
+    }
+    return ((LATENCY_SUB_BUCKETS + sub_bucket + 1) << (msb - 2)) - 1;
+}
+
+static LatencyProbe beginLatencyProbe()
+{
+    LatencyProbe probe;
+    latency_depth += 1;
+    probe.num_splits = free_list.num_splits;
+    probe.num_merges = free_list.num_merges;
+    probe.start = readCycles();
+    return probe;
+}
+
+static void endLatencyProbe(LatencyProbe* probe, int op, bool is_mmap)
+{
+    unsigned long long cycles = readCycles() - probe->start;
+    latency_depth -= 1;
+    if (latency_depth > 0)
+    {
+        return;
+    }
+    int path = SMALLOC_PATH_BUDDY_HIT;
+    if (is_mmap)
+    {
+        path = (op == SMALLOC_OP_SFREE) ? SMALLOC_PATH_MUNMAP : SMALLOC_PATH_MMAP;
+    }
+    else if (free_list.num_merges != probe->num_merges)
+    {
+        path = SMALLOC_PATH_MERGE;
+    }
+    else if (free_list.num_splits != probe->num_splits)
+    {
+        path = SMALLOC_PATH_SPLIT;
+    }
+    latency_histograms[op][path][getLatencyBucket(cycles)] += 1;
+}
+
+#define LATENCY_BEGIN() LatencyProbe latency_probe = beginLatencyProbe()
+#define LATENCY_END(op, is_mmap) endLatencyProbe(&latency_probe, (op), (is_mmap))
+#else
+#define LATENCY_BEGIN()
+#define LATENCY_END(op, is_mmap)
+#endif
+
+#ifdef MALLOC_HEAP_PROFILER
+/*
+Sampled heap profiler: on average one allocation per PROFILE_SAMPLE_BYTES allocated bytes is picked
+(the distance between samples is drawn from an exponential distribution, so big allocations are picked
+proportionally to their size), its call stack is captured and it's tracked until it's freed.
+Stacks and live samples are kept in fixed tables, samples that don't fit are dropped and counted.
+*/
+#ifndef PROFILE_SAMPLE_BYTES
+#define PROFILE_SAMPLE_BYTES (512*KB)
+#endif
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_MAX_STACKS 1024
+#define PROFILE_MAX_SAMPLES 8192
+
+class ProfileStack
+{
+public:
+    void* frames[PROFILE_MAX_DEPTH];
+    int depth;
+    size_t inuse_count;
+    size_t inuse_bytes;
+    size_t alloc_count;
+    size_t alloc_bytes;
+};
+
+class ProfileSample
+{
+public:
+    MallocMetaData* block;
+    int stack;
+    size_t size;
+};
+
+static ProfileStack profile_stacks[PROFILE_MAX_STACKS];
+static ProfileSample profile_samples[PROFILE_MAX_SAMPLES];
+static size_t profile_num_dropped = 0;
+static long long profile_bytes_until_sample = -1;
+static unsigned long long profile_random_state = 0x9e3779b97f4a7c15ULL;
+static bool profile_in_backtrace = false;
+
+static long long getNextSampleDistance()
+{
+    // xorshift64*, then an exponentially distributed distance with mean PROFILE_SAMPLE_BYTES.
+    profile_random_state ^= profile_random_state >> 12;
+    profile_random_state ^= profile_random_state << 25;
+    profile_random_state ^= profile_random_state >> 27;
+    unsigned long long random = profile_random_state * 0x2545f4914f6cdd1dULL;
+    double uniform = ((random >> 11) + 1.0) / 9007199254740993.0; // (0, 1]
+    return (long long)(-log(uniform) * PROFILE_SAMPLE_BYTES) + 1;
+}
+
+static int findProfileStack(void** frames, int depth)
+{
+    size_t hash = depth;
+    for (int i = 0; i < depth; i++)
+    {
+        hash = (hash * 31) ^ (size_t)frames[i];
+    }
+    for (int probe = 0; probe < PROFILE_MAX_STACKS; probe++)
+    {
+        int index = (hash + probe) % PROFILE_MAX_STACKS;
+        ProfileStack* stack = &profile_stacks[index];
+        if (stack->depth == 0)
+        {
+            memcpy(stack->frames, frames, depth * sizeof(void*));
+            stack->depth = depth;
+            return index;
+        }
+        if (stack->depth == depth && memcmp(stack->frames, frames, depth * sizeof(void*)) == 0)
+        {
+            return index;
+        }
+    }
+    return -1;
+}
+
+static void profileAllocation(void* allocation, size_t size)
+{
+    if (allocation == NULL || profile_in_backtrace)
+    {
+        return;
+    }
+    if (profile_bytes_until_sample < 0)
+    {
+        profile_bytes_until_sample = getNextSampleDistance();
+    }
+    profile_bytes_until_sample -= size;
+    if (profile_bytes_until_sample > 0)
+    {
+        return;
+    }
+    profile_bytes_until_sample = getNextSampleDistance();
+
+    // backtrace() may allocate the first time it's called, don't sample our own allocations.
+    void* frames[PROFILE_MAX_DEPTH + 1];
+    profile_in_backtrace = true;
+    int depth = backtrace(frames, PROFILE_MAX_DEPTH + 1) - 1; // the profiler's own frame is left out.
+    profile_in_backtrace = false;
+    int stack = (depth > 0) ? findProfileStack(frames + 1, depth) : -1;
+
+    MallocMetaData* block = (MallocMetaData*)((char*)allocation - sizeof(MallocMetaData));
+    size_t hash = ((size_t)block) >> 4;
+    for (int probe = 0; stack >= 0 && probe < PROFILE_MAX_SAMPLES; probe++)
+    {
+        ProfileSample* sample = &profile_samples[(hash + probe) % PROFILE_MAX_SAMPLES];
+        if (sample->block == NULL)
+        {
+            sample->block = block;
+            sample->stack = stack;
+            sample->size = size;
+            block->is_sampled = true;
+            profile_stacks[stack].inuse_count += 1;
+            profile_stacks[stack].inuse_bytes += size;
+            profile_stacks[stack].alloc_count += 1;
+            profile_stacks[stack].alloc_bytes += size;
+            return;
+        }
+    }
+    profile_num_dropped += 1;
+}
+
+static void profileFree(MallocMetaData* block)
+{
+    if (!block->is_sampled)
+    {
+        return;
+    }
+    block->is_sampled = false;
+    size_t hash = ((size_t)block) >> 4;
+    for (int probe = 0; probe < PROFILE_MAX_SAMPLES; probe++)
+    {
+        int index = (hash + probe) % PROFILE_MAX_SAMPLES;
+        ProfileSample* sample = &profile_samples[index];
+        if (sample->block == block)
+        {
+            profile_stacks[sample->stack].inuse_count -= 1;
+            profile_stacks[sample->stack].inuse_bytes -= sample->size;
+            sample->block = NULL;
+            // re-insert the rest of the probe run so lookups don't stop at the hole.
+            for (int next = (index + 1) % PROFILE_MAX_SAMPLES; profile_samples[next].block != NULL; next = (next + 1) % PROFILE_MAX_SAMPLES)
+            {
+                ProfileSample moved = profile_samples[next];
+                profile_samples[next].block = NULL;
+                size_t moved_hash = ((size_t)moved.block) >> 4;
+                for (int moved_probe = 0; moved_probe < PROFILE_MAX_SAMPLES; moved_probe++)
+                {
+                    ProfileSample* slot = &profile_samples[(moved_hash + moved_probe) % PROFILE_MAX_SAMPLES];
+                    if (slot->block == NULL)
+                    {
+                        *slot = moved;
+                        break;
+                    }
+                }
+            }
+            return;
+        }
+        if (sample->block == NULL)
+        {
+            return;
+        }
+    }
+}
+
+#define PROFILE_ALLOCATION(allocation, size) profileAllocation((allocation), (size))
+#define PROFILE_FREE(block) profileFree(block)
+#else
+#define PROFILE_ALLOCATION(allocation, size)
+#define PROFILE_FREE(block)
+#endif
+
+#ifdef MALLOC_TRACE
+/*
+Allocation trace recorder (see alloc_trace.h): every outermost smalloc/scalloc/srealloc/sfree call is
+encoded into a buffer that is written to the trace fd whenever it fills up and by smalloc_trace_stop().
+*/
+#define TRACE_BUFFER_SIZE (64*KB)
+
+static int trace_fd = -1;
+static uint8_t trace_buffer[TRACE_BUFFER_SIZE];
+static size_t trace_length = 0;
+static unsigned int trace_next_id = 1;
+static unsigned int trace_first_id = 1; // ids below it belong to an earlier trace.
+static unsigned long long trace_last_time = 0;
+static int trace_depth = 0; // scalloc and srealloc call smalloc/sfree, only the outermost call is recorded.
+
+static unsigned long long readTraceTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static bool flushTrace()
+{
+    size_t written_length = 0;
+    while (written_length < trace_length)
+    {
+        ssize_t written = write(trace_fd, trace_buffer + written_length, trace_length - written_length);
+        if (written <= 0)
+        {
+            // the trace is useless with a hole in it, stop recording.
+            trace_fd = -1;
+            trace_length = 0;
+            return false;
+        }
+        written_length += written;
+    }
+    trace_length = 0;
+    return true;
+}
+
+static unsigned int beginTrace(MallocMetaData* block)
+{
+    trace_depth += 1;
+    return (block != NULL) ? block->trace_id : 0;
+}
+
+static void endTrace(int op, void* allocation, unsigned int old_id, size_t num, size_t size)
+{
+    trace_depth -= 1;
+    if (trace_depth > 0)
+    {
+        return;
+    }
+    MallocMetaData* block = (op != ALLOC_TRACE_SFREE && allocation != NULL) ? (MallocMetaData*)((char*)allocation - sizeof(MallocMetaData)) : NULL;
+    if (block != NULL)
+    {
+        block->trace_id = 0;
+    }
+    if (trace_fd < 0 || (trace_length + ALLOC_TRACE_MAX_RECORD > TRACE_BUFFER_SIZE && !flushTrace()))
+    {
+        return;
+    }
+    unsigned long long now = readTraceTime();
+    uint8_t* record = trace_buffer + trace_length;
+    size_t length = 0;
+    record[length++] = op | ((op != ALLOC_TRACE_SFREE && allocation == NULL) ? ALLOC_TRACE_FAILED : 0);
+    length += allocTracePutVarint(record + length, now - trace_last_time);
+    trace_last_time = now;
+    if (op == ALLOC_TRACE_SREALLOC || op == ALLOC_TRACE_SFREE)
+    {
+        length += allocTracePutVarint(record + length, (old_id >= trace_first_id) ? (trace_next_id - old_id) : 0);
+    }
+    if (op == ALLOC_TRACE_SCALLOC)
+    {
+        length += allocTracePutVarint(record + length, num);
+    }
+    if (op != ALLOC_TRACE_SFREE)
+    {
+        length += allocTracePutVarint(record + length, size);
+    }
+    trace_length += length;
+    if (block != NULL)
+    {
+        block->trace_id = trace_next_id++;
+    }
+}
+
+#define TRACE_BEGIN(block) unsigned int trace_old_id = beginTrace(block)
+#define TRACE_END(op, allocation, num, size) endTrace((op), (allocation), trace_old_id, (num), (size))
+#else
+#define TRACE_BEGIN(block)
+#define TRACE_END(op, allocation, num, size)
+#endif
+
+static void initializeAllocator()
+{
+    if (allocator_init)
+    {
+        return;
+    }
+    free_list.initialize(&list_head_node, &list_tail_node, head_datas, tail_datas);
+    mmap_registry.initialize(free_list.cookies, &mmap_head_node, &mmap_tail_node);
+    allocator_init = true;
+}
+
+static void recordAllocation(void* allocation)
+{
+    if (allocation == NULL)
+    {
+        num_failed_allocations += 1;
+        return;
+    }
+    size_t used_bytes = free_list.num_allocated_bytes + mmap_registry.num_allocated_bytes;
+    if (used_bytes > peak_used_bytes)
+    {
+        peak_used_bytes = used_bytes;
+    }
+}
+
+#ifdef MALLOC_HUGE_ALLOCATIONS
+// above MAX_SIZE. Huge blocks aren't in the mmap registry nor in its counters.
+static bool isHugeBlock(MallocMetaData* block)
+{
+    return block->size > MAX_SIZE;
+}
+
+static void* allocateHugeBlock(size_t size)
+{
+    MallocMetaData* data = (MallocMetaData*)hugeMap(size, sizeof(MallocMetaData));
+    if (data == NULL)
+    {
+        return NULL;
+    }
+    data->addr = (void*)((char*)data + sizeof(MallocMetaData));
+    data->cookies = free_list.cookies;
+    data->size = size;
+    data->is_free = false;
+    data->is_huge = false;
+    data->is_zeroed = true; // a fresh mapping, see zeroAllocation()
+    data->is_sampled = false;
+    data->trace_id = 0;
+    data->next = NULL;
+    data->prev = NULL;
+    return data->addr;
+}
+
+// the kernel moves the pages, nothing is copied. NULL if the block couldn't be resized, it's left as it was.
+static void* remapHugeBlock(MallocMetaData* block, size_t size)
+{
+    MallocMetaData* data = (MallocMetaData*)hugeRemap(block, block->size, size, sizeof(MallocMetaData));
+    if (data == NULL)
+    {
+        return NULL;
+    }
+    data->addr = (void*)((char*)data + sizeof(MallocMetaData));
+    data->size = size;
+    return data->addr;
+}
+#endif
+
+void *smalloc(size_t size)
+{
+    initializeAllocator();
+    if (!buddy_system_init)
+    {
+        free_list.initializeBuddySystem(head_datas, tail_datas);
+        buddy_system_init = true;
+    }
+    
+    if (size <= 0 || size > SIZE_LIMIT)
+    {    
+        /* 
+        potential error:
+            consider checking if size > MAX_SIZE. 
+            is it a case for mmap or is it an error?
+        */
+        return NULL;
+    }
+    LATENCY_BEGIN();
+    TRACE_BEGIN(NULL);
+    void* allocation = NULL;
+    if (size >= MY_MMAP_THRESHOLD)
+    {
+        /*
+        potential errors:
+            should we check if (datap->size > MY_MMAP_THRESHOLD) or (datap->size >= MY_MMAP_THRESHOLD)?
+        */
+#ifdef MALLOC_HUGE_ALLOCATIONS
+        allocation = (size > MAX_SIZE) ? allocateHugeBlock(size) : mmap_registry.addMapping(size);
+#else
+        allocation = mmap_registry.addMapping(size);
+#endif
+    }
+    else
+    {
+        allocation = free_list.allocateBlock(size);
+    }
+    recordAllocation(allocation);
+    PROFILE_ALLOCATION(allocation, size);
+    TRACE_END(ALLOC_TRACE_SMALLOC, allocation, 1, size);
+    LATENCY_END(SMALLOC_OP_SMALLOC, size >= MY_MMAP_THRESHOLD);
+    return allocation;
+}
+
+static void zeroAllocation(void* allocation, size_t size)
+{
+    MallocMetaData *datap = (MallocMetaData*)((char*)allocation - sizeof(MallocMetaData));
+    size_t dirty_size = size;
+    if (datap->is_zeroed)
+    {
+        // skip the untouched pages so they're not faulted in, clear only up to the first page boundary.
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t page_offset = (size_t)allocation % page_size;
+        dirty_size = (page_offset == 0) ? 0 : (page_size - page_offset);
+        if (dirty_size > size)
+        {
+            dirty_size = size;
+        }
+    }
+    bulkMemset(allocation, 0, dirty_size);
+}
+
+void *scalloc(size_t num, size_t size)
+{
+    size_t total;
+    if (num <= 0 || size <= 0 || __builtin_mul_overflow(num, size, &total) || total > SIZE_LIMIT)
+    {
+        /* 
+        potential error:
+            consider not checking if num*size > MAX_SIZE. 
+            is it a case for mmap or is it an error?
+        */
+        return NULL;
+    }
+    TRACE_BEGIN(NULL);
+    void* allocation = smalloc(total);
+    if(allocation != NULL)
+    {
+        zeroAllocation(allocation, total);
+    }
+    TRACE_END(ALLOC_TRACE_SCALLOC, allocation, num, size);
+    return allocation;
+}
+
+/*
+smemalign() hands out a pointer inside a bigger block, right after an alias metadata whose addr is the
+payload of the real block (a real block's addr is always its own payload).
+*/
+static MallocMetaData* getBlock(void* p)
+{
+    MallocMetaData *datap = (MallocMetaData*)((char*)p - sizeof(MallocMetaData));
+    if (datap->cookies == free_list.cookies && datap->addr != p)
+    {
+        datap = (MallocMetaData*)((char*)datap->addr - sizeof(MallocMetaData));
+    }
+    return datap;
+}
+
+void* smemalign(size_t alignment, size_t size)
+{
+    if (size <= 0 || size > SIZE_LIMIT || alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        return NULL;
+    }
+    if (alignment <= MIN_ALIGNMENT)
+    {
+        return smalloc(size);
+    }
+    // enough to find an aligned address with room for the alias metadata in front of it.
+    char* allocation = (char*)smalloc(size + alignment + sizeof(MallocMetaData));
+    if (allocation == NULL || ((size_t)allocation % alignment) == 0)
+    {
+        return allocation;
+    }
+    char* aligned = (char*)(((size_t)allocation + sizeof(MallocMetaData) + alignment - 1) & ~(alignment - 1));
+    MallocMetaData* block = (MallocMetaData*)(allocation - sizeof(MallocMetaData));
+    MallocMetaData* alias = (MallocMetaData*)(aligned - sizeof(MallocMetaData));
+    *alias = *block;
+    alias->addr = allocation;
+    alias->size = block->size - (aligned - allocation);
+    alias->next = NULL;
+    alias->prev = NULL;
+    return aligned;
+}
+
+size_t smalloc_usable_size(void* p)
+{
+    if (p == NULL)
+    {
+        return 0;
+    }
+    MallocMetaData *datap = (MallocMetaData*)((char*)p - sizeof(MallocMetaData));
+    if (datap->cookies != free_list.cookies)
+    {
+        exit(0xdeadbeef);
+    }
+    return datap->size; // an alias' size is what's left of its block past p.
+}
+
+void sfree(void* p)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+    MallocMetaData *datap = getBlock(p);
+    MallocMetaData* merged = datap;
+    if (datap->cookies != free_list.cookies || datap->cookies != mmap_registry.cookies)
+    {
+        // an overflow occured and someone used our data.
+        exit(0xdeadbeef);
+    }
+    if (datap->is_free)
+    {
+        return; // block is already free!
+    }
+    LATENCY_BEGIN();
+    TRACE_BEGIN(datap);
+    PROFILE_FREE(datap);
+    bool is_mmap = (datap->size >= MY_MMAP_THRESHOLD);
+    
+    if (is_mmap)
+    {
+        /*
+        potential errors:
+            should we check if (datap->size > MY_MMAP_THRESHOLD) or (datap->size >= MY_MMAP_THRESHOLD)?
+        */
+#ifdef MALLOC_HUGE_ALLOCATIONS
+        if (isHugeBlock(datap))
+        {
+            hugeUnmap(datap, datap->size, sizeof(MallocMetaData));
+        }
+        else
+        {
+            mmap_registry.removeMapping(datap);
+        }
+#else
+        mmap_registry.removeMapping(datap);
+#endif
+    }
+    else
+    {
+        free_list.setBlockFree(merged, true);
+        merged->is_zeroed = false;
+        free_list.setRequestedSize(merged, 0);
+        free_list.num_free_blocks += 1;
+        free_list.num_free_bytes += merged->size;
+        free_list.num_allocated_blocks -= 1;
+        free_list.num_allocated_bytes -= merged->size;
+
+        MallocMetaData *buddy = free_list.findBuddy(merged);
+        while (buddy != NULL)
+        {
+            if (buddy < merged)
+            {
+                merged = free_list.mergeBlocks(buddy, merged);
+            }
+            else
+            {
+                merged = free_list.mergeBlocks(merged, buddy);
+            }
+            buddy = free_list.findBuddy(merged);
+        }
+    }
+    TRACE_END(ALLOC_TRACE_SFREE, NULL, 1, 0);
+    LATENCY_END(SMALLOC_OP_SFREE, is_mmap);
+}
+
+void* srealloc(void* oldp, size_t size)
+{
+    if (size <= 0 || size > SIZE_LIMIT)
+    {
+        return NULL;
+    }
+
+    if(oldp == NULL)
+    {
+        return smalloc(size);
+    }
+    MallocMetaData *datap = (MallocMetaData*)((char*)oldp - sizeof(MallocMetaData));
+    size_t old_size = datap->size; // datap's metadata may be overwritten by the copy.
+    bool merged_blocks = false;
+    if (datap->cookies != free_list.cookies || datap->cookies != mmap_registry.cookies)
     {
         exit(0xdeadbeef);
     }
+    if (datap->addr != oldp)
+    {
+        // an aligned alias (smemalign), the data is moved to a plain block.
+        void* newp = smalloc(size);
+        if (newp != NULL)
+        {
+            bulkMemmove(newp, oldp, (old_size < size) ? old_size : size);
+            sfree(oldp);
+        }
+        return newp;
+    }
+    LATENCY_BEGIN();
+    TRACE_BEGIN(datap);
+    bool is_mmap = (size >= 128*KB);
     void* newp = NULL;
-    if (size >= 128*KB)
+    if (is_mmap)
     {
         /*
         potential errors:
@@ -785,121 +1834,118 @@ void* srealloc(void* oldp, size_t size)
         */
         if (datap->size == size)
         {
+            TRACE_END(ALLOC_TRACE_SREALLOC, oldp, 1, size);
+            LATENCY_END(SMALLOC_OP_SREALLOC, is_mmap);
+            return oldp;
+        }
+        else if (datap->size >= MY_MMAP_THRESHOLD && mmap_registry.resizeMapping(datap, size))
+        {
+            recordAllocation(oldp);
+            PROFILE_FREE(datap);
+            PROFILE_ALLOCATION(oldp, size);
+            TRACE_END(ALLOC_TRACE_SREALLOC, oldp, 1, size);
+            LATENCY_END(SMALLOC_OP_SREALLOC, is_mmap);
             return oldp;
         }
+#ifdef MALLOC_HUGE_ALLOCATIONS
+        else if (isHugeBlock(datap) && size > MAX_SIZE)
+        {
+            PROFILE_FREE(datap);
+            newp = remapHugeBlock(datap, size);
+            if (newp == NULL)
+            {
+                PROFILE_ALLOCATION(oldp, old_size); // it's still there
+            }
+            else
+            {
+                PROFILE_ALLOCATION(newp, size);
+            }
+            TRACE_END(ALLOC_TRACE_SREALLOC, newp, 1, size);
+            LATENCY_END(SMALLOC_OP_SREALLOC, is_mmap);
+            return newp;
+        }
+#endif
         else
         {
-            newp = smalloc(size); // which will use mmap() in this case.
-            mmap_free_list.deleteFromFreeList(datap);
-            mmap_free_list.insertToFreeList((MallocMetaData*)newp);
+            newp = smalloc(size); // which will use mmap() and register the new chunk in this case.
         }
     }
-    else
+    else if (datap->size >= MY_MMAP_THRESHOLD)
+    {
+        newp = smalloc(size); // a chunk shrinking into the buddy heap.
+    }
+    else if (free_list.isBlockContainable(datap, size))
     {
-        MallocMetaData *datap_prev = free_list.findPreviousBuddy(datap);
-        MallocMetaData *datap_next = free_list.findNextBuddy(datap);
-        bool managed_to_contain = free_list.isBlockContainable(datap, size);
         MallocMetaData* merged = datap;
-
-        if (datap->cookies != free_list.cookies ||
-            (datap_prev != NULL && datap_prev->cookies != free_list.cookies) ||
-            (datap_next != NULL && datap_next->cookies != free_list.cookies))
-        {
-            // an overflow occured and someone used our data.
-            exit(0xdeadbeef);
-        }
-        
-        if (managed_to_contain)
+        // datap may be absorbed by a buddy, its request is accounted again on the block it ends up in.
+        free_list.setRequestedSize(datap, 0);
+        while (merged->size < size)
         {
-            while ( merged && (merged->size < size) )
+            MallocMetaData* buddy = free_list.findBuddy(merged);
+            free_list.num_allocated_bytes -= merged->size;
+            free_list.num_free_bytes -= merged->size;
+            if (buddy < merged)
             {
-                if ( datap_next && datap_prev && (datap_prev->size <= datap_next->size) )
-                {
-                    free_list.num_allocated_bytes -= merged->size;
-                    free_list.num_free_bytes -= merged->size;
-                    merged = free_list.mergeBlocks(datap_prev, merged);
-                    merged->is_free = false;
-                    free_list.num_free_bytes -= (sizeof(MallocMetaData));
-                    free_list.num_allocated_bytes += merged->size;
-                    merged_blocks = true;
-                }
-                else if ( datap_next && datap_prev && ( datap_prev->size > datap_next->size ) )
-                {
-                    free_list.num_allocated_bytes -= merged->size;
-                    free_list.num_free_bytes -= merged->size;
-                    merged = free_list.mergeBlocks(merged, datap_next);
-                    merged->is_free = false;
-                    free_list.num_free_bytes -= (sizeof(MallocMetaData));
-                    free_list.num_allocated_bytes += merged->size;
-                    merged_blocks = true;
-                }
-                else if ( datap_next && (!datap_prev) )
-                {
-                    free_list.num_allocated_bytes -= merged->size;
-                    free_list.num_free_bytes -= merged->size;
-                    merged = free_list.mergeBlocks(merged, datap_next);
-                    merged->is_free = false;
-                    free_list.num_free_bytes -= (sizeof(MallocMetaData));
-                    free_list.num_allocated_bytes += (merged->size);
-                    merged_blocks = true;
-                }
-                else if ( (!datap_next) && datap_prev )
-                {
-                    free_list.num_allocated_bytes -= merged->size;
-                    free_list.num_free_bytes -= merged->size;
-                    merged = free_list.mergeBlocks(datap_prev, merged);
-                    merged->is_free = false;
-                    free_list.num_free_bytes -= (sizeof(MallocMetaData));
-                    free_list.num_allocated_bytes += (merged->size);
-                    merged_blocks = true;
-                } 
-                datap_prev = free_list.findPreviousBuddy(merged);
-                datap_next = free_list.findNextBuddy(merged);
-            }   
-        }
-        else
-        {
-            merged = free_list.findBlock(size);
-            managed_to_contain = true;
+                merged = free_list.mergeBlocks(buddy, merged);
+            }
+            else
+            {
+                merged = free_list.mergeBlocks(merged, buddy);
+            }
+            free_list.setBlockFree(merged, false);
+            free_list.num_free_bytes -= (sizeof(MallocMetaData));
+            free_list.num_allocated_bytes += merged->size;
+            merged_blocks = true;
         }
         newp = merged->addr;
+        free_list.setRequestedSize(merged, size);
+        recordAllocation(newp); // merging may have grown the used bytes.
+        // datap's metadata may be inside the merged block now, drop its sample before the data is moved.
+        PROFILE_FREE(datap);
+        PROFILE_ALLOCATION(newp, size);
     }
-
-    if(!newp)
+    else
     {
-        return NULL;
+        newp = smalloc(size);
     }
-    if(memmove(newp, oldp, datap->size) != newp) 
+
+    if(!newp)
     {
+        TRACE_END(ALLOC_TRACE_SREALLOC, NULL, 1, size);
+        LATENCY_END(SMALLOC_OP_SREALLOC, is_mmap);
         return NULL;
     }
+    size_t copy_size = (old_size < size) ? old_size : size;
+    bulkMemmove(newp, oldp, copy_size);
     if ( (!merged_blocks) && (newp != oldp) )
     {
         sfree(oldp);
     }
+    TRACE_END(ALLOC_TRACE_SREALLOC, newp, 1, size);
+    LATENCY_END(SMALLOC_OP_SREALLOC, is_mmap);
     return newp;
 }
 
 size_t _num_free_blocks()
 {
-    return free_list.num_free_blocks + mmap_free_list.num_free_blocks;
+    return free_list.num_free_blocks;
 }
 
 size_t _num_free_bytes()
 {
-    return free_list.num_free_bytes + mmap_free_list.num_free_bytes;
+    return free_list.num_free_bytes;
 }
 
 size_t _num_allocated_blocks()
 {
     return (free_list.num_allocated_blocks + free_list.num_free_blocks
-            + mmap_free_list.num_allocated_blocks + mmap_free_list.num_free_blocks); // look at function 7
+            + mmap_registry.num_allocated_blocks); // look at function 7
 }
 
 size_t _num_allocated_bytes()
 {
     return (free_list.num_allocated_bytes + free_list.num_free_bytes
-            + mmap_free_list.num_allocated_bytes + mmap_free_list.num_free_bytes);
+            + mmap_registry.num_allocated_bytes);
 }
 
 // size_t _num_free_blocks()
@@ -922,6 +1968,479 @@ size_t _num_allocated_bytes()
 // return (free_list.num_allocated_bytes + mmap_free_list.num_allocated_bytes );
 // }
 
+void smalloc_fragmentation(struct smalloc_fragmentation* fragmentation)
+{
+    if (fragmentation == NULL)
+    {
+        return;
+    }
+    initializeAllocator();
+    size_t free_blocks_by_order[MAX_ORDER+1];
+    size_t total_free_blocks = 0;
+    size_t total_free_bytes = 0; // in whole blocks, metadata included
+    fragmentation->largest_free_order = -1;
+    fragmentation->largest_free_block = 0;
+    for (int i = 0; i < (MAX_ORDER+1); i++)
+    {
+        // every block of an order has the same size.
+        size_t block_size = ((size_t)MIN_BUDDY_BLOCK << i);
+        free_blocks_by_order[i] = free_list.orders_list[i].num_free_blocks;
+        fragmentation->free_bytes_by_order[i] = free_blocks_by_order[i] * (block_size - sizeof(MallocMetaData));
+        total_free_bytes += free_blocks_by_order[i] * block_size;
+        total_free_blocks += free_blocks_by_order[i];
+        if (free_blocks_by_order[i] > 0)
+        {
+            fragmentation->largest_free_order = i;
+            fragmentation->largest_free_block = block_size - sizeof(MallocMetaData);
+        }
+    }
+
+    /*
+    the fragmentation index of Linux's buddy allocator: how much a failure to allocate a block of
+    the given order would be due to fragmentation (close to 1) rather than to lack of memory (close to 0).
+    an allocation that would succeed gets -1.
+    */
+    for (int i = 0; i < (MAX_ORDER+1); i++)
+    {
+        if (i <= fragmentation->largest_free_order)
+        {
+            fragmentation->fragmentation_index[i] = -1;
+        }
+        else if (total_free_blocks == 0)
+        {
+            fragmentation->fragmentation_index[i] = 0;
+        }
+        else
+        {
+            double requested = pow(2,i)*MIN_BUDDY_BLOCK;
+            fragmentation->fragmentation_index[i] = 1.0 - (1.0 + (total_free_bytes / requested)) / total_free_blocks;
+        }
+    }
+
+    fragmentation->requested_bytes = free_list.num_requested_bytes;
+    fragmentation->granted_bytes = free_list.num_allocated_bytes;
+    fragmentation->internal_fragmentation_bytes = free_list.num_allocated_bytes - free_list.num_requested_bytes;
+}
+
+static bool writeSnapshotBuffer(int fd, const char* buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, buffer, length);
+        if (written <= 0)
+        {
+            return false;
+        }
+        buffer += written;
+        length -= written;
+    }
+    return true;
+}
+
+/*
+Only write(2) is used and nothing is allocated, so this can run from a signal handler.
+The buddy region is walked physically (every block starts where the previous one ends), which also shows
+blocks that were lost from the order lists. If the signal interrupted the allocator mid-update the walk
+may meet a half-written block, it stops there and marks the snapshot as corrupted.
+*/
+int smalloc_snapshot_write(int fd)
+{
+    struct heap_snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = HEAP_SNAPSHOT_MAGIC;
+    header.version = HEAP_SNAPSHOT_VERSION;
+    header.num_roots = free_list.num_roots;
+    header.root_size = DEFAULT_BUDDY_BLOCK;
+    header.min_block_size = MIN_BUDDY_BLOCK;
+    header.meta_data_size = sizeof(MallocMetaData);
+    header.region_base = (uint64_t)free_list.buddy_region;
+    if (!writeSnapshotBuffer(fd, (const char*)&header, sizeof(header)))
+    {
+        return -1;
+    }
+
+    struct heap_snapshot_record records[64];
+    int num_records = 0;
+    memset(records, 0, sizeof(records));
+    char* region_end = (char*)free_list.buddy_region + (free_list.num_roots*DEFAULT_BUDDY_BLOCK);
+    char* curr = (char*)free_list.buddy_region;
+    bool corrupted = false;
+    while (free_list.buddy_region != NULL && curr < region_end)
+    {
+        MallocMetaData* block = (MallocMetaData*)curr;
+        int order = getOrderFromSize(block->size + sizeof(MallocMetaData));
+        if (block->cookies != free_list.cookies || order < 0 || curr + block->size + sizeof(MallocMetaData) > region_end)
+        {
+            corrupted = true;
+            break;
+        }
+        records[num_records].type = HEAP_SNAPSHOT_BLOCK;
+        records[num_records].order = order;
+        records[num_records].is_free = block->is_free;
+        records[num_records].requested_size = block->requested_size;
+        records[num_records].address = (uint64_t)block;
+        records[num_records].size = block->size;
+        num_records++;
+        if (num_records == 64)
+        {
+            if (!writeSnapshotBuffer(fd, (const char*)records, sizeof(records)))
+            {
+                return -1;
+            }
+            num_records = 0;
+        }
+        curr += block->size + sizeof(MallocMetaData);
+    }
+    for (MallocMetaData* chunk = mmap_registry.head->next; !corrupted && chunk != mmap_registry.tail; chunk = chunk->next)
+    {
+        if (chunk == NULL || chunk->cookies != mmap_registry.cookies)
+        {
+            corrupted = true;
+            break;
+        }
+        records[num_records].type = HEAP_SNAPSHOT_CHUNK;
+        records[num_records].order = 0;
+        records[num_records].is_free = chunk->is_free;
+        records[num_records].requested_size = 0;
+        records[num_records].address = (uint64_t)chunk;
+        records[num_records].size = chunk->size;
+        num_records++;
+        if (num_records == 64)
+        {
+            if (!writeSnapshotBuffer(fd, (const char*)records, sizeof(records)))
+            {
+                return -1;
+            }
+            num_records = 0;
+        }
+    }
+    memset(&records[num_records], 0, sizeof(records[num_records]));
+    records[num_records].type = corrupted ? HEAP_SNAPSHOT_CORRUPTED : HEAP_SNAPSHOT_END;
+    num_records++;
+    if (!writeSnapshotBuffer(fd, (const char*)records, num_records * sizeof(records[0])))
+    {
+        return -1;
+    }
+    return corrupted ? -1 : 0;
+}
+
+static char snapshot_path[256];
+
+static void snapshotSignalHandler(int signo)
+{
+    int saved_errno = errno;
+    int fd = open(snapshot_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0)
+    {
+        smalloc_snapshot_write(fd);
+        close(fd);
+    }
+    errno = saved_errno;
+}
+
+int smalloc_snapshot_on_signal(int signo, const char* path)
+{
+    if (path == NULL || strlen(path) >= sizeof(snapshot_path))
+    {
+        return -1;
+    }
+    strcpy(snapshot_path, path);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = snapshotSignalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    return sigaction(signo, &action, NULL);
+}
+
+#ifdef MALLOC_TRACE
+int smalloc_trace_start(int fd)
+{
+    if (trace_fd >= 0 || fd < 0)
+    {
+        return -1;
+    }
+    struct alloc_trace_header header;
+    header.magic = ALLOC_TRACE_MAGIC;
+    header.version = ALLOC_TRACE_VERSION;
+    trace_fd = fd;
+    memcpy(trace_buffer, &header, sizeof(header));
+    trace_length = sizeof(header);
+    trace_first_id = trace_next_id;
+    trace_last_time = readTraceTime();
+    return 0;
+}
+
+int smalloc_trace_stop()
+{
+    if (trace_fd < 0)
+    {
+        return -1;
+    }
+    bool flushed = flushTrace();
+    trace_fd = -1;
+    return flushed ? 0 : -1;
+}
+#else
+int smalloc_trace_start(int fd)
+{
+    return -1;
+}
+
+int smalloc_trace_stop()
+{
+    return -1;
+}
+#endif
+
+// huge allocations (-DMALLOC_HUGE_ALLOCATIONS) aren't counted by the functions above.
+size_t _num_huge_allocations()
+{
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    return huge_alloc_stats.num_blocks;
+#else
+    return 0;
+#endif
+}
+
+size_t _num_huge_allocation_bytes()
+{
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    return huge_alloc_stats.num_bytes;
+#else
+    return 0;
+#endif
+}
+
+size_t _num_huge_page_bytes()
+{
+    return free_list.num_huge_page_bytes + mmap_registry.num_huge_page_bytes;
+}
+
+void smalloc_stats(struct smalloc_stats* stats)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+    initializeAllocator();
+    for (int i = 0; i < (MAX_ORDER+1); i++)
+    {
+        stats->free_blocks_by_order[i] = free_list.orders_list[i].num_free_blocks;
+        stats->used_blocks_by_order[i] = free_list.orders_list[i].num_used_blocks;
+    }
+    stats->num_splits = free_list.num_splits;
+    stats->num_merges = free_list.num_merges;
+    stats->num_mmaps = mmap_registry.num_mmaps;
+    stats->num_munmaps = mmap_registry.num_munmaps;
+    stats->mmapped_bytes = mmap_registry.mmapped_bytes;
+    stats->munmapped_bytes = mmap_registry.munmapped_bytes;
+    stats->used_bytes = free_list.num_allocated_bytes + mmap_registry.num_allocated_bytes;
+    stats->peak_used_bytes = peak_used_bytes;
+    stats->huge_page_bytes = _num_huge_page_bytes();
+    stats->num_failed_allocations = num_failed_allocations;
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    stats->num_huge_allocations = huge_alloc_stats.num_blocks;
+    stats->huge_allocation_bytes = huge_alloc_stats.num_bytes;
+    stats->huge_mapped_bytes = huge_alloc_stats.mapped_bytes;
+#else
+    stats->num_huge_allocations = 0;
+    stats->huge_allocation_bytes = 0;
+    stats->huge_mapped_bytes = 0;
+#endif
+#ifdef MALLOC_PAGE_HEAP
+    stats->num_span_allocs = page_heap.num_span_allocs;
+    stats->num_span_frees = page_heap.num_span_frees;
+    stats->span_reserved_bytes = page_heap.num_regions * PAGE_HEAP_REGION_SIZE;
+    stats->span_free_bytes = page_heap.num_free_pages * PAGE_HEAP_PAGE_SIZE;
+#else
+    stats->num_span_allocs = 0;
+    stats->num_span_frees = 0;
+    stats->span_reserved_bytes = 0;
+    stats->span_free_bytes = 0;
+#endif
+}
+
+#ifdef MALLOC_LATENCY_STATS
+size_t smalloc_latency_samples(int op, int path)
+{
+    if (op < 0 || op >= SMALLOC_NUM_OPS || path < 0 || path >= SMALLOC_NUM_PATHS)
+    {
+        return 0;
+    }
+    size_t samples = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        samples += latency_histograms[op][path][i];
+    }
+    return samples;
+}
+
+size_t smalloc_latency_percentile(int op, int path, double percentile)
+{
+    size_t samples = smalloc_latency_samples(op, path);
+    if (samples == 0)
+    {
+        return 0;
+    }
+    // the rank of the sample holding the percentile, counting from 1.
+    size_t rank = (size_t)ceil(samples * percentile / 100.0);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    size_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += latency_histograms[op][path][i];
+        if (seen >= rank)
+        {
+            return getLatencyBucketBound(i);
+        }
+    }
+    return getLatencyBucketBound(LATENCY_BUCKETS - 1);
+}
+
+void smalloc_latency_dump(int fd)
+{
+    const char* op_names[SMALLOC_NUM_OPS] = {"smalloc", "sfree", "srealloc"};
+    const char* path_names[SMALLOC_NUM_PATHS] = {"buddy_hit", "split", "merge", "mmap", "munmap"};
+    char line[256];
+    int length = snprintf(line, sizeof(line), "%-10s %-10s %12s %12s %12s %12s\n", "op", "path", "samples", "p50", "p99", "p99.9");
+    if (write(fd, line, length) < 0)
+    {
+        return;
+    }
+    for (int op = 0; op < SMALLOC_NUM_OPS; op++)
+    {
+        for (int path = 0; path < SMALLOC_NUM_PATHS; path++)
+        {
+            size_t samples = smalloc_latency_samples(op, path);
+            if (samples == 0)
+            {
+                continue;
+            }
+            length = snprintf(line, sizeof(line), "%-10s %-10s %12zu %12zu %12zu %12zu\n", op_names[op], path_names[path], samples,
+                              smalloc_latency_percentile(op, path, 50), smalloc_latency_percentile(op, path, 99),
+                              smalloc_latency_percentile(op, path, 99.9));
+            if (write(fd, line, length) < 0)
+            {
+                return;
+            }
+        }
+    }
+}
+#else
+size_t smalloc_latency_samples(int op, int path)
+{
+    return 0;
+}
+
+size_t smalloc_latency_percentile(int op, int path, double percentile)
+{
+    return 0;
+}
+
+void smalloc_latency_dump(int fd)
+{}
+#endif
+
+#ifdef MALLOC_HEAP_PROFILER
+static bool writeAll(int fd, const char* buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, buffer, length);
+        if (written <= 0)
+        {
+            return false;
+        }
+        buffer += written;
+        length -= written;
+    }
+    return true;
+}
+
+size_t smalloc_profile_live_samples()
+{
+    size_t live = 0;
+    for (int i = 0; i < PROFILE_MAX_STACKS; i++)
+    {
+        live += profile_stacks[i].inuse_count;
+    }
+    return live;
+}
+
+void smalloc_profile_dump(int fd)
+{
+    size_t inuse_count = 0, inuse_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    for (int i = 0; i < PROFILE_MAX_STACKS; i++)
+    {
+        inuse_count += profile_stacks[i].inuse_count;
+        inuse_bytes += profile_stacks[i].inuse_bytes;
+        alloc_count += profile_stacks[i].alloc_count;
+        alloc_bytes += profile_stacks[i].alloc_bytes;
+    }
+
+    // pprof's legacy heap profile format, heap_v2 tells it the sampling rate to unsample with.
+    char line[64 + PROFILE_MAX_DEPTH * 20];
+    int length = snprintf(line, sizeof(line), "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%d\n",
+                          inuse_count, inuse_bytes, alloc_count, alloc_bytes, PROFILE_SAMPLE_BYTES);
+    if (!writeAll(fd, line, length))
+    {
+        return;
+    }
+    for (int i = 0; i < PROFILE_MAX_STACKS; i++)
+    {
+        ProfileStack* stack = &profile_stacks[i];
+        if (stack->alloc_count == 0)
+        {
+            continue;
+        }
+        length = snprintf(line, sizeof(line), "%zu: %zu [%zu: %zu] @", stack->inuse_count, stack->inuse_bytes,
+                          stack->alloc_count, stack->alloc_bytes);
+        for (int frame = 0; frame < stack->depth; frame++)
+        {
+            length += snprintf(line + length, sizeof(line) - length, " %p", stack->frames[frame]);
+        }
+        length += snprintf(line + length, sizeof(line) - length, "\n");
+        if (!writeAll(fd, line, length))
+        {
+            return;
+        }
+    }
+
+    // pprof needs the mappings to symbolize the addresses.
+    if (!writeAll(fd, "\nMAPPED_LIBRARIES:\n", strlen("\nMAPPED_LIBRARIES:\n")))
+    {
+        return;
+    }
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps < 0)
+    {
+        return;
+    }
+    char buffer[4096];
+    ssize_t bytes_read;
+    while ((bytes_read = read(maps, buffer, sizeof(buffer))) > 0)
+    {
+        if (!writeAll(fd, buffer, bytes_read))
+        {
+            break;
+        }
+    }
+    close(maps);
+}
+#else
+size_t smalloc_profile_live_samples()
+{
+    return 0;
+}
+
+void smalloc_profile_dump(int fd)
+{}
+#endif
+
 size_t _size_meta_data()
 {
     return (sizeof(MallocMetaData));
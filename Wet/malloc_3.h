@@ -0,0 +1,131 @@
+#ifndef MALLOC_3_H
+#define MALLOC_3_H
+
+#include <stddef.h>
+
+/*
+Extensions of the malloc_3 engine on top of the my_stdlib.h API.
+*/
+
+#define SMALLOC_NUM_ORDERS 11 // MAX_ORDER + 1
+
+struct smalloc_stats
+{
+    /* buddy heap, per order */
+    size_t free_blocks_by_order[SMALLOC_NUM_ORDERS];
+    size_t used_blocks_by_order[SMALLOC_NUM_ORDERS];
+
+    /* buddy heap events */
+    size_t num_splits;
+    size_t num_merges;
+
+    /* mmap()ed chunks */
+    size_t num_mmaps;
+    size_t num_munmaps;
+    size_t mmapped_bytes;   // total payload bytes ever mapped
+    size_t munmapped_bytes; // total payload bytes ever unmapped
+
+    /* huge allocations above MAX_SIZE (-DMALLOC_HUGE_ALLOCATIONS), none of the counters above sees them */
+    size_t num_huge_allocations;
+    size_t huge_allocation_bytes; // their payload
+    size_t huge_mapped_bytes;     // reserved for them, committed or not
+
+    /* page heap spans (-DMALLOC_PAGE_HEAP), they're chunks too but aren't counted as mmaps */
+    size_t num_span_allocs;
+    size_t num_span_frees;
+    size_t span_reserved_bytes; // of the regions the spans are carved out of
+    size_t span_free_bytes;     // in free spans, committed or not
+
+    /* usage, in payload bytes of the blocks handed out (buddy + mmap) */
+    size_t used_bytes;
+    size_t peak_used_bytes;
+    size_t huge_page_bytes;
+
+    /* valid requests that couldn't be satisfied */
+    size_t num_failed_allocations;
+};
+
+/*
+Fills stats with a snapshot of the allocator. Every counter, the per-order ones included, is kept up to date
+by the allocator: it costs the same however large the heap has grown, so it can be polled periodically.
+*/
+void smalloc_stats(struct smalloc_stats* stats);
+
+struct smalloc_fragmentation
+{
+    /* external fragmentation of the buddy heap */
+    int largest_free_order;     // the largest order that can still be allocated, -1 when there's no free block
+    size_t largest_free_block;  // payload bytes of the largest free block
+    size_t free_bytes_by_order[SMALLOC_NUM_ORDERS];
+    double fragmentation_index[SMALLOC_NUM_ORDERS]; // -1 if the order can be allocated, otherwise 0 (out of memory) .. 1 (fragmented)
+
+    /* internal fragmentation of the live buddy blocks */
+    size_t requested_bytes;
+    size_t granted_bytes; // payload bytes of the blocks handed out
+    size_t internal_fragmentation_bytes;
+};
+
+void smalloc_fragmentation(struct smalloc_fragmentation* fragmentation);
+
+/*
+Latency histograms, only collected when built with -DMALLOC_LATENCY_STATS (otherwise the probes compile
+to nothing, the queries return 0 and the dump writes nothing).
+Every outermost smalloc/sfree/srealloc call is timed in cycles (rdtsc) and filed by the path it took.
+*/
+enum smalloc_latency_op
+{
+    SMALLOC_OP_SMALLOC,
+    SMALLOC_OP_SFREE,
+    SMALLOC_OP_SREALLOC,
+    SMALLOC_NUM_OPS
+};
+
+enum smalloc_latency_path
+{
+    SMALLOC_PATH_BUDDY_HIT, // served by a buddy block as is
+    SMALLOC_PATH_SPLIT,     // a buddy block had to be split
+    SMALLOC_PATH_MERGE,     // buddies were merged
+    SMALLOC_PATH_MMAP,      // a chunk was mapped
+    SMALLOC_PATH_MUNMAP,    // a chunk was unmapped
+    SMALLOC_NUM_PATHS
+};
+
+size_t smalloc_latency_samples(int op, int path);
+// upper bound (in cycles) of the histogram bucket holding the given percentile, e.g. 99.9.
+size_t smalloc_latency_percentile(int op, int path, double percentile);
+// writes a p50/p99/p99.9 table of every non-empty histogram to fd, using only write(2).
+void smalloc_latency_dump(int fd);
+
+/*
+Sampled heap profiler, only active when built with -DMALLOC_HEAP_PROFILER (PROFILE_SAMPLE_BYTES sets the
+mean distance between samples, 512KB by default).
+The dump is a pprof legacy heap profile ("pprof <binary> <file>", or flamegraphs via "pprof -traces"),
+holding both the in-use and the allocated totals of every sampled call stack.
+*/
+size_t smalloc_profile_live_samples();
+void smalloc_profile_dump(int fd);
+
+/*
+Binary heap snapshot (see heap_snapshot.h), read it with tools/heap_snapshot_view.
+smalloc_snapshot_write() is async-signal-safe, smalloc_snapshot_on_signal() installs a handler that
+writes a snapshot to path whenever signo is delivered. Both return 0 on success and -1 on failure.
+*/
+int smalloc_snapshot_write(int fd);
+int smalloc_snapshot_on_signal(int signo, const char* path);
+
+/*
+smemalign() returns a block aligned to alignment (a power of two), it's released with sfree() as usual.
+smalloc_usable_size() is the number of bytes that can be used through p, at least what was asked for.
+*/
+void* smemalign(size_t alignment, size_t size);
+size_t smalloc_usable_size(void* p);
+
+/*
+Allocation trace (see alloc_trace.h), only recorded when built with -DMALLOC_TRACE (otherwise both return -1).
+Every smalloc/scalloc/srealloc/sfree call between start and stop is written to fd, replay it with
+tools/alloc_trace_replay_*. Both return 0 on success and -1 on failure.
+*/
+int smalloc_trace_start(int fd);
+int smalloc_trace_stop();
+
+#endif /* MALLOC_3_H */
@@ -1,722 +1,399 @@
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/mman.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <cmath> // necessary for calculations
+#include "mem_kernels.h"
+#ifdef MALLOC_HUGE_ALLOCATIONS
+#include "huge_alloc.h"
+#endif
 
 #define MAX_SIZE (1e8)
 #define KB (1024)
-#define MB (1024*1024)
 #define MY_MMAP_THRESHOLD (128*KB)
-#define DEFAULT_BUDDY_BLOCK (128*KB)
-#define MIN_BUDDY_BLOCK (128)
-#define BUDDY_BLOCKS_NUM 32
-#define MAX_ORDER 10
 
-static bool allocated_by_smalloc = false;
-static bool allocated_by_scalloc = false;
-static int  alloc_src_in_srealloc = 0;
+/*
+TLSF (two-level segregated fit): every smalloc/sfree is a bounded number of steps, no list is ever walked.
+Free blocks are kept in lists by size, the first level is the power of two (fl), the second splits it in
+SL_COUNT equal ranges (sl). A bitmap of the non empty first levels and one of the non empty second levels per
+first level find a list that holds blocks large enough in two bit scans. A request is rounded up to the next
+second level range first, so any block of the list found fits (good fit: at most 1/SL_COUNT too large).
+Blocks are split on allocation and coalesced with their physical neighbors on free, in O(1) through the
+prev_phys link and the size (the next block starts right after the payload).
+The heap grows by areas from sbrk(), a new area right after the previous one extends it. Allocations of
+MY_MMAP_THRESHOLD and more get a mapping of their own.
+*/
 
-void DEBUG_PrintList(); // to remove
+#define ALIGN_SIZE 16
+#define SL_COUNT_LOG2 4
+#define SL_COUNT (1 << SL_COUNT_LOG2)
+#define FL_INDEX_SHIFT (SL_COUNT_LOG2 + 4) // log2(ALIGN_SIZE), the sizes below 2^FL_INDEX_SHIFT share the first level
+#define SMALL_BLOCK_SIZE (1 << FL_INDEX_SHIFT)
+#define FL_INDEX_MAX 39 // the last first level takes everything from 2^(FL_INDEX_MAX - 1) up
+#define FL_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define MIN_BLOCK_SIZE 16 // a free block's payload holds its two list links
+#define HEAP_GROW_SIZE (128*KB)
+
+#define BLOCK_FREE ((size_t)1)
+#define BLOCK_MAPPED ((size_t)2)
+#define BLOCK_FLAGS (BLOCK_FREE | BLOCK_MAPPED)
 
 class MallocMetaData
 {
 public:
-    int cookies; // it's essential that the cookies are placed at the beginning of the block.
-    size_t size;
-    bool is_free;
-    void* addr;
-    MallocMetaData* next;
-    MallocMetaData* prev;
-    int allocation_src; /* can get 3 values: 0 := unallocated, 1 := allocated by scalloc, 2:= allocated by smalloc*/
-    MallocMetaData(int cookies = 0, size_t size = 0, bool is_free = false, MallocMetaData* next = NULL, MallocMetaData* prev = NULL, int allocation_src = 0);
-    ~MallocMetaData() = default;
-    bool operator==(MallocMetaData& other);
-    bool operator< (MallocMetaData& other);
-    bool operator>=(MallocMetaData& other);
-    bool operator> (MallocMetaData& other);
-    bool operator<=(MallocMetaData& other);
-};
+    MallocMetaData* prev_phys; // the block right before this one in its area, NULL for the first one
+    size_t size_and_flags; // payload bytes, a multiple of ALIGN_SIZE, with BLOCK_FREE and BLOCK_MAPPED in the low bits
+    // only while the block is free, they're the first bytes of its payload.
+    MallocMetaData* next_free;
+    MallocMetaData* prev_free;
 
-MallocMetaData::MallocMetaData(int cookies, size_t size, bool is_free, MallocMetaData* next, MallocMetaData* prev, int allocation_src):
-    cookies(cookies),
-    size(size),
-    is_free(is_free),
-    next(next),
-    prev(prev),
-    allocation_src(allocation_src)
-{}
-
-bool MallocMetaData::operator==(MallocMetaData& other)
-{
-    return (this->size == other.size && this->addr == other.addr);
-}
-
-bool MallocMetaData::operator<(MallocMetaData& other)
-{
-    if ( this->size < other.size )
+    size_t GetSize() const
     {
-        return true;
+        return this->size_and_flags & ~BLOCK_FLAGS;
     }
-    else if (this->size == other.size)
+    void SetSize(size_t size)
     {
-        return (this->addr < other.addr);
+        this->size_and_flags = size | (this->size_and_flags & BLOCK_FLAGS);
     }
-    return false;
-}
-
-bool MallocMetaData::operator>=(MallocMetaData& other)
-{
-    return !((*this) < other);
-}
-
-bool MallocMetaData::operator>(MallocMetaData& other)
-{
-    return ( (*this >= other) && !(*this == other) );    
-}
-
-bool MallocMetaData::operator<=(MallocMetaData& other)
-{
-    return( !((*this) > other) );
-}
-
-static void Swap(MallocMetaData* A, MallocMetaData* B)
-{
-    if(!A || !B) //sanity check
-        return;
-    
-    if(*A < *B)
+    bool IsFree() const
     {
-        MallocMetaData* tmp = A;
-        A = B;
-        B = tmp;
+        return (this->size_and_flags & BLOCK_FREE) != 0;
     }
-
-    MallocMetaData* prevA = A->prev;
-    MallocMetaData* nextA = A->next;
-    MallocMetaData* prevB = B->prev;
-    MallocMetaData* nextB = B->next;
-    
-    if(prevA != NULL)
+    void SetFree(bool is_free)
     {
-        prevA->next = B;
+        this->size_and_flags = is_free ? (this->size_and_flags | BLOCK_FREE) : (this->size_and_flags & ~BLOCK_FREE);
     }
-    if(nextA != NULL && nextA != B)
+    bool IsMapped() const
     {
-        nextA->prev = B;
+        return (this->size_and_flags & BLOCK_MAPPED) != 0;
     }
-
-    
-    if(nextB != NULL)
+    void* GetPayload()
     {
-        nextB->prev = A;
+        return (char*)this + BLOCK_OVERHEAD;
     }
-    if(prevB != NULL && prevB != A)
+    MallocMetaData* GetNextPhys()
     {
-        prevB->next = A;
+        return (MallocMetaData*)((char*)this + BLOCK_OVERHEAD + this->GetSize());
     }
-
-    B->prev = prevA;
-    if(nextA != B)
-        B->next = nextA;
-    else
-        B->next = A;
-
-    A->next = nextB;
-    if(prevB != A)
-        A->prev = prevB;
-    else
-        A->prev = B;
-
-}
-
-static void initializeData(MallocMetaData* head_datas, MallocMetaData* tail_datas)
-{
-    for (int i = 0; i < (BUDDY_BLOCKS_NUM+1); i++)
+    static MallocMetaData* FromPayload(void* p)
     {
-        head_datas[i] = MallocMetaData();
-        tail_datas[i] = MallocMetaData();
+        return (MallocMetaData*)((char*)p - BLOCK_OVERHEAD);
     }
-}
 
-static int getOrderFromSize(size_t size)
-{
-    double upper_size_bound = pow(2,MAX_ORDER)*MIN_BUDDY_BLOCK;
-    if (size == upper_size_bound)
-    {
-        return MAX_ORDER;
-    }
-    
-    for (int i = 0; i < (MAX_ORDER); i++)
-    {
-        double lower_bound = pow(2,i)*MIN_BUDDY_BLOCK;
-        double upper_bound = pow(2,i+1)*MIN_BUDDY_BLOCK;
-        if ( (size_t)(lower_bound) <= size && (size_t)upper_bound > size )
-        {
-            return i;
-        }
-    }
-    return -1;
-}
+    static const size_t BLOCK_OVERHEAD = 2 * sizeof(size_t); // prev_phys and size_and_flags
+};
 
-class MyList
+class Tlsf
 {
 public:
-    MallocMetaData* head;
-    MallocMetaData* tail;
-    MyList();
-    MyList(MallocMetaData* head_node, MallocMetaData* tail_node);
-    ~MyList() = default;
-    void insert(MallocMetaData* node);
-    void SortMallocMetaDataList(MallocMetaData* head_node, MallocMetaData* tail_node);
-    MallocMetaData* findBlock(MallocMetaData block);
-    int removeBlock(MallocMetaData* block);
+    unsigned int fl_bitmap; // bit fl is set while some list of the first level fl isn't empty
+    unsigned int sl_bitmap[FL_COUNT];
+    MallocMetaData* free_lists[FL_COUNT][SL_COUNT];
+    MallocMetaData* area_end; // the sentinel (a used, empty block) that ends the last area, NULL before the first one
+    size_t num_allocated_bytes; // payload bytes of the used blocks, mapped ones included
+    size_t num_free_bytes;
+    size_t num_allocated_blocks;
+    size_t num_free_blocks;
+
+    MallocMetaData* SearchBlock(size_t size);
+    void InsertFreeBlock(MallocMetaData* block);
+    void RemoveFreeBlock(MallocMetaData* block);
+    void SplitBlock(MallocMetaData* block, size_t size);
+    MallocMetaData* CoalesceBlock(MallocMetaData* block);
+    bool GrowHeap(size_t size);
 };
 
-MyList::MyList()
+static size_t AlignUp(size_t size)
 {
-    this->head = NULL;
-    this->tail = NULL;
+    return (size + ALIGN_SIZE - 1) & ~(size_t)(ALIGN_SIZE - 1);
 }
 
-MyList::MyList(MallocMetaData* head_node, MallocMetaData* tail_node)
+static int FindLastSet(size_t n)
 {
-    this->head = head_node;
-    if (this->head)
-    {
-        this->head->next = tail_node;
-    }
-    this->tail = tail_node;
-    if (this->tail)
-    {
-        this->tail->prev = head_node;
-    }
+    return 63 - __builtin_clzll(n);
 }
 
-void MyList::insert(MallocMetaData* node)
+// the lists a block of this size goes to.
+static void MappingInsert(size_t size, int* fl, int* sl)
 {
-    node->next = this->tail;
-    node->prev = this->tail->prev;
-    this->tail->prev->next = node;
-    this->tail->prev = node;
-    SortMallocMetaDataList(this->head, this->tail);
-}
-
-void MyList::SortMallocMetaDataList(MallocMetaData* head_node, MallocMetaData* tail_node)
-{
-    size_t list_size = 0;
-    for ( MallocMetaData *curr = this->head->next; curr != tail_node; curr = curr->next)
-    {
-        list_size++; 
-    }
-    
-    if(list_size <= 1)
+    if (size < SMALL_BLOCK_SIZE)
     {
+        *fl = 0;
+        *sl = (int)(size / (SMALL_BLOCK_SIZE / SL_COUNT));
         return;
     }
-    
-    for (MallocMetaData *curr = this->head->next; curr != tail_node; curr = curr->next)
+    int last_set = FindLastSet(size);
+    *fl = last_set - (FL_INDEX_SHIFT - 1);
+    *sl = (int)((size >> (last_set - SL_COUNT_LOG2)) ^ (1 << SL_COUNT_LOG2));
+    if (*fl >= FL_COUNT)
     {
-        for (MallocMetaData *curr_inner = curr->next; curr_inner != tail_node; curr_inner = curr_inner->next )
-        {
-            if ( (*curr_inner) < (*curr) )
-            {
-                Swap(curr_inner ,curr ); 
-                MallocMetaData* tmp = curr_inner;
-                curr_inner = curr;
-                curr = tmp;  
-            }
-        }   
+        *fl = FL_COUNT - 1;
+        *sl = SL_COUNT - 1;
     }
 }
 
-MallocMetaData* MyList::findBlock(MallocMetaData block)
+// a block of at least this size is in a list whose every block fits: the next second level range.
+static size_t RoundUpSearchSize(size_t size)
 {
-    for (MallocMetaData *curr = this->head->next; curr != this->tail; curr = curr->next )
+    if (size < SMALL_BLOCK_SIZE)
     {
-        if ( (*curr) == block )
-        {
-            return curr;
-        }
-    } 
-    return NULL;  
+        return size;
+    }
+    return size + ((size_t)1 << (FindLastSet(size) - SL_COUNT_LOG2)) - 1;
+}
+
+static void MappingSearch(size_t size, int* fl, int* sl)
+{
+    MappingInsert(RoundUpSearchSize(size), fl, sl);
 }
 
-int MyList::removeBlock(MallocMetaData* block)
+MallocMetaData* Tlsf::SearchBlock(size_t size)
 {
-    MallocMetaData* found = findBlock(*block);
-    if (!found)
+    int fl, sl;
+    MappingSearch(size, &fl, &sl);
+    if (fl >= FL_COUNT)
     {
-        return -1;
+        return NULL;
     }
-    else
+    unsigned int sl_map = this->sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0)
     {
-        MallocMetaData* tmp = block->prev;
-        block->prev->next = block->next;
-        block->next->prev = tmp;
+        unsigned int fl_map = (fl + 1 < FL_COUNT) ? this->fl_bitmap & (~0U << (fl + 1)) : 0;
+        if (fl_map == 0)
+        {
+            return NULL;
+        }
+        fl = __builtin_ctz(fl_map);
+        sl_map = this->sl_bitmap[fl];
     }
-    return 1;
-}
-
-class FreeList
-{
-public:
-    int cookies;
-    MallocMetaData* head;
-    MallocMetaData* tail;
-    void* wasted_block;
-    size_t wasted_block_size;
-    MyList orders_list[ MAX_ORDER + 1];
-
-    size_t num_allocated_bytes;
-    size_t num_free_bytes;
-    size_t num_allocated_blocks;
-    size_t num_free_blocks;
-
-    FreeList(MallocMetaData* head_node, MallocMetaData* tail_node, MallocMetaData* head_datas, MallocMetaData* tail_datas);
-    ~FreeList() = default;
-    void initializeBuddySystem(MallocMetaData* head_nodes, MallocMetaData* tail_nodes);
-    void SortMallocMetaDataList(MallocMetaData* head_node, MallocMetaData* tail_node);
-    MallocMetaData* findBlock(size_t required_size);
-    MallocMetaData* splitBlock(MallocMetaData* data, size_t min_size);
-    MallocMetaData* mergeBlocks(MallocMetaData* prev, MallocMetaData* curr);
-    MallocMetaData* findNextBuddy(MallocMetaData* block);
-    MallocMetaData* findPreviousBuddy(MallocMetaData* block);
-    void insertToFreeList(MallocMetaData* block);
-    void deleteFromFreeList(MallocMetaData* block);
-    void* addMapping(size_t size);
-    void* allocateBlock(size_t size);
-    void removeMapping(MallocMetaData* block);
-    bool isBlockContainable(MallocMetaData* block, size_t required_size);
-};
-
-void FreeList::initializeBuddySystem(MallocMetaData* head_nodes, MallocMetaData* tail_nodes)
-{
-    // allign allocations to start at a multiple of (32*128*KB) to ease calculations later
-    void* curr_prog_break = sbrk(0);
-    size_t align_to_num = (32*128*KB);
-    size_t alloc_alignment_size = align_to_num - ( ((size_t)curr_prog_break) % align_to_num ); // check correctness!!!!!!!!!!!
-    this->wasted_block = curr_prog_break;
-    this->wasted_block_size = alloc_alignment_size;
-    this->wasted_block = sbrk(alloc_alignment_size);
-
-
-    // allocate the new aray of size (32*128*KB)
-    void* new_list = sbrk(32*128*KB);
-    for (int i = 0; i < BUDDY_BLOCKS_NUM; i++)
-    {
-        MallocMetaData* curr = (MallocMetaData*)((char*)new_list + (i*DEFAULT_BUDDY_BLOCK));
-        // MallocMetaData* next = (MallocMetaData*)((char*)new_list + ((i+1)*DEFAULT_BUDDY_BLOCK));
-        // MallocMetaData* prev = (MallocMetaData*)((char*)new_list + ((i-1)*DEFAULT_BUDDY_BLOCK));
-        curr->size = (128*KB) - sizeof(MallocMetaData);
-        curr->is_free = true;
-        curr->cookies = this->cookies;
-        curr->addr = (void*)((char*)curr + sizeof(MallocMetaData));
-        this->orders_list[MAX_ORDER].insert(curr); // at the beginning they're all inserted with size = 128KB
-        this->num_free_bytes += curr->size;
-        this->num_free_blocks += 1;
-    }
-    this->num_allocated_blocks = 0;
-    this->num_allocated_bytes = 0;
+    sl = __builtin_ctz(sl_map);
+    return this->free_lists[fl][sl];
 }
 
-FreeList::FreeList(MallocMetaData* head_node, MallocMetaData* tail_node, MallocMetaData* head_datas, MallocMetaData* tail_datas)
+void Tlsf::InsertFreeBlock(MallocMetaData* block)
 {
-    srand(0);
-    this->cookies = rand();
-    this->head = head_node;
-    this->head->next = tail_node;
-    this->tail = tail_node;
-    this->tail->prev = head_node;
-    this->head->cookies = this->cookies;
-    initializeData(head_datas, tail_datas);
-    for (int i = 0; i < (MAX_ORDER+1); i++)
-    {
-        this->orders_list[i] = MyList( &head_datas[i], &tail_datas[i]); 
-    }
-
-    this->num_free_blocks = 0;
-    this->num_allocated_blocks = 0;
-    this->num_free_bytes = 0;
-    this->num_allocated_bytes = 0;
+    int fl, sl;
+    MappingInsert(block->GetSize(), &fl, &sl);
+    MallocMetaData* head = this->free_lists[fl][sl];
+    block->prev_free = NULL;
+    block->next_free = head;
+    if (head != NULL)
+    {
+        head->prev_free = block;
+    }
+    this->free_lists[fl][sl] = block;
+    this->fl_bitmap |= 1U << fl;
+    this->sl_bitmap[fl] |= 1U << sl;
 }
 
-void FreeList::SortMallocMetaDataList(MallocMetaData* head_node, MallocMetaData* tail_node)
+void Tlsf::RemoveFreeBlock(MallocMetaData* block)
 {
-    size_t list_size = 0;
-    for ( MallocMetaData *curr = this->head->next; curr != tail_node; curr = curr->next)
+    int fl, sl;
+    MappingInsert(block->GetSize(), &fl, &sl);
+    if (block->prev_free == NULL)
     {
-        list_size++; 
+        this->free_lists[fl][sl] = block->next_free;
     }
-    
-    if(list_size <= 1)
+    else
     {
-        return;
+        block->prev_free->next_free = block->next_free;
     }
-    
-    for (MallocMetaData *curr = this->head->next; curr != tail_node; curr = curr->next)
+    if (block->next_free != NULL)
     {
-        for (MallocMetaData *curr_inner = curr->next; curr_inner != tail_node; curr_inner = curr_inner->next )
-        {
-            if ( (*curr_inner) < (*curr) )
-            {
-                Swap(curr_inner ,curr ); 
-                MallocMetaData* tmp = curr_inner;
-                curr_inner = curr;
-                curr = tmp;  
-            }
-        }   
+        block->next_free->prev_free = block->prev_free;
     }
-}
-
-MallocMetaData* FreeList::findBlock(size_t required_size)
-{
-    for (int i = 0; i < (MAX_ORDER+1); i++)
+    if (this->free_lists[fl][sl] == NULL)
     {
-        for (MallocMetaData* curr = this->orders_list[i].head->next; curr != this->orders_list[i].tail; curr = curr->next)
+        this->sl_bitmap[fl] &= ~(1U << sl);
+        if (this->sl_bitmap[fl] == 0)
         {
-            if (curr->cookies != this->cookies)
-            {
-                exit(0xdeadbeef);
-            }
-            
-            if (curr->size >= required_size && curr->is_free == true)
-            { // since the list is sorted we'll find the smallest size first.
-                return curr;
-            }     
+            this->fl_bitmap &= ~(1U << fl);
         }
     }
-    return NULL;
 }
 
-/*
-potential errors
-Useful edge case tests:
-1) when should we stop splitting? when block->size <= 2*min_size or when (block->size + sizeof(MallocMetaData)) <= 2*min_size
-*/
-MallocMetaData* FreeList::splitBlock(MallocMetaData* data, size_t min_size)
+// what the used block doesn't need becomes a free block of its own, when it's big enough to hold one.
+void Tlsf::SplitBlock(MallocMetaData* block, size_t size)
 {
-    // min_size is the size of the block we want to insert!
-    MallocMetaData* new_block = NULL;
-    MallocMetaData* curr_block = data;
-    int current_size = curr_block->size;
-    size_t new_size = (current_size - sizeof(MallocMetaData))/2; // the size of the block after splitting
-    bool inserted = false;
-    while ( min_size <= new_size )
-    {
-        current_size = curr_block->size;
-        new_size = (current_size - sizeof(MallocMetaData))/2;
-        if ( (current_size + sizeof(MallocMetaData)) > MIN_BUDDY_BLOCK && new_size >= min_size)
-        {
-            curr_block->size = new_size;
-            /*potential errors:
-                added sizeof(MallocMetaData)
-            */
-            new_block = (MallocMetaData*)((char*)curr_block + new_size + sizeof(MallocMetaData) );
-            new_block->cookies = curr_block->cookies;
-            new_block->size = new_size;
-            new_block->is_free = true;
-            new_block->addr = (void*)((char*)new_block + sizeof(MallocMetaData));
-            int index_old = getOrderFromSize( current_size + sizeof(MallocMetaData) );
-            int index_new = getOrderFromSize( new_size + sizeof(MallocMetaData) );
-            // int index_old = getOrderFromSize( current_size );
-            // int index_new = getOrderFromSize( new_size );
-            this->orders_list[index_old].removeBlock(curr_block);
-            this->orders_list[index_new].insert(curr_block);
-            this->orders_list[index_new].insert(new_block);
-            current_size = new_size;
-            inserted = true;
-            this->num_free_blocks += 1; //+2?
-            this->num_free_bytes -= sizeof(MallocMetaData);
-        }
-        else if(!inserted || current_size <= MIN_BUDDY_BLOCK)
-        {
-            // can't split a block with the minimum size.
-            /* potential errors: here!!!*/
-            return curr_block;
-        }
-    }
-    
-    return curr_block;
-}
-
-MallocMetaData* FreeList::mergeBlocks(MallocMetaData* prev, MallocMetaData* curr)
-{   
-    if ( (prev->size + sizeof(MallocMetaData) + curr->size) > DEFAULT_BUDDY_BLOCK )
+    size_t block_size = block->GetSize();
+    if (block_size < size + MallocMetaData::BLOCK_OVERHEAD + MIN_BLOCK_SIZE)
     {
-        return NULL;
+        return;
     }
-    
-    int index_prev = getOrderFromSize(prev->size + sizeof(MallocMetaData));
-    int index_curr = getOrderFromSize(curr->size + sizeof(MallocMetaData));
-    this->orders_list[index_prev].removeBlock(prev);
-    this->orders_list[index_curr].removeBlock(curr);
-    prev->size += (curr->size + sizeof(MallocMetaData));
-    int new_index = getOrderFromSize( prev->size + sizeof(MallocMetaData));
-    this->orders_list[new_index].insert(prev);
-    this->num_free_blocks -= 1;
-    this->num_free_bytes += sizeof(MallocMetaData);
-    return prev;
+    MallocMetaData* rest = (MallocMetaData*)((char*)block->GetPayload() + size);
+    rest->prev_phys = block;
+    rest->size_and_flags = (block_size - size - MallocMetaData::BLOCK_OVERHEAD) | BLOCK_FREE;
+    rest->GetNextPhys()->prev_phys = rest;
+    block->SetSize(size);
+    // a free block's neighbors are never free, the rest doesn't have to be coalesced.
+    this->num_free_blocks++;
+    this->num_free_bytes += rest->GetSize();
+    this->num_allocated_bytes -= rest->GetSize() + MallocMetaData::BLOCK_OVERHEAD;
+    this->InsertFreeBlock(rest);
 }
 
-MallocMetaData* FreeList::findNextBuddy(MallocMetaData* block)
+// merges a free block, not in any list yet, with its free neighbors.
+MallocMetaData* Tlsf::CoalesceBlock(MallocMetaData* block)
 {
-    if(!block)
+    MallocMetaData* next = block->GetNextPhys();
+    if (next->IsFree())
     {
-        return NULL;
+        this->RemoveFreeBlock(next);
+        block->SetSize(block->GetSize() + MallocMetaData::BLOCK_OVERHEAD + next->GetSize());
+        block->GetNextPhys()->prev_phys = block;
+        this->num_free_blocks--;
+        this->num_free_bytes += MallocMetaData::BLOCK_OVERHEAD;
     }
-    for (int i = 0; i < (MAX_ORDER + 1); i++)
+    MallocMetaData* prev = block->prev_phys;
+    if (prev != NULL && prev->IsFree())
     {
-        for (MallocMetaData* curr = this->orders_list[i].head->next; curr != this->orders_list[i].tail; curr = curr->next)
-        {
-            MallocMetaData* end_of_block = (MallocMetaData*)((char*)block + sizeof(MallocMetaData) + block->size );
-            if ( ( end_of_block == curr ) && curr->is_free )
-            {
-                return curr;
-            }  
-        }
+        this->RemoveFreeBlock(prev);
+        prev->SetSize(prev->GetSize() + MallocMetaData::BLOCK_OVERHEAD + block->GetSize());
+        prev->GetNextPhys()->prev_phys = prev;
+        this->num_free_blocks--;
+        this->num_free_bytes += MallocMetaData::BLOCK_OVERHEAD;
+        block = prev;
     }
-    return NULL;
+    return block;
 }
 
-MallocMetaData* FreeList::findPreviousBuddy(MallocMetaData* block)
+// adds a free block that SearchBlock(size) finds, at the end of the last area if nothing moved the break since.
+// an area ends with a sentinel, a used empty block, so every block has a next one.
+bool Tlsf::GrowHeap(size_t size)
 {
-    for (int i = 0; i < (MAX_ORDER + 1); i++)
+    size_t payload = AlignUp(RoundUpSearchSize(size));
+    payload = (payload + MallocMetaData::BLOCK_OVERHEAD < HEAP_GROW_SIZE) ?
+        HEAP_GROW_SIZE - MallocMetaData::BLOCK_OVERHEAD : payload;
+    void* program_break = sbrk(0);
+    MallocMetaData* block;
+    if (this->area_end != NULL && (char*)this->area_end + MallocMetaData::BLOCK_OVERHEAD == program_break)
     {
-        for (MallocMetaData* curr = this->orders_list[i].head->next; curr != this->orders_list[i].tail; curr = curr->next)
+        // the old sentinel becomes the new block's header.
+        if (sbrk(payload + MallocMetaData::BLOCK_OVERHEAD) == (void*)(-1))
         {
-            MallocMetaData* end_of_curr = (MallocMetaData*)((char*)curr + sizeof(MallocMetaData) + curr->size);
-            if ( ( end_of_curr == block ) && curr->is_free )
-            {
-                return curr;
-            }  
+            return false;
         }
+        block = this->area_end;
     }
-    return NULL;
-}
-
-void FreeList::insertToFreeList(MallocMetaData* block)
-{
-    block->next = this->tail;
-    block->prev = this->tail->prev;
-    this->tail->prev = block;
-    this->tail->prev->next = block;
-    SortMallocMetaDataList(this->head, this->tail);
-}
-
-void FreeList::deleteFromFreeList(MallocMetaData* block)
-{
-    for ( MallocMetaData* curr = this->head->next; curr != this->tail; curr = curr->next)
+    else
     {
-        if ( curr == block)
+        size_t padding = (ALIGN_SIZE - (uintptr_t)program_break % ALIGN_SIZE) % ALIGN_SIZE;
+        if (sbrk(padding + payload + 2 * MallocMetaData::BLOCK_OVERHEAD) == (void*)(-1))
         {
-            (curr->prev)->next = curr->next;
-            (curr->next)->prev = curr->prev;
+            return false;
         }
-        
+        block = (MallocMetaData*)((char*)program_break + padding);
+        block->prev_phys = NULL;
     }
-    
+    block->size_and_flags = payload | BLOCK_FREE;
+    MallocMetaData* sentinel = block->GetNextPhys();
+    sentinel->prev_phys = block;
+    sentinel->size_and_flags = 0;
+    this->area_end = sentinel;
+    this->num_free_blocks++;
+    this->num_free_bytes += block->GetSize();
+    this->InsertFreeBlock(this->CoalesceBlock(block));
+    return true;
 }
 
-void* FreeList::addMapping(size_t size)
-{
-    void* allocation;
-    int case_num = 0;
-    if ( ( allocated_by_scalloc || (alloc_src_in_srealloc == 1) ) && (size >= 2*MB) )
-    {
-        case_num = 1;
-    }
-    else if ( ( allocated_by_smalloc || (alloc_src_in_srealloc == 2) ) && (size >= 4*MB) )
-    {
-        case_num = 2;
-    }
-    allocated_by_scalloc = false;
-    allocated_by_smalloc = false;
-    alloc_src_in_srealloc = 0;
-    switch (case_num)
-    {
-    case 1:
-        allocation = mmap(NULL, (size + sizeof(MallocMetaData)), (PROT_EXEC | PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB), -1, 0); // correct flags / prot?
-        ((MallocMetaData*)allocation)->allocation_src = 1;
-        break;
+static Tlsf tlsf = Tlsf();
 
-    case 2:
-        allocation = mmap(NULL, (size + sizeof(MallocMetaData)), (PROT_EXEC | PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB), -1, 0); // correct flags / prot?
-        ((MallocMetaData*)allocation)->allocation_src = 2;
-        break;    
-    
-    default:
-        allocation = mmap(NULL, (size + sizeof(MallocMetaData)), (PROT_EXEC | PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0); // correct flags / prot?
-        break;
-    }
+static void* AllocateMapping(size_t size)
+{
+    void* allocation = mmap(NULL, size + MallocMetaData::BLOCK_OVERHEAD, (PROT_READ | PROT_WRITE),
+                            (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
     if (allocation == MAP_FAILED)
     {
         return NULL;
     }
-    
-    MallocMetaData* data = (MallocMetaData*)allocation;
-    data->addr = (void*)((char*)allocation + sizeof(MallocMetaData));
-    data->is_free = false;
-    data->size = size;
-    data->cookies = this->cookies;
-    this->insertToFreeList(data);
-
-    // this->num_allocated_bytes += (size + sizeof(MallocMetaData));
-    this->num_allocated_bytes += (size);
-    this->num_allocated_blocks += 1;
-    
-    return data->addr;
+    MallocMetaData* block = (MallocMetaData*)allocation;
+    block->prev_phys = NULL;
+    block->size_and_flags = size | BLOCK_MAPPED;
+    tlsf.num_allocated_blocks++;
+    tlsf.num_allocated_bytes += size;
+    return block->GetPayload();
 }
 
-void* FreeList::allocateBlock(size_t size)
+#ifdef MALLOC_HUGE_ALLOCATIONS
+// above MAX_SIZE a block is mapped on its own (see huge_alloc.h). It's marked as mapped too, but the counters
+// of the mappings don't see it.
+static void* AllocateHuge(size_t size)
 {
-    MallocMetaData* found = this->findBlock(size);
-    if (!found)
+    if (size > HUGE_ALLOC_MAX_SIZE)
     {
-        // shouldn't allocate more, try looking for a block that's empty and merge it with its buddy.
-        return NULL;
+        return NULL; // before AlignUp() wraps it around
     }
-    else
+    size = AlignUp(size);
+    MallocMetaData* block = (MallocMetaData*)hugeMap(size, MallocMetaData::BLOCK_OVERHEAD);
+    if (block == NULL)
     {
-        if (found->cookies != this->cookies)
-        {
-            // there was an overflow that corrupted our data.
-            exit(0xdeadbeef);
-        }
-
-        // if ( (found->size) > (2*size) ) /* potential errors: maybe wrong condition*/
-        if ( (found->size - sizeof(MallocMetaData)) > 2*size )
-        {
-            MallocMetaData* split_block = this->splitBlock(found, size);
-            /* potential errors*/
-            // things to consider: when splitting the blocks I should change the number of free_bytes, block...
-            // potential errors: numerical calculations with size, etc.
-            split_block->is_free = false;
-            this->num_free_blocks -= 1;
-            this->num_allocated_blocks += 1;
-            this->num_free_bytes -= (split_block->size);
-            this->num_allocated_bytes += (split_block->size);
-            return split_block->addr;
-        }
-        else
-        {
-            found->is_free = false;
-            this->num_allocated_blocks += 1;
-            this->num_allocated_bytes += found->size;
-            this->num_free_blocks -= 1;
-            this->num_free_bytes -= found->size;
-            return found->addr;
-        }
+        return NULL;
     }
-    return NULL;
+    block->prev_phys = NULL;
+    block->size_and_flags = size | BLOCK_MAPPED;
+    return block->GetPayload();
 }
 
-void FreeList::removeMapping(MallocMetaData* block)
+static bool IsHugeBlock(MallocMetaData* block)
 {
-    for (MallocMetaData* curr = this->head->next; curr != this->tail; curr = curr->next)
-    {
-        if (block == curr)
-        {
-            curr->prev->next = curr->next;
-            curr->next->prev = curr->prev;
-        }
-    }   
+    return block->GetSize() > MAX_SIZE;
 }
+#endif
 
-bool FreeList::isBlockContainable(MallocMetaData* block, size_t required_size)
+void *smalloc(size_t size)
 {
-    MallocMetaData* next_buddy = this->findNextBuddy(block);
-    MallocMetaData* prev_buddy = this->findPreviousBuddy(block);
-    size_t accumulated_size = block->size;
-    while ( required_size > accumulated_size )
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    if (size > MAX_SIZE)
     {
-        if ( next_buddy && prev_buddy && (prev_buddy->size <= next_buddy->size) )
-        {
-            accumulated_size += (prev_buddy->size);
-            prev_buddy = this->findPreviousBuddy(prev_buddy);
-        }
-        else if ( next_buddy && prev_buddy && ( prev_buddy->size > next_buddy->size ) )
-        {
-            accumulated_size += (next_buddy->size);
-            next_buddy = this->findNextBuddy(next_buddy);
-        }
-        else if ( next_buddy && (!prev_buddy) )
-        {
-            accumulated_size += (next_buddy->size);
-            next_buddy = this->findNextBuddy(next_buddy);
-        }
-        else if ( (!next_buddy) && prev_buddy )
-        {
-            accumulated_size += (prev_buddy->size);
-            prev_buddy = this->findPreviousBuddy(prev_buddy);
-        }
+        return AllocateHuge(size);
     }
-    return (accumulated_size >= required_size);
-}
-
-// the following elements are allocated on the stack!
-static MallocMetaData head_datas[BUDDY_BLOCKS_NUM+1];
-static MallocMetaData tail_datas[BUDDY_BLOCKS_NUM+1];
-static MallocMetaData list_head_node = MallocMetaData();
-static MallocMetaData mmap_head_node = MallocMetaData();
-static MallocMetaData list_tail_node = MallocMetaData();
-static MallocMetaData mmap_tail_node = MallocMetaData();
-static FreeList free_list = FreeList(&list_head_node, &list_tail_node, head_datas, tail_datas);
-static FreeList mmap_free_list = FreeList(&mmap_head_node, &mmap_tail_node, head_datas, tail_datas);
-static bool buddy_system_init = false;
-
-void *smalloc(size_t size)
-{
-    if (!buddy_system_init)
-    {
-        free_list.initializeBuddySystem(head_datas, tail_datas);
-        buddy_system_init = true;
-    }
-    
-    if (size <= 0 || size > MAX_SIZE)
-    {    
-        /* 
-        potential error:
-            consider checking if size > MAX_SIZE. 
-            is it a case for mmap or is it an error?
-        */
+#endif
+    if (size == 0 || size > MAX_SIZE)
+    {
         return NULL;
     }
+    size = AlignUp(size);
     if (size >= MY_MMAP_THRESHOLD)
     {
-        /*
-        potential errors:
-            should we check if (datap->size > MY_MMAP_THRESHOLD) or (datap->size >= MY_MMAP_THRESHOLD)?
-        */
-        allocated_by_smalloc = true;
-        return mmap_free_list.addMapping(size);
+        return AllocateMapping(size);
     }
-    else
+    size = (size < MIN_BLOCK_SIZE) ? MIN_BLOCK_SIZE : size;
+    MallocMetaData* block = tlsf.SearchBlock(size);
+    if (block == NULL)
     {
-        return free_list.allocateBlock(size);
+        if (!tlsf.GrowHeap(size))
+        {
+            return NULL;
+        }
+        block = tlsf.SearchBlock(size);
     }
-    return NULL;
+    tlsf.RemoveFreeBlock(block);
+    block->SetFree(false);
+    tlsf.num_free_blocks--;
+    tlsf.num_free_bytes -= block->GetSize();
+    tlsf.num_allocated_blocks++;
+    tlsf.num_allocated_bytes += block->GetSize();
+    tlsf.SplitBlock(block, size);
+    return block->GetPayload();
 }
 
 void *scalloc(size_t num, size_t size)
 {
-    if (num <= 0 || size <= 0 || (size*num) > MAX_SIZE)
+    size_t total;
+    // smalloc() turns down what's too large.
+    if (num == 0 || size == 0 || __builtin_mul_overflow(num, size, &total))
     {
-        /* 
-        potential error:
-            consider not checking if num*size > MAX_SIZE. 
-            is it a case for mmap or is it an error?
-        */
         return NULL;
     }
-    allocated_by_scalloc = true;
-    void* allocation = smalloc(num*size);
-    if(allocation == NULL)
+    void* allocation = smalloc(total);
+    if (allocation == NULL)
     {
         return NULL;
     }
-    memset(allocation, 0, num*size);
+    // a fresh mapping is already zeroed.
+    if (!MallocMetaData::FromPayload(allocation)->IsMapped())
+    {
+        bulkMemset(allocation, 0, total);
+    }
     return allocation;
 }
 
@@ -726,289 +403,152 @@ void sfree(void* p)
     {
         return;
     }
-    MallocMetaData *datap = (MallocMetaData*)((char*)p - sizeof(MallocMetaData));
-    MallocMetaData* merged = datap;
-    if (datap->cookies != free_list.cookies || datap->cookies != mmap_free_list.cookies)
+    MallocMetaData* block = MallocMetaData::FromPayload(p);
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    if (IsHugeBlock(block))
     {
-        // an overflow occured and someone used our data.
-        exit(0xdeadbeef);
+        hugeUnmap(block, block->GetSize(), MallocMetaData::BLOCK_OVERHEAD);
+        return;
     }
-    if (datap->is_free)
+#endif
+    if (block->IsFree())
     {
-        return; // block is already free!
+        return;
     }
-    
-    if (datap->size >= MY_MMAP_THRESHOLD)
+    tlsf.num_allocated_blocks--;
+    tlsf.num_allocated_bytes -= block->GetSize();
+    if (block->IsMapped())
     {
-        /*
-        potential errors:
-            should we check if (datap->size > MY_MMAP_THRESHOLD) or (datap->size >= MY_MMAP_THRESHOLD)?
-            according to the notes in section 3, we shouldn't consider munmapped areas as freed
-        */
-        mmap_free_list.num_allocated_blocks -= 1;
-        mmap_free_list.num_allocated_bytes -= datap->size;
-        datap->is_free = true;
-        MallocMetaData* found = mmap_free_list.findBlock(datap->size);
-        if (found)
-        {
-            mmap_free_list.removeMapping(datap);
-        }
-        munmap(datap, datap->size + sizeof(MallocMetaData));
-        // wasnt very clear on what we should do with unmapped blocks, check it.
+        munmap(block, block->GetSize() + MallocMetaData::BLOCK_OVERHEAD);
+        return;
     }
-    else
-    {
-        merged->is_free = true;
-        free_list.num_free_blocks += 1;
-        free_list.num_free_bytes += merged->size;
-        free_list.num_allocated_blocks -= 1;
-        free_list.num_allocated_bytes -= merged->size;
+    block->SetFree(true);
+    tlsf.num_free_blocks++;
+    tlsf.num_free_bytes += block->GetSize();
+    tlsf.InsertFreeBlock(tlsf.CoalesceBlock(block));
+}
 
-        MallocMetaData *datap_prev = free_list.findPreviousBuddy(merged);
-        MallocMetaData *datap_next = free_list.findNextBuddy(merged);
-        while ( (datap_next || datap_prev) && (merged))
+#ifdef MALLOC_HUGE_ALLOCATIONS
+// a huge block to or from any size, or a heap block to a huge size.
+static void* ReallocateHuge(MallocMetaData* block, size_t size)
+{
+    if (IsHugeBlock(block) && size > MAX_SIZE)
+    {
+        if (size > HUGE_ALLOC_MAX_SIZE)
         {
-            if (datap->cookies != free_list.cookies ||
-            (datap_prev != NULL && datap_prev->cookies != free_list.cookies) ||
-            (datap_next != NULL && datap_next->cookies != free_list.cookies))
-            {
-                // an overflow occured and someone used our data.
-                exit(0xdeadbeef);
-            }
-            if (datap_prev != NULL)
-            {
-                merged = free_list.mergeBlocks(datap_prev, merged);
-                if (datap_next != NULL)
-                {
-                    merged = free_list.mergeBlocks(merged, datap_next);
-                }
-            }
-            else
-            {
-                if (datap_next != NULL)
-                {
-                    merged = free_list.mergeBlocks(merged, datap_next);
-                }
-            }
-            datap_prev = free_list.findPreviousBuddy(merged);
-            datap_next = free_list.findNextBuddy(merged);
+            return NULL;
         }
+        size = AlignUp(size);
+        MallocMetaData* moved = (MallocMetaData*)hugeRemap(block, block->GetSize(), size, MallocMetaData::BLOCK_OVERHEAD);
+        if (moved == NULL)
+        {
+            return NULL;
+        }
+        moved->SetSize(size);
+        return moved->GetPayload();
     }
-}
-
-void* srealloc(void* oldp, size_t size)
-{
-    if (size <= 0 || size > MAX_SIZE)
+    void* allocation = smalloc(size);
+    if (allocation == NULL)
     {
         return NULL;
     }
+    bulkMemmove(allocation, block->GetPayload(), (block->GetSize() < size) ? block->GetSize() : size);
+    sfree(block->GetPayload());
+    return allocation;
+}
+#endif
 
-    if(oldp == NULL)
+void* srealloc(void* oldp, size_t size)
+{
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    if (size > MAX_SIZE || (oldp != NULL && IsHugeBlock(MallocMetaData::FromPayload(oldp))))
     {
-        return smalloc(size);
+        return (oldp == NULL) ? smalloc(size) : ReallocateHuge(MallocMetaData::FromPayload(oldp), size);
     }
-    MallocMetaData *datap = (MallocMetaData*)((char*)oldp - sizeof(MallocMetaData));
-    bool merged_blocks = false;
-    if (datap->cookies != free_list.cookies || datap->cookies != mmap_free_list.cookies)
+#endif
+    if (size == 0 || size > MAX_SIZE)
     {
-        exit(0xdeadbeef);
+        return NULL;
     }
-    void* newp = NULL;
-    if (size >= 128*KB)
+    if (oldp == NULL)
     {
-        /*
-        potential errors:
-            should we check if (datap->size > MY_MMAP_THRESHOLD) or (datap->size >= MY_MMAP_THRESHOLD)?
-        */
-        if (datap->size == size)
-        {
-            return oldp;
-        }
-        else
-        {
-            alloc_src_in_srealloc = datap->allocation_src;
-            newp = smalloc(size); // which will use mmap() in this case.
-            mmap_free_list.deleteFromFreeList(datap);
-            mmap_free_list.insertToFreeList((MallocMetaData*)newp);
-        }
+        return smalloc(size);
     }
-    else
+    MallocMetaData* block = MallocMetaData::FromPayload(oldp);
+    size_t old_size = block->GetSize();
+    if (size <= old_size)
     {
-        MallocMetaData *datap_prev = free_list.findPreviousBuddy(datap);
-        MallocMetaData *datap_next = free_list.findNextBuddy(datap);
-        bool managed_to_contain = free_list.isBlockContainable(datap, size);
-        MallocMetaData* merged = datap;
-
-        if (datap->cookies != free_list.cookies ||
-            (datap_prev != NULL && datap_prev->cookies != free_list.cookies) ||
-            (datap_next != NULL && datap_next->cookies != free_list.cookies))
-        {
-            // an overflow occured and someone used our data.
-            exit(0xdeadbeef);
-        }
-        
-        if (managed_to_contain)
-        {
-            while ( merged && (merged->size < size) )
-            {
-                if ( datap_next && datap_prev && (datap_prev->size <= datap_next->size) )
-                {
-                    free_list.num_allocated_bytes -= merged->size;
-                    free_list.num_free_bytes -= merged->size;
-                    merged = free_list.mergeBlocks(datap_prev, merged);
-                    merged->is_free = false;
-                    free_list.num_free_bytes -= (sizeof(MallocMetaData));
-                    free_list.num_allocated_bytes += merged->size;
-                    merged_blocks = true;
-                }
-                else if ( datap_next && datap_prev && ( datap_prev->size > datap_next->size ) )
-                {
-                    free_list.num_allocated_bytes -= merged->size;
-                    free_list.num_free_bytes -= merged->size;
-                    merged = free_list.mergeBlocks(merged, datap_next);
-                    merged->is_free = false;
-                    free_list.num_free_bytes -= (sizeof(MallocMetaData));
-                    free_list.num_allocated_bytes += merged->size;
-                    merged_blocks = true;
-                }
-                else if ( datap_next && (!datap_prev) )
-                {
-                    free_list.num_allocated_bytes -= merged->size;
-                    free_list.num_free_bytes -= merged->size;
-                    merged = free_list.mergeBlocks(merged, datap_next);
-                    merged->is_free = false;
-                    free_list.num_free_bytes -= (sizeof(MallocMetaData));
-                    free_list.num_allocated_bytes += (merged->size);
-                    merged_blocks = true;
-                }
-                else if ( (!datap_next) && datap_prev )
-                {
-                    free_list.num_allocated_bytes -= merged->size;
-                    free_list.num_free_bytes -= merged->size;
-                    merged = free_list.mergeBlocks(datap_prev, merged);
-                    merged->is_free = false;
-                    free_list.num_free_bytes -= (sizeof(MallocMetaData));
-                    free_list.num_allocated_bytes += (merged->size);
-                    merged_blocks = true;
-                } 
-                datap_prev = free_list.findPreviousBuddy(merged);
-                datap_next = free_list.findNextBuddy(merged);
-            }   
-        }
-        else
-        {
-            merged = free_list.findBlock(size);
-            managed_to_contain = true;
-        }
-        newp = merged->addr;
+        return oldp;
     }
-
-    if(!newp)
+    MallocMetaData* next = block->IsMapped() ? NULL : block->GetNextPhys();
+    size_t aligned_size = AlignUp(size);
+    if (next != NULL && next->IsFree() && old_size + MallocMetaData::BLOCK_OVERHEAD + next->GetSize() >= aligned_size)
     {
-        return NULL;
+        // the free block right after is enough, the block grows into it.
+        tlsf.RemoveFreeBlock(next);
+        tlsf.num_free_blocks--;
+        tlsf.num_free_bytes -= next->GetSize();
+        block->SetSize(old_size + MallocMetaData::BLOCK_OVERHEAD + next->GetSize());
+        block->GetNextPhys()->prev_phys = block;
+        tlsf.num_allocated_bytes += MallocMetaData::BLOCK_OVERHEAD + next->GetSize();
+        tlsf.SplitBlock(block, aligned_size);
+        return oldp;
     }
-    if(memmove(newp, oldp, datap->size) != newp) 
+    void* allocation = smalloc(size);
+    if (allocation == NULL)
     {
         return NULL;
     }
-    if ( (!merged_blocks) && (newp != oldp) )
-    {
-        sfree(oldp);
-    }
-    return newp;
+    bulkMemmove(allocation, oldp, old_size);
+    sfree(oldp);
+    return allocation;
 }
 
 size_t _num_free_blocks()
 {
-    return free_list.num_free_blocks + mmap_free_list.num_free_blocks;
+    return tlsf.num_free_blocks;
 }
 
 size_t _num_free_bytes()
 {
-    return free_list.num_free_bytes + mmap_free_list.num_free_bytes;
+    return tlsf.num_free_bytes;
 }
 
 size_t _num_allocated_blocks()
 {
-    return (free_list.num_allocated_blocks + free_list.num_free_blocks
-            + mmap_free_list.num_allocated_blocks + mmap_free_list.num_free_blocks); // look at function 7
+    return tlsf.num_allocated_blocks + tlsf.num_free_blocks;
 }
 
 size_t _num_allocated_bytes()
 {
-    return (free_list.num_allocated_bytes + free_list.num_free_bytes
-            + mmap_free_list.num_allocated_bytes + mmap_free_list.num_free_bytes);
+    return tlsf.num_allocated_bytes + tlsf.num_free_bytes;
 }
 
-// size_t _num_free_blocks()
-// {
-// return free_list.num_free_blocks + mmap_free_list.num_free_blocks;
-// }
-
-// size_t _num_free_bytes()
-// {
-// return free_list.num_free_bytes + mmap_free_list.num_free_bytes;
-// }
-
-// size_t _num_allocated_blocks()
-// {
-// return (free_list.num_allocated_blocks + mmap_free_list.num_allocated_blocks ); // look at function 7
-// }
-
-// size_t _num_allocated_bytes()
-// {
-// return (free_list.num_allocated_bytes + mmap_free_list.num_allocated_bytes );
-// }
-
 size_t _size_meta_data()
 {
-    return (sizeof(MallocMetaData));
+    return MallocMetaData::BLOCK_OVERHEAD;
 }
 
 size_t _num_meta_data_bytes()
 {
-    return (_size_meta_data() * _num_allocated_blocks());
+    return _size_meta_data() * _num_allocated_blocks();
 }
 
-void DEBUG_PrintList()
+// huge allocations (-DMALLOC_HUGE_ALLOCATIONS) aren't counted by the functions above.
+size_t _num_huge_allocations()
 {
-    int freed = 0;
-    int allocated = 0;
-    for (int i = 0; i < (MAX_ORDER+1); i++)
-    {
-        int i_freed = 0;
-        int i_allocated = 0;
-
-        MallocMetaData *p = free_list.orders_list[i].head->next;
-        printf("\nPrinting list with free:\n(size, addr)\n");
-        printf("HEAD <--> ");
-        for (; p != free_list.orders_list[i].tail; p = p->next)
-        {
-            if(p->is_free)
-            {
-                printf("(%ld, %p) <--> ", p->size, p->addr);
-                freed++;
-                i_freed++;
-            }
-        }
-        printf("TAIL(freed:%d, order:%d)\n",i_freed,i);
-        printf("--------------------------------------------------------------------------\n");
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    return huge_alloc_stats.num_blocks;
+#else
+    return 0;
+#endif
+}
 
-        p = free_list.orders_list[i].head->next;
-        printf("\nPrinting list with allocated:\n(size, addr)\n");
-        printf("HEAD <--> ");
-        for (; p != free_list.orders_list[i].tail; p = p->next)
-        {
-            if(!p->is_free)
-            {
-                printf("(%ld, %p) <--> ", p->size, p->addr);
-                allocated++;
-                i_allocated++;
-            }       
-        }
-        printf("TAIL(allocated:%d, order:%d)\n",i_allocated,i);
-        printf("--------------------------------------------------------------------------\n");
-    }
-        printf("Total Free: %d, Total allocated: %d\n", freed, allocated);
-        printf("===========================================================================\n");
-}
\ No newline at end of file
+size_t _num_huge_allocation_bytes()
+{
+#ifdef MALLOC_HUGE_ALLOCATIONS
+    return huge_alloc_stats.num_bytes;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,192 @@
+#ifndef MEM_KERNELS_H
+#define MEM_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MEM_KERNELS_X86
+#endif
+
+/*
+Bulk clear/copy used by scalloc and srealloc.
+Below NON_TEMPORAL_THRESHOLD libc's memset/memmove are used as is. Above it the data is written with
+streaming (non-temporal) stores that bypass the caches, so clearing or moving a multi-MB block doesn't
+evict the caller's working set. The AVX2 or SSE2 kernel is picked once at runtime from CPUID.
+*/
+#define NON_TEMPORAL_THRESHOLD (1024*1024)
+
+typedef void (*MemsetKernel)(void* dst, int c, size_t n);
+typedef void (*MemmoveKernel)(void* dst, const void* src, size_t n);
+
+#ifdef MEM_KERNELS_X86
+
+__attribute__((target("avx2")))
+static inline void memsetAVX2(void* dst, int c, size_t n)
+{
+    char* d = (char*)dst;
+    size_t head = (32 - ((uintptr_t)d % 32)) % 32;
+    memset(d, c, head);
+    d += head;
+    n -= head;
+    __m256i value = _mm256_set1_epi8((char)c);
+    for (; n >= 128; n -= 128, d += 128)
+    {
+        _mm256_stream_si256((__m256i*)(d), value);
+        _mm256_stream_si256((__m256i*)(d + 32), value);
+        _mm256_stream_si256((__m256i*)(d + 64), value);
+        _mm256_stream_si256((__m256i*)(d + 96), value);
+    }
+    _mm_sfence();
+    memset(d, c, n);
+}
+
+// copies front to back, so it's also correct for overlapping areas when dst < src.
+__attribute__((target("avx2")))
+static inline void memmoveAVX2(void* dst, const void* src, size_t n)
+{
+    char* d = (char*)dst;
+    const char* s = (const char*)src;
+    size_t head = (32 - ((uintptr_t)d % 32)) % 32;
+    memmove(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 128; n -= 128, d += 128, s += 128)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(s));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s + 32));
+        __m256i e = _mm256_loadu_si256((const __m256i*)(s + 64));
+        __m256i f = _mm256_loadu_si256((const __m256i*)(s + 96));
+        _mm256_stream_si256((__m256i*)(d), a);
+        _mm256_stream_si256((__m256i*)(d + 32), b);
+        _mm256_stream_si256((__m256i*)(d + 64), e);
+        _mm256_stream_si256((__m256i*)(d + 96), f);
+    }
+    _mm_sfence();
+    memmove(d, s, n);
+}
+
+__attribute__((target("sse2")))
+static inline void memsetSSE2(void* dst, int c, size_t n)
+{
+    char* d = (char*)dst;
+    size_t head = (16 - ((uintptr_t)d % 16)) % 16;
+    memset(d, c, head);
+    d += head;
+    n -= head;
+    __m128i value = _mm_set1_epi8((char)c);
+    for (; n >= 64; n -= 64, d += 64)
+    {
+        _mm_stream_si128((__m128i*)(d), value);
+        _mm_stream_si128((__m128i*)(d + 16), value);
+        _mm_stream_si128((__m128i*)(d + 32), value);
+        _mm_stream_si128((__m128i*)(d + 48), value);
+    }
+    _mm_sfence();
+    memset(d, c, n);
+}
+
+__attribute__((target("sse2")))
+static inline void memmoveSSE2(void* dst, const void* src, size_t n)
+{
+    char* d = (char*)dst;
+    const char* s = (const char*)src;
+    size_t head = (16 - ((uintptr_t)d % 16)) % 16;
+    memmove(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 64; n -= 64, d += 64, s += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(s));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i e = _mm_loadu_si128((const __m128i*)(s + 32));
+        __m128i f = _mm_loadu_si128((const __m128i*)(s + 48));
+        _mm_stream_si128((__m128i*)(d), a);
+        _mm_stream_si128((__m128i*)(d + 16), b);
+        _mm_stream_si128((__m128i*)(d + 32), e);
+        _mm_stream_si128((__m128i*)(d + 48), f);
+    }
+    _mm_sfence();
+    memmove(d, s, n);
+}
+
+#endif /* MEM_KERNELS_X86 */
+
+static inline void memsetLibc(void* dst, int c, size_t n)
+{
+    memset(dst, c, n);
+}
+
+static inline void memmoveLibc(void* dst, const void* src, size_t n)
+{
+    memmove(dst, src, n);
+}
+
+static inline MemsetKernel getMemsetKernel()
+{
+    static MemsetKernel kernel = NULL;
+    if (kernel == NULL)
+    {
+        kernel = memsetLibc;
+#ifdef MEM_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            kernel = memsetAVX2;
+        }
+        else if (__builtin_cpu_supports("sse2"))
+        {
+            kernel = memsetSSE2;
+        }
+#endif
+    }
+    return kernel;
+}
+
+static inline MemmoveKernel getMemmoveKernel()
+{
+    static MemmoveKernel kernel = NULL;
+    if (kernel == NULL)
+    {
+        kernel = memmoveLibc;
+#ifdef MEM_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            kernel = memmoveAVX2;
+        }
+        else if (__builtin_cpu_supports("sse2"))
+        {
+            kernel = memmoveSSE2;
+        }
+#endif
+    }
+    return kernel;
+}
+
+static inline void bulkMemset(void* dst, int c, size_t n)
+{
+    if (n < NON_TEMPORAL_THRESHOLD)
+    {
+        memset(dst, c, n);
+        return;
+    }
+    getMemsetKernel()(dst, c, n);
+}
+
+static inline void bulkMemmove(void* dst, const void* src, size_t n)
+{
+    // the streaming kernels copy front to back, a backward overlapping move is left to libc.
+    if (n < NON_TEMPORAL_THRESHOLD || ((char*)dst > (const char*)src && (char*)dst < (const char*)src + n))
+    {
+        memmove(dst, src, n);
+        return;
+    }
+    getMemmoveKernel()(dst, src, n);
+}
+
+#endif /* MEM_KERNELS_H */
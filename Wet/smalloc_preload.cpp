@@ -0,0 +1,346 @@
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <new>
+#include "malloc_3.h"
+
+/*
+The malloc_3 engine under the standard allocation names, built as libsmalloc.so:
+    LD_PRELOAD=libsmalloc.so <program>
+The engine is constant-initialized, so calls that come before any constructor has run (from libc, ld.so or
+libstdc++ while they start up) are served like any other. libc's allocator is never looked up (no dlsym()),
+so dlsym() allocating through us is fine too.
+The engine isn't thread-safe, every call is serialized by one lock. It's recursive because the heap profiler's
+backtrace() may allocate.
+The engine is built with MALLOC_GROWABLE_HEAP: once the buddy region is full it grows by 4MB at the program
+break, small objects never get a mapping of their own. It's built with MALLOC_HUGE_ALLOCATIONS too: requests
+above MAX_SIZE (1e8) are mapped on their own and grown with mremap() (see huge_alloc.h), up to 1TB.
+It's a way to run real programs against malloc_3, not an allocator for production use:
+    - every request waits on the one lock, threads don't scale.
+    - a small request takes a whole power of two block, up to half of it is wasted.
+    - the region only grows while it ends at the program break, past that small requests fail (ENOMEM).
+    - nothing is given back to the system, the region never shrinks.
+    - every request of 128KB or more is a mapping of its own, vm.max_map_count caps how many can be live.
+*/
+
+void* smalloc(size_t size);
+void* scalloc(size_t num, size_t size);
+void sfree(void* p);
+void* srealloc(void* oldp, size_t size);
+
+static pthread_mutex_t allocator_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+class AllocatorLock
+{
+public:
+    AllocatorLock()
+    {
+        pthread_mutex_lock(&allocator_mutex);
+    }
+    ~AllocatorLock()
+    {
+        pthread_mutex_unlock(&allocator_mutex);
+    }
+};
+
+// a fork() while another thread holds the lock would leave it locked forever in the child.
+static void lockBeforeFork()
+{
+    pthread_mutex_lock(&allocator_mutex);
+}
+
+static void unlockAfterFork()
+{
+    pthread_mutex_unlock(&allocator_mutex);
+}
+
+static void resetAfterFork()
+{
+    // the owner is a thread of the parent, the child starts over with a fresh lock.
+    pthread_mutex_t unlocked = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+    allocator_mutex = unlocked;
+}
+
+__attribute__((constructor))
+static void registerForkHandlers()
+{
+    pthread_atfork(lockBeforeFork, unlockAfterFork, resetAfterFork);
+}
+
+static void* allocate(size_t size)
+{
+    size = (size == 0) ? 1 : size; // malloc(0) is a unique pointer.
+    AllocatorLock lock;
+    void* p = smalloc(size);
+    if (p == NULL)
+    {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+static void* allocateAligned(size_t alignment, size_t size)
+{
+    size = (size == 0) ? 1 : size;
+    AllocatorLock lock;
+    return smemalign(alignment, size);
+}
+
+static bool isPowerOfTwo(size_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+extern "C" {
+
+void* malloc(size_t size)
+{
+    return allocate(size);
+}
+
+void* calloc(size_t num, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(num, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (total == 0)
+    {
+        return allocate(1);
+    }
+    AllocatorLock lock;
+    void* p = scalloc(1, total);
+    if (p == NULL)
+    {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+void free(void* p)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+    AllocatorLock lock;
+    sfree(p);
+}
+
+void* realloc(void* p, size_t size)
+{
+    if (p == NULL)
+    {
+        return allocate(size);
+    }
+    if (size == 0)
+    {
+        free(p);
+        return NULL;
+    }
+    AllocatorLock lock;
+    void* newp = srealloc(p, size);
+    if (newp == NULL)
+    {
+        errno = ENOMEM;
+    }
+    return newp;
+}
+
+void* reallocarray(void* p, size_t num, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(num, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(p, total);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    if (!isPowerOfTwo(alignment) || (alignment % sizeof(void*)) != 0)
+    {
+        return EINVAL;
+    }
+    void* p = allocateAligned(alignment, size);
+    if (p == NULL)
+    {
+        return ENOMEM;
+    }
+    *memptr = p;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    if (!isPowerOfTwo(alignment))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    void* p = allocateAligned(alignment, size);
+    if (p == NULL)
+    {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    return aligned_alloc(alignment, size);
+}
+
+void* valloc(size_t size)
+{
+    return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+void* pvalloc(size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return aligned_alloc(page_size, (size + page_size - 1) & ~(page_size - 1));
+}
+
+size_t malloc_usable_size(void* p)
+{
+    AllocatorLock lock;
+    return smalloc_usable_size(p);
+}
+
+} // extern "C"
+
+static void* allocateOrThrow(size_t size, size_t alignment)
+{
+    while (true)
+    {
+        void* p = (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) ? allocateAligned(alignment, size) : allocate(size);
+        if (p != NULL)
+        {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == NULL)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+static void* allocateNoThrow(size_t size, size_t alignment)
+{
+    try
+    {
+        return allocateOrThrow(size, alignment);
+    }
+    catch (...)
+    {
+        return NULL;
+    }
+}
+
+void* operator new(size_t size)
+{
+    return allocateOrThrow(size, 0);
+}
+
+void* operator new[](size_t size)
+{
+    return allocateOrThrow(size, 0);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return allocateNoThrow(size, 0);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return allocateNoThrow(size, 0);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return allocateOrThrow(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return allocateOrThrow(size, (size_t)alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return allocateNoThrow(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return allocateNoThrow(size, (size_t)alignment);
+}
+
+// every delete is a free(): the size and the alignment are known from the block itself.
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
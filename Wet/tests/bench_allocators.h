@@ -0,0 +1,128 @@
+#ifndef BENCH_ALLOCATORS_H
+#define BENCH_ALLOCATORS_H
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+/*
+The implementations the benchmarks compare, next to the system malloc.
+malloc_1/2/3(/4) all export the same names, so each one is built as a module (see tests/CMakeLists.txt)
+and loaded with dlopen() into its own namespace. malloc_1 is built twice, one sbrk() per allocation and the bump
+mode, malloc_2 once per fit policy: first fit, best fit and the simd index.
+*/
+
+#ifndef MALLOC_BENCH_MODULE_DIR
+#define MALLOC_BENCH_MODULE_DIR "."
+#endif
+
+struct Allocator
+{
+    std::string name;
+    void* (*malloc_fn)(size_t);
+    void* (*calloc_fn)(size_t, size_t);
+    void (*free_fn)(void*);
+    void* (*realloc_fn)(void*, size_t);
+    bool thread_safe; // the system malloc and malloc_1_bump, the others have to be called under a lock.
+    size_t (*allocated_bytes_fn)(); // the implementation's own counters, NULL if it has none
+    size_t (*meta_data_bytes_fn)();
+};
+
+static inline void benchNoFree(void*)
+{}
+
+static inline Allocator loadAllocator(const std::string& name)
+{
+    Allocator allocator = {name, NULL, NULL, NULL, NULL, false, NULL, NULL};
+    std::string path = std::string(MALLOC_BENCH_MODULE_DIR) + "/libbench_" + name + ".so";
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+    {
+        return allocator;
+    }
+    allocator.malloc_fn = (void* (*)(size_t))dlsym(handle, "_Z7smallocm");
+    allocator.calloc_fn = (void* (*)(size_t, size_t))dlsym(handle, "_Z7scallocmm");
+    allocator.free_fn = (void (*)(void*))dlsym(handle, "_Z5sfreePv");
+    allocator.realloc_fn = (void* (*)(void*, size_t))dlsym(handle, "_Z8sreallocPvm");
+    allocator.allocated_bytes_fn = (size_t (*)())dlsym(handle, "_Z20_num_allocated_bytesv");
+    allocator.meta_data_bytes_fn = (size_t (*)())dlsym(handle, "_Z20_num_meta_data_bytesv");
+    if (allocator.free_fn == NULL)
+    {
+        allocator.free_fn = benchNoFree; // malloc_1 never frees.
+        allocator.thread_safe = (name == "malloc_1_bump"); // its chunks are per thread
+    }
+    return allocator;
+}
+
+static inline std::vector<Allocator>& getAllocators()
+{
+    static std::vector<Allocator> allocators;
+    if (allocators.empty())
+    {
+        allocators.push_back({"system", malloc, calloc, free, realloc, true, NULL, NULL});
+        for (const char* name : {"malloc_1", "malloc_1_bump", "malloc_2", "malloc_2_best_fit", "malloc_2_simd",
+                                 "malloc_3", "malloc_3_page_heap", "malloc_4"})
+        {
+            Allocator allocator = loadAllocator(name);
+            if (allocator.malloc_fn != NULL)
+            {
+                allocators.push_back(allocator);
+            }
+        }
+    }
+    return allocators;
+}
+
+// memory the allocator holds (used, free and metadata), from its own counters or mallinfo2() for the system.
+static inline size_t getFootprint(const Allocator& allocator)
+{
+    if (allocator.allocated_bytes_fn == NULL)
+    {
+        struct mallinfo2 info = mallinfo2();
+        return info.arena + info.hblkhd;
+    }
+    return allocator.allocated_bytes_fn() + (allocator.meta_data_bytes_fn ? allocator.meta_data_bytes_fn() : 0);
+}
+
+// a field of /proc/self/status in kB ("VmRSS:", "VmHWM:"), 0 if it can't be read.
+static inline size_t readStatusKb(const char* key)
+{
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status == NULL)
+    {
+        return 0;
+    }
+    char line[256];
+    size_t value = 0;
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, key, strlen(key)) == 0)
+        {
+            value = strtoul(line + strlen(key), NULL, 10);
+            break;
+        }
+    }
+    fclose(status);
+    return value;
+}
+
+// resets VmHWM to the current RSS (linux >= 4.0), returns false if it couldn't.
+static inline bool resetPeakRss()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool reset = (write(fd, "5", 1) == 1);
+    close(fd);
+    return reset;
+}
+
+#endif /* BENCH_ALLOCATORS_H */
@@ -0,0 +1,93 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <stdint.h>
+#include <string.h>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define HUGE_ALLOCATION_LIMIT ((size_t)1 << 40)
+#define GB ((size_t)1 << 30)
+
+TEST_CASE("Huge allocation", "[huge_alloc]")
+{
+    sfree(smalloc(16)); // malloc_3 sets its heap up on the first allocation
+    size_t blocks = _num_allocated_blocks();
+    size_t bytes = _num_allocated_bytes();
+
+    // only the pages that are touched are committed.
+    char *a = (char *)smalloc(4 * GB);
+    REQUIRE(a != nullptr);
+    a[0] = 'a';
+    a[2 * GB] = 'b';
+    a[4 * GB - 1] = 'c';
+    REQUIRE(_num_huge_allocations() == 1);
+    REQUIRE(_num_huge_allocation_bytes() == 4 * GB);
+    // the heap's counters don't see it.
+    REQUIRE(_num_allocated_blocks() == blocks);
+    REQUIRE(_num_allocated_bytes() == bytes);
+
+    sfree(a);
+    REQUIRE(_num_huge_allocations() == 0);
+    REQUIRE(_num_huge_allocation_bytes() == 0);
+}
+
+TEST_CASE("Size limits", "[huge_alloc]")
+{
+    char *a = (char *)smalloc(MAX_ALLOCATION_SIZE + 1);
+    REQUIRE(a != nullptr);
+    memset(a, 'x', MAX_ALLOCATION_SIZE + 1);
+    sfree(a);
+
+    REQUIRE(smalloc(HUGE_ALLOCATION_LIMIT + 1) == nullptr);
+    REQUIRE(smalloc(SIZE_MAX) == nullptr);
+    REQUIRE(srealloc(nullptr, SIZE_MAX) == nullptr);
+    REQUIRE(_num_huge_allocations() == 0);
+}
+
+TEST_CASE("scalloc", "[huge_alloc]")
+{
+    // the products overflow, they're not taken for what's left of them.
+    REQUIRE(scalloc((size_t)1 << 33, (size_t)1 << 33) == nullptr);
+    REQUIRE(scalloc(SIZE_MAX, 2) == nullptr);
+    REQUIRE(scalloc(((size_t)1 << 32) + 1, (size_t)1 << 32) == nullptr);
+
+    char *a = (char *)scalloc(1024 * 1024, 1024);
+    REQUIRE(a != nullptr);
+    REQUIRE(_num_huge_allocations() == 1);
+    REQUIRE(a[0] == 0);
+    REQUIRE(a[GB / 2] == 0);
+    REQUIRE(a[GB - 1] == 0);
+    sfree(a);
+}
+
+TEST_CASE("srealloc", "[huge_alloc]")
+{
+    char *a = (char *)smalloc(1000);
+    REQUIRE(a != nullptr);
+    memset(a, 'x', 1000);
+
+    // from the heap to a huge block.
+    char *b = (char *)srealloc(a, 2 * GB);
+    REQUIRE(b != nullptr);
+    REQUIRE(_num_huge_allocations() == 1);
+    b[2 * GB - 1] = 'y';
+
+    // between huge sizes the pages are remapped.
+    char *c = (char *)srealloc(b, 3 * GB);
+    REQUIRE(c != nullptr);
+    REQUIRE(_num_huge_allocation_bytes() == 3 * GB);
+    REQUIRE(c[2 * GB - 1] == 'y');
+    c[3 * GB - 1] = 'z';
+
+    // and back to the heap.
+    char *d = (char *)srealloc(c, 1000);
+    REQUIRE(d != nullptr);
+    REQUIRE(_num_huge_allocations() == 0);
+    size_t copied = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        copied += (d[i] == 'x');
+    }
+    REQUIRE(copied == 1000);
+    sfree(d);
+}
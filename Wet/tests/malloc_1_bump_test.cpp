@@ -0,0 +1,122 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define CHUNK_SIZE (1024 * 1024)
+#define ALIGNMENT 16
+
+TEST_CASE("Alignment", "[malloc1_bump]")
+{
+    char *prev = (char *)smalloc(1);
+    REQUIRE(prev != nullptr);
+    REQUIRE((uintptr_t)prev % ALIGNMENT == 0);
+    for (size_t size = 1; size <= 100; size++)
+    {
+        char *p = (char *)smalloc(size);
+        REQUIRE(p != nullptr);
+        REQUIRE((uintptr_t)p % ALIGNMENT == 0);
+        REQUIRE(p >= prev + ALIGNMENT);
+        memset(p, 'x', size);
+        prev = p;
+    }
+}
+
+TEST_CASE("Chunked refill", "[malloc1_bump]")
+{
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(10);
+    REQUIRE(a != nullptr);
+    void *after = sbrk(0);
+    REQUIRE((size_t)after - (size_t)base >= CHUNK_SIZE);
+    REQUIRE((size_t)after - (size_t)base < CHUNK_SIZE + ALIGNMENT);
+
+    // the rest of the chunk is used without moving the break.
+    for (int i = 1; i < CHUNK_SIZE / 64; i++)
+    {
+        char *p = (char *)smalloc(64);
+        REQUIRE(p != nullptr);
+    }
+    REQUIRE(sbrk(0) == after);
+
+    // until it's full.
+    char *b = (char *)smalloc(64);
+    REQUIRE(b != nullptr);
+    REQUIRE(b >= (char *)after);
+    REQUIRE((size_t)sbrk(0) - (size_t)after >= CHUNK_SIZE);
+}
+
+TEST_CASE("0 size", "[malloc1_bump]")
+{
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(0);
+    REQUIRE(a == nullptr);
+    void *after = sbrk(0);
+    REQUIRE(after == base);
+}
+
+TEST_CASE("Max size", "[malloc1_bump]")
+{
+    char *a = (char *)smalloc(16);
+    REQUIRE(a != nullptr);
+
+    // a large allocation gets a region of its own, the chunk goes on where it was.
+    char *b = (char *)smalloc(MAX_ALLOCATION_SIZE);
+    REQUIRE(b != nullptr);
+    REQUIRE((uintptr_t)b % ALIGNMENT == 0);
+    memset(b, 'x', MAX_ALLOCATION_SIZE);
+    char *c = (char *)smalloc(16);
+    REQUIRE(c == a + 16);
+
+    char *d = (char *)smalloc(MAX_ALLOCATION_SIZE + 1);
+    REQUIRE(d == nullptr);
+}
+
+TEST_CASE("Threads", "[malloc1_bump]")
+{
+    const int num_threads = 4;
+    const int count = 20000;
+    std::vector<std::vector<char *>> pointers(num_threads, std::vector<char *>(count));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++)
+    {
+        threads.emplace_back([&pointers, t]()
+        {
+            for (int i = 0; i < count; i++)
+            {
+                size_t size = 1 + (i % 200);
+                char *p = (char *)smalloc(size);
+                if (p != nullptr)
+                {
+                    memset(p, 'a' + t, size);
+                }
+                pointers[t][i] = p;
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    // no thread wrote over another thread's allocations.
+    for (int t = 0; t < num_threads; t++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            char *p = pointers[t][i];
+            REQUIRE(p != nullptr);
+            REQUIRE((uintptr_t)p % ALIGNMENT == 0);
+            size_t overwritten = 0;
+            for (size_t k = 0; k < 1 + (size_t)(i % 200); k++)
+            {
+                overwritten += (p[k] != 'a' + t);
+            }
+            REQUIRE(overwritten == 0);
+        }
+    }
+}
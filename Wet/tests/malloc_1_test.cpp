@@ -1,7 +1,11 @@
 #include "my_stdlib.h"
+#include "malloc_1.h"
 #include <catch2/catch_test_macros.hpp>
 
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
+#include <vector>
 
 #define MAX_ALLOCATION_SIZE (1e8)
 
@@ -51,3 +55,102 @@ TEST_CASE("Max size", "[malloc1]")
     after = sbrk(0);
     REQUIRE(MAX_ALLOCATION_SIZE == (size_t)after - (size_t)base);
 }
+
+TEST_CASE("Region alloc", "[malloc1]")
+{
+    void *base = sbrk(0);
+    struct region *r = region_create(1024);
+    REQUIRE(r != nullptr);
+
+    char *a = (char *)region_alloc(r, 10, 0);
+    REQUIRE(a != nullptr);
+    REQUIRE((uintptr_t)a % REGION_DEFAULT_ALIGNMENT == 0);
+    char *b = (char *)region_alloc(r, 1, 1);
+    REQUIRE(b == a + 10);
+    char *c = (char *)region_alloc(r, 100, 4096);
+    REQUIRE(c != nullptr);
+    REQUIRE((uintptr_t)c % 4096 == 0);
+    REQUIRE(c > b);
+
+    REQUIRE(region_alloc(r, 0, 0) == nullptr);
+    REQUIRE(region_alloc(r, 10, 3) == nullptr);
+    REQUIRE(region_alloc(r, MAX_ALLOCATION_SIZE + 1, 0) == nullptr);
+
+    // regions are mapped, the break doesn't move.
+    REQUIRE(sbrk(0) == base);
+    region_destroy(r);
+}
+
+TEST_CASE("Region growth", "[malloc1]")
+{
+    struct region *r = region_create(1024);
+    REQUIRE(r != nullptr);
+
+    // far more than the first chunk, every object keeps what was written to it.
+    std::vector<char *> objects(20000);
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        objects[i] = (char *)region_alloc(r, 100, 0);
+        REQUIRE(objects[i] != nullptr);
+        memset(objects[i], (char)i, 100);
+    }
+    size_t overwritten = 0;
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        for (int k = 0; k < 100; k++)
+        {
+            overwritten += (objects[i][k] != (char)i);
+        }
+    }
+    REQUIRE(overwritten == 0);
+
+    // larger than any chunk so far.
+    char *large = (char *)region_alloc(r, 10000000, 0);
+    REQUIRE(large != nullptr);
+    memset(large, 'x', 10000000);
+    region_destroy(r);
+}
+
+TEST_CASE("Region mark and release", "[malloc1]")
+{
+    struct region *r = region_create(1024);
+    REQUIRE(r != nullptr);
+    char *a = (char *)region_alloc(r, 16, 0);
+    REQUIRE(a != nullptr);
+
+    struct region_mark mark = region_mark(r);
+    char *b = (char *)region_alloc(r, 16, 0);
+    REQUIRE(b == a + 16);
+    for (int i = 0; i < 10000; i++)
+    {
+        REQUIRE(region_alloc(r, 1000, 0) != nullptr);
+    }
+    region_release(r, mark);
+
+    // everything after the mark is gone, the memory before it isn't.
+    char *c = (char *)region_alloc(r, 16, 0);
+    REQUIRE(c == b);
+    region_destroy(r);
+}
+
+TEST_CASE("Region reset", "[malloc1]")
+{
+    struct region *r = region_create(1024);
+    REQUIRE(r != nullptr);
+    std::vector<char *> first_round(5000);
+    for (size_t i = 0; i < first_round.size(); i++)
+    {
+        first_round[i] = (char *)region_alloc(r, 200, 0);
+        REQUIRE(first_round[i] != nullptr);
+    }
+
+    // the same allocations again get the same memory, the chunks were kept.
+    region_reset(r);
+    size_t moved = 0;
+    for (size_t i = 0; i < first_round.size(); i++)
+    {
+        moved += (region_alloc(r, 200, 0) != first_round[i]);
+    }
+    REQUIRE(moved == 0);
+    region_destroy(r);
+}
@@ -2,6 +2,13 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include <unistd.h>
+#include <string.h>
+#include <vector>
+#ifdef MALLOC_2_SIMD_INDEX
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#endif
 
 #define MAX_ALLOCATION_SIZE (1e8)
 
@@ -61,7 +68,7 @@ TEST_CASE("Check size", "[malloc2]")
     verify_blocks(2, 11, 1, 1);
     verify_size(base);
     sfree(b);
-    verify_blocks(2, 11, 2, 11);
+    verify_blocks(1, 11 + _size_meta_data(), 1, 11 + _size_meta_data());
     verify_size(base);
 }
 
@@ -119,30 +126,21 @@ TEST_CASE("free", "[malloc2]")
     verify_blocks(3, 30, 1, 10);
     verify_size(base);
     sfree(b);
-    verify_blocks(3, 30, 2, 20);
+    // adjacent free blocks are merged, the metadata in between becomes payload.
+    verify_blocks(2, 30 + _size_meta_data(), 1, 20 + _size_meta_data());
     verify_size(base);
     sfree(c);
-    verify_blocks(3, 30, 3, 30);
+    verify_blocks(1, 30 + 2 * _size_meta_data(), 1, 30 + 2 * _size_meta_data());
     verify_size(base);
 
     char *new_a = (char *)smalloc(10);
     REQUIRE(a == new_a);
-    char *new_b = (char *)smalloc(10);
-    REQUIRE(b == new_b);
-    char *new_c = (char *)smalloc(10);
-    REQUIRE(c == new_c);
-
-    verify_blocks(3, 30, 0, 0);
+    // the merged block is too small to split.
+    verify_blocks(1, 30 + 2 * _size_meta_data(), 0, 0);
     verify_size(base);
 
     sfree(new_a);
-    verify_blocks(3, 30, 1, 10);
-    verify_size(base);
-    sfree(new_b);
-    verify_blocks(3, 30, 2, 20);
-    verify_size(base);
-    sfree(new_c);
-    verify_blocks(3, 30, 3, 30);
+    verify_blocks(1, 30 + 2 * _size_meta_data(), 1, 30 + 2 * _size_meta_data());
     verify_size(base);
 }
 
@@ -165,30 +163,20 @@ TEST_CASE("free 2", "[malloc2]")
     verify_blocks(3, 30, 1, 10);
     verify_size(base);
     sfree(a);
-    verify_blocks(3, 30, 2, 20);
+    verify_blocks(2, 30 + _size_meta_data(), 1, 20 + _size_meta_data());
     verify_size(base);
     sfree(c);
-    verify_blocks(3, 30, 3, 30);
+    verify_blocks(1, 30 + 2 * _size_meta_data(), 1, 30 + 2 * _size_meta_data());
     verify_size(base);
 
     char *new_a = (char *)smalloc(10);
     REQUIRE(a == new_a);
-    char *new_b = (char *)smalloc(10);
-    REQUIRE(b == new_b);
-    char *new_c = (char *)smalloc(10);
-    REQUIRE(c == new_c);
-
-    verify_blocks(3, 30, 0, 0);
+    // the merged block is too small to split.
+    verify_blocks(1, 30 + 2 * _size_meta_data(), 0, 0);
     verify_size(base);
 
     sfree(new_a);
-    verify_blocks(3, 30, 1, 10);
-    verify_size(base);
-    sfree(new_b);
-    verify_blocks(3, 30, 2, 20);
-    verify_size(base);
-    sfree(new_c);
-    verify_blocks(3, 30, 3, 30);
+    verify_blocks(1, 30 + 2 * _size_meta_data(), 1, 30 + 2 * _size_meta_data());
     verify_size(base);
 }
 
@@ -214,27 +202,18 @@ TEST_CASE("free 3", "[malloc2]")
     verify_blocks(3, 30, 2, 20);
     verify_size(base);
     sfree(b);
-    verify_blocks(3, 30, 3, 30);
+    // b's neighbors are both free, the three become one block.
+    verify_blocks(1, 30 + 2 * _size_meta_data(), 1, 30 + 2 * _size_meta_data());
     verify_size(base);
 
     char *new_a = (char *)smalloc(10);
     REQUIRE(a == new_a);
-    char *new_b = (char *)smalloc(10);
-    REQUIRE(b == new_b);
-    char *new_c = (char *)smalloc(10);
-    REQUIRE(c == new_c);
-
-    verify_blocks(3, 30, 0, 0);
+    // the merged block is too small to split.
+    verify_blocks(1, 30 + 2 * _size_meta_data(), 0, 0);
     verify_size(base);
 
     sfree(new_a);
-    verify_blocks(3, 30, 1, 10);
-    verify_size(base);
-    sfree(new_b);
-    verify_blocks(3, 30, 2, 20);
-    verify_size(base);
-    sfree(new_c);
-    verify_blocks(3, 30, 3, 30);
+    verify_blocks(1, 30 + 2 * _size_meta_data(), 1, 30 + 2 * _size_meta_data());
     verify_size(base);
 }
 
@@ -298,7 +277,7 @@ TEST_CASE("Reuse two blocks", "[malloc2]")
     verify_blocks(2, 20, 1, 10);
     verify_size(base);
     sfree(c);
-    verify_blocks(2, 20, 2, 20);
+    verify_blocks(1, 20 + _size_meta_data(), 1, 20 + _size_meta_data());
     verify_size(base);
 }
 
@@ -335,7 +314,7 @@ TEST_CASE("Reuse two blocks reverse", "[malloc2]")
     verify_blocks(2, 20, 1, 10);
     verify_size(base);
     sfree(c);
-    verify_blocks(2, 20, 2, 20);
+    verify_blocks(1, 20 + _size_meta_data(), 1, 20 + _size_meta_data());
     verify_size(base);
 }
 
@@ -361,18 +340,18 @@ TEST_CASE("Reuse two blocks both", "[malloc2]")
     verify_blocks(2, 20, 1, 10);
     verify_size(base);
     sfree(b);
-    verify_blocks(2, 20, 2, 20);
+    verify_blocks(1, 20 + _size_meta_data(), 1, 20 + _size_meta_data());
     verify_size(base);
 
     char *c = (char *)smalloc(10);
     REQUIRE(c != nullptr);
     REQUIRE(c == a);
 
-    verify_blocks(2, 20, 1, 10);
+    verify_blocks(1, 20 + _size_meta_data(), 0, 0);
     verify_size(base);
 
     sfree(c);
-    verify_blocks(2, 20, 2, 20);
+    verify_blocks(1, 20 + _size_meta_data(), 1, 20 + _size_meta_data());
     verify_size(base);
 }
 
@@ -398,18 +377,18 @@ TEST_CASE("Reuse two blocks sizes small", "[malloc2]")
     verify_blocks(2, 110, 1, 10);
     verify_size(base);
     sfree(b);
-    verify_blocks(2, 110, 2, 110);
+    verify_blocks(1, 110 + _size_meta_data(), 1, 110 + _size_meta_data());
     verify_size(base);
 
     char *c = (char *)smalloc(10);
     REQUIRE(c != nullptr);
     REQUIRE(c == a);
 
-    verify_blocks(2, 110, 1, 100);
+    verify_blocks(1, 110 + _size_meta_data(), 0, 0);
     verify_size(base);
 
     sfree(c);
-    verify_blocks(2, 110, 2, 110);
+    verify_blocks(1, 110 + _size_meta_data(), 1, 110 + _size_meta_data());
     verify_size(base);
 }
 
@@ -435,18 +414,19 @@ TEST_CASE("Reuse two blocks sizes large", "[malloc2]")
     verify_blocks(2, 110, 1, 10);
     verify_size(base);
     sfree(b);
-    verify_blocks(2, 110, 2, 110);
+    verify_blocks(1, 110 + _size_meta_data(), 1, 110 + _size_meta_data());
     verify_size(base);
 
+    // a and b were merged, the first fit is a.
     char *c = (char *)smalloc(100);
     REQUIRE(c != nullptr);
-    REQUIRE(c == b);
+    REQUIRE(c == a);
 
-    verify_blocks(2, 110, 1, 10);
+    verify_blocks(1, 110 + _size_meta_data(), 0, 0);
     verify_size(base);
 
     sfree(c);
-    verify_blocks(2, 110, 2, 110);
+    verify_blocks(1, 110 + _size_meta_data(), 1, 110 + _size_meta_data());
     verify_size(base);
 }
 
@@ -479,7 +459,7 @@ TEST_CASE("scalloc", "[malloc2]")
     verify_blocks(2, sizeof(int) * 100 + 10, 1, 10);
     verify_size(base);
     sfree(b);
-    verify_blocks(2, sizeof(int) * 100 + 10, 2, sizeof(int) * 100 + 10);
+    verify_blocks(1, sizeof(int) * 100 + 10 + _size_meta_data(), 1, sizeof(int) * 100 + 10 + _size_meta_data());
     verify_size(base);
 }
 
@@ -632,19 +612,20 @@ TEST_CASE("realloc", "[malloc2]")
     verify_blocks(1, 10 * sizeof(int), 0, 0);
     verify_size(base);
 
+    // the block is at the top of the heap, it grows in place.
     int *b = (int *)srealloc(a, 100 * sizeof(int));
     REQUIRE(b != nullptr);
-    REQUIRE(b != a);
+    REQUIRE(b == a);
     for (int i = 0; i < 10; i++)
     {
         REQUIRE(b[i] == i);
     }
 
-    verify_blocks(2, sizeof(int) * 110, 1, sizeof(int) * 10);
+    verify_blocks(1, sizeof(int) * 100, 0, 0);
     verify_size(base);
 
     sfree(b);
-    verify_blocks(2, sizeof(int) * 110, 2, sizeof(int) * 110);
+    verify_blocks(1, sizeof(int) * 100, 1, sizeof(int) * 100);
     verify_size(base);
 }
 
@@ -709,3 +690,300 @@ TEST_CASE("srealloc Max size", "[malloc2]")
     verify_blocks(1, MAX_ALLOCATION_SIZE, 1, MAX_ALLOCATION_SIZE);
     verify_size(base);
 }
+
+TEST_CASE("Reuse smallest size class", "[malloc2]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    // the used blocks in between keep the free ones from being merged.
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(300);
+    char *s1 = (char *)smalloc(10);
+    char *b = (char *)smalloc(20);
+    char *s2 = (char *)smalloc(10);
+    char *c = (char *)smalloc(5000);
+    REQUIRE(a != nullptr);
+    REQUIRE(s1 != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(s2 != nullptr);
+    REQUIRE(c != nullptr);
+    verify_blocks(5, 5340, 0, 0);
+    verify_size(base);
+
+    sfree(a);
+    sfree(b);
+    sfree(c);
+    verify_blocks(5, 5340, 3, 5320);
+
+    // the free blocks are kept by size, the best fitting class is used even if a lower block would fit.
+    char *d = (char *)smalloc(16);
+    REQUIRE(d == b);
+    verify_blocks(5, 5340, 2, 5300);
+    char *e = (char *)smalloc(1000);
+    REQUIRE(e == c);
+    verify_blocks(6, 5340 - _size_meta_data(), 2, 4300 - _size_meta_data());
+    char *f = (char *)smalloc(300);
+    REQUIRE(f == a);
+    verify_blocks(6, 5340 - _size_meta_data(), 1, 4000 - _size_meta_data());
+    verify_size(base);
+
+    sfree(d);
+    sfree(e);
+    sfree(f);
+    verify_blocks(5, 5340, 3, 5320);
+    verify_size(base);
+    sfree(s1);
+    sfree(s2);
+    verify_blocks(1, 5340 + 4 * _size_meta_data(), 1, 5340 + 4 * _size_meta_data());
+    verify_size(base);
+}
+
+TEST_CASE("Split", "[malloc2]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(100000);
+    REQUIRE(a != nullptr);
+    char *guard = (char *)smalloc(10);
+    REQUIRE(guard != nullptr);
+    sfree(a);
+    verify_blocks(2, 100010, 1, 100000);
+
+    // a small request takes only what it needs out of a big free block.
+    char *b = (char *)smalloc(16);
+    REQUIRE(b == a);
+    verify_blocks(3, 100010 - _size_meta_data(), 1, 100000 - 16 - _size_meta_data());
+    verify_size(base);
+    char *c = (char *)smalloc(1000);
+    REQUIRE(c == b + 16 + _size_meta_data());
+    verify_blocks(4, 100010 - 2 * _size_meta_data(), 1, 100000 - 1016 - 2 * _size_meta_data());
+    verify_size(base);
+
+    // too little would be left to split off: the whole block is used.
+    char *d = (char *)smalloc(100000 - 1016 - 2 * _size_meta_data() - 100);
+    REQUIRE(d == c + 1000 + _size_meta_data());
+    verify_blocks(4, 100010 - 2 * _size_meta_data(), 0, 0);
+    verify_size(base);
+
+    sfree(b);
+    sfree(d);
+    verify_blocks(4, 100010 - 2 * _size_meta_data(), 2, 100000 - 1000 - 2 * _size_meta_data());
+    sfree(c);
+    verify_blocks(2, 100010, 1, 100000);
+    verify_size(base);
+    sfree(guard);
+    verify_blocks(1, 100010 + _size_meta_data(), 1, 100010 + _size_meta_data());
+}
+
+TEST_CASE("Wilderness", "[malloc2]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    memset(a, 'x', 100);
+    sfree(a);
+
+    // the free block at the top of the heap is grown by the missing part only.
+    char *b = (char *)scalloc(1000, 1);
+    REQUIRE(b == a);
+    void *after = sbrk(0);
+    REQUIRE(1000 + _size_meta_data() == (size_t)after - (size_t)base);
+    for (int i = 0; i < 1000; i++)
+    {
+        REQUIRE(b[i] == 0);
+    }
+    verify_blocks(1, 1000, 0, 0);
+    verify_size(base);
+
+    sfree(b);
+    verify_blocks(1, 1000, 1, 1000);
+    verify_size(base);
+}
+
+TEST_CASE("srealloc in place", "[malloc2]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(1000);
+    char *guard = (char *)smalloc(10);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(guard != nullptr);
+    memset(a, 'x', 100);
+    sfree(b);
+    verify_blocks(3, 1110, 1, 1000);
+
+    // the free block that follows is taken, what isn't needed of it is split off again.
+    char *c = (char *)srealloc(a, 500);
+    REQUIRE(c == a);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(c[i] == 'x');
+    }
+    verify_blocks(3, 1110, 1, 600);
+    verify_size(base);
+
+    // all of it.
+    char *d = (char *)srealloc(c, 1100 + _size_meta_data());
+    REQUIRE(d == a);
+    verify_blocks(2, 1110 + _size_meta_data(), 0, 0);
+    verify_size(base);
+
+    // the block after is used, the data has to move.
+    char *e = (char *)srealloc(d, 5000);
+    REQUIRE(e != a);
+    REQUIRE(e > guard);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(e[i] == 'x');
+    }
+    verify_blocks(3, 6110 + _size_meta_data(), 1, 1100 + _size_meta_data());
+    verify_size(base);
+
+    sfree(e);
+    sfree(guard);
+    verify_blocks(1, 6110 + 3 * _size_meta_data(), 1, 6110 + 3 * _size_meta_data());
+    verify_size(base);
+}
+
+TEST_CASE("srealloc into the wilderness", "[malloc2]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(1000);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    memset(a, 'x', 100);
+    sfree(b);
+    verify_blocks(2, 1100, 1, 1000);
+
+    // the free block at the top isn't enough: it's taken and the break is moved by what's still missing.
+    char *c = (char *)srealloc(a, 3000);
+    REQUIRE(c == a);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(c[i] == 'x');
+    }
+    void *after = sbrk(0);
+    REQUIRE(3000 + _size_meta_data() == (size_t)after - (size_t)base);
+    verify_blocks(1, 3000, 0, 0);
+    verify_size(base);
+
+    sfree(c);
+    verify_blocks(1, 3000, 1, 3000);
+    verify_size(base);
+}
+
+TEST_CASE("Free in random order", "[malloc2]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    // every other block is freed, in a shuffled order: the free lists grow to count blocks.
+    const int count = 100000;
+    void *base = sbrk(0);
+    std::vector<char *> blocks(count), pins(count);
+    std::vector<int> order(count);
+    size_t block_bytes = 0;
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        blocks[i] = (char *)smalloc(16 + i % 49);
+        pins[i] = (char *)smalloc(16);
+        failed += (blocks[i] == nullptr || pins[i] == nullptr);
+        block_bytes += 16 + i % 49;
+        order[i] = i;
+    }
+    REQUIRE(failed == 0);
+    verify_blocks(2 * count, block_bytes + 16 * count, 0, 0);
+    unsigned int state = 11;
+    for (int i = count - 1; i > 0; i--)
+    {
+        state = state * 1103515245 + 12345;
+        std::swap(order[i], order[(state >> 8) % (i + 1)]);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        sfree(blocks[order[i]]);
+    }
+    verify_blocks(2 * count, block_bytes + 16 * count, count, block_bytes);
+    verify_size(base);
+
+    // with the pins gone everything is merged back into one block.
+    for (int i = 0; i < count; i++)
+    {
+        sfree(pins[i]);
+    }
+    size_t total = block_bytes + 16 * count + (2 * count - 1) * _size_meta_data();
+    verify_blocks(1, total, 1, total);
+    verify_size(base);
+}
+
+#ifdef MALLOC_2_SIMD_INDEX
+// the process' address space, read without allocating.
+static size_t mapped_bytes()
+{
+    char buffer[64] = {0};
+    int fd = open("/proc/self/statm", O_RDONLY);
+    REQUIRE(fd >= 0);
+    REQUIRE(read(fd, buffer, sizeof(buffer) - 1) > 0);
+    close(fd);
+    return strtoul(buffer, NULL, 10) * sysconf(_SC_PAGESIZE);
+}
+
+TEST_CASE("Index can't grow", "[malloc2]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    // 512 blocks fill the index's first mapping, the next one needs it doubled.
+    void *heap_base = sbrk(0);
+    static void *blocks[512];
+    for (int i = 0; i < 512; i++)
+    {
+        blocks[i] = smalloc(16);
+        REQUIRE(blocks[i] != nullptr);
+    }
+    verify_blocks(512, 512 * 16, 0, 0);
+
+    // with room for a few more blocks in the heap but not for the index, the block isn't made.
+    void *base = sbrk(0);
+    struct rlimit old_limit;
+    REQUIRE(getrlimit(RLIMIT_AS, &old_limit) == 0);
+    struct rlimit limit = old_limit;
+    limit.rlim_cur = mapped_bytes() + 2 * sysconf(_SC_PAGESIZE);
+    REQUIRE(setrlimit(RLIMIT_AS, &limit) == 0);
+    void *failed = smalloc(16);
+    void *after = sbrk(0);
+    REQUIRE(setrlimit(RLIMIT_AS, &old_limit) == 0);
+    REQUIRE(failed == nullptr);
+    REQUIRE(after == base);
+    verify_blocks(512, 512 * 16, 0, 0);
+
+    // every block already has its place: all of them are found again once they're freed.
+    for (int i = 0; i < 512; i += 2)
+    {
+        sfree(blocks[i]);
+    }
+    verify_blocks(512, 512 * 16, 256, 256 * 16);
+    for (int i = 0; i < 512; i += 2)
+    {
+        blocks[i] = smalloc(16);
+        REQUIRE(blocks[i] != nullptr);
+    }
+    REQUIRE(sbrk(0) == base);
+    verify_blocks(512, 512 * 16, 0, 0);
+    verify_size(heap_base);
+
+    for (int i = 0; i < 512; i++)
+    {
+        sfree(blocks[i]);
+    }
+    verify_blocks(1, 512 * 16 + 511 * _size_meta_data(), 1, 512 * 16 + 511 * _size_meta_data());
+}
+#endif
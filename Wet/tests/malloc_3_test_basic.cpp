@@ -1,8 +1,15 @@
 #include "my_stdlib.h"
+#include "malloc_3.h"
+#include "heap_snapshot.h"
+#include "alloc_trace.h"
 #include <catch2/catch_test_macros.hpp>
 
 #include <unistd.h>
 #include <cmath>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -202,7 +209,9 @@ TEST_CASE("Finding buddies test", "[malloc3]")
         verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, allocations.size()%2, allocations.size(), 32-(int)(i/2)-1, 0, 0, 0);
     }
 
+#ifndef MALLOC_GROWABLE_HEAP
     REQUIRE(smalloc(40) == NULL);
+#endif
     // Free the allocated blocks
     while (!allocations.empty())
     {
@@ -223,7 +232,9 @@ TEST_CASE("Finding buddies test", "[malloc3]")
         allocations.push_back(ptr);
         verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, allocations.size()%2, allocations.size(), 32-(int)(i/2)-1, 0, 0, 0);
     }
+#ifndef MALLOC_GROWABLE_HEAP
     REQUIRE(smalloc(40) == NULL);
+#endif
     // Free the allocated blocks
     while (!allocations.empty())
     {
@@ -283,6 +294,180 @@ TEST_CASE("multiple big allocs test", "[malloc3]")
     verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 0, 0);
 }
 
+TEST_CASE("mmap chunks out of order", "[malloc3]")
+{
+    const int count = 40;
+    std::vector<char*> chunks;
+    std::vector<size_t> sizes;
+    std::vector<char> fills;
+    size_t big_bytes = 0;
+    for (int i = 0; i < count; i++)
+    {
+        size_t size = MMAP_THRESHOLD + 4096 * i + 3 * i;
+        char* p = (char*)smalloc(size);
+        REQUIRE(p != nullptr);
+        memset(p, 'a' + i % 26, size);
+        chunks.push_back(p);
+        sizes.push_back(size);
+        fills.push_back('a' + i % 26);
+        big_bytes += size;
+        verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, i + 1, big_bytes);
+    }
+
+    // free or resize chunks picked at random, the resized ones keep their data.
+    unsigned int state = 7;
+    for (int step = 0; step < count; step++)
+    {
+        state = state * 1103515245 + 12345;
+        size_t i = (state >> 8) % chunks.size();
+        if (step % 2 == 0)
+        {
+            sfree(chunks[i]);
+            big_bytes -= sizes[i];
+            chunks.erase(chunks.begin() + i);
+            sizes.erase(sizes.begin() + i);
+            fills.erase(fills.begin() + i);
+        }
+        else
+        {
+            size_t size = (step % 4 == 1) ? sizes[i] + 50000 : MMAP_THRESHOLD + (sizes[i] - MMAP_THRESHOLD) / 2;
+            char* p = (char*)srealloc(chunks[i], size);
+            REQUIRE(p != nullptr);
+            size_t kept = 0;
+            for (size_t k = 0; k < std::min(size, sizes[i]); k++)
+            {
+                kept += (p[k] == fills[i]);
+            }
+            REQUIRE(kept == std::min(size, sizes[i]));
+            memset(p, fills[i], size);
+            big_bytes = big_bytes - sizes[i] + size;
+            chunks[i] = p;
+            sizes[i] = size;
+        }
+        verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, chunks.size(), big_bytes);
+    }
+
+    // a chunk shrinks into the buddy heap, an order 3 block split off a root.
+    char* small = (char*)srealloc(chunks[0], 900);
+    REQUIRE(small != nullptr);
+    REQUIRE(small[899] == fills[0]);
+    big_bytes -= sizes[0];
+    verify_block_by_order(0, 0, 0, 0, 0, 0, 1, 1, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 31, 0, chunks.size() - 1, big_bytes);
+
+    // and grows back into a chunk.
+    char* grown = (char*)srealloc(small, MMAP_THRESHOLD + 1);
+    REQUIRE(grown != nullptr);
+    REQUIRE(grown[899] == fills[0]);
+    chunks[0] = grown;
+    sizes[0] = MMAP_THRESHOLD + 1;
+    big_bytes += sizes[0];
+    verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, chunks.size(), big_bytes);
+
+    while (!chunks.empty())
+    {
+        state = state * 1103515245 + 12345;
+        size_t i = (state >> 8) % chunks.size();
+        sfree(chunks[i]);
+        big_bytes -= sizes[i];
+        chunks.erase(chunks.begin() + i);
+        sizes.erase(sizes.begin() + i);
+        verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, chunks.size(), big_bytes);
+    }
+}
+
+// every buddy block is a power of two (metadata included), and the counters agree with the order lists.
+static void verify_buddy_heap(size_t live_blocks, size_t live_bytes)
+{
+    struct smalloc_stats stats;
+    smalloc_stats(&stats);
+    size_t free_blocks = 0, used_blocks = 0, free_bytes = 0, heap_bytes = 0;
+    for (int order = 0; order <= 10; order++)
+    {
+        size_t block_size = 128 << order;
+        free_blocks += stats.free_blocks_by_order[order];
+        used_blocks += stats.used_blocks_by_order[order];
+        free_bytes += stats.free_blocks_by_order[order] * (block_size - _size_meta_data());
+        heap_bytes += (stats.free_blocks_by_order[order] + stats.used_blocks_by_order[order]) * block_size;
+    }
+    REQUIRE(heap_bytes == 32 * MAX_ELEMENT_SIZE);
+    REQUIRE(used_blocks == live_blocks);
+    REQUIRE(free_blocks == _num_free_blocks());
+    REQUIRE(free_bytes == _num_free_bytes());
+    REQUIRE(_num_allocated_blocks() == free_blocks + used_blocks);
+    REQUIRE(_num_allocated_bytes() == free_bytes + live_bytes);
+}
+
+TEST_CASE("buddy blocks stay powers of two", "[malloc3]")
+{
+    std::vector<unsigned char*> blocks;
+    size_t live_bytes = 0;
+    unsigned int state = 2023;
+    for (int step = 0; step < 20000; step++)
+    {
+        state = state * 1103515245 + 12345;
+        unsigned int op = (state >> 16) % 10;
+        size_t size = 1 + (state >> 4) % 16000;
+        if (blocks.empty() || (op < 4 && blocks.size() < 150))
+        {
+            unsigned char* p = (unsigned char*)smalloc(size);
+            if (p == nullptr)
+            {
+                continue; // the heap is fragmented, a block of that order isn't left
+            }
+            memset(p, (unsigned char)blocks.size(), smalloc_usable_size(p));
+            blocks.push_back(p);
+            live_bytes += smalloc_usable_size(p);
+        }
+        else
+        {
+            size_t i = (state >> 8) % blocks.size();
+            unsigned char fill = *blocks[i];
+            size_t old_size = smalloc_usable_size(blocks[i]);
+            size_t overwritten = 0;
+            for (size_t k = 0; k < old_size; k++)
+            {
+                overwritten += (blocks[i][k] != fill);
+            }
+            REQUIRE(overwritten == 0);
+            if (op < 7)
+            {
+                live_bytes -= old_size;
+                sfree(blocks[i]);
+                blocks[i] = blocks.back();
+                blocks.pop_back();
+            }
+            else
+            {
+                unsigned char* p = (unsigned char*)srealloc(blocks[i], size);
+                if (p == nullptr)
+                {
+                    continue;
+                }
+                size_t kept = 0;
+                for (size_t k = 0; k < std::min(old_size, size); k++)
+                {
+                    kept += (p[k] == fill);
+                }
+                REQUIRE(kept == std::min(old_size, size));
+                live_bytes = live_bytes - old_size + smalloc_usable_size(p);
+                memset(p, fill, smalloc_usable_size(p));
+                blocks[i] = p;
+            }
+        }
+        for (unsigned char* p : blocks)
+        {
+            size_t block_size = smalloc_usable_size(p) + _size_meta_data();
+            REQUIRE((block_size & (block_size - 1)) == 0);
+        }
+        verify_buddy_heap(blocks.size(), live_bytes);
+    }
+    for (unsigned char* p : blocks)
+    {
+        sfree(p);
+    }
+    verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 0, 0);
+}
+
 TEST_CASE("Exit Test", "[malloc3]") {
     SECTION("Exit with Code 0xDEADBEEF") {
         int exitCode = 0xDEADBEEF & 0xFF;  // Keep only the lower 8 bits
@@ -415,3 +600,463 @@ TEST_CASE("weird values", "[malloc3]")
     sfree(ptr);
     verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 0, 0);
 }
+
+#ifdef MALLOC_HUGE_PAGES
+TEST_CASE("huge page accounting", "[malloc3]")
+{
+    const size_t huge_page = 2 * 1024 * 1024;
+    void* small = smalloc(40);
+    REQUIRE(small != nullptr);
+    size_t base = _num_huge_page_bytes();
+    REQUIRE(base % huge_page == 0);
+
+    // the mapping, metadata included, is rounded up to whole huge pages.
+    char* big = (char*)smalloc(2 * huge_page + 100);
+    REQUIRE(big != nullptr);
+    big[0] = 'a';
+    big[2 * huge_page + 99] = 'b';
+    REQUIRE(_num_huge_page_bytes() == base + 3 * huge_page);
+
+    sfree(big);
+    REQUIRE(_num_huge_page_bytes() == base);
+    sfree(small);
+}
+#endif
+
+TEST_CASE("scalloc reused block", "[malloc3]")
+{
+    char* a = (char*)smalloc(5000);
+    REQUIRE(a != nullptr);
+    for (int i = 0; i < 5000; i++)
+    {
+        a[i] = 'a';
+    }
+    sfree(a);
+
+    char* b = (char*)scalloc(5000, 1);
+    REQUIRE(b == a);
+    for (int i = 0; i < 5000; i++)
+    {
+        REQUIRE(b[i] == 0);
+    }
+    sfree(b);
+
+    char* c = (char*)scalloc(1000, 1000);
+    REQUIRE(c != nullptr);
+    for (int i = 0; i < 1000 * 1000; i++)
+    {
+        REQUIRE(c[i] == 0);
+    }
+    sfree(c);
+}
+
+TEST_CASE("srealloc large copy", "[malloc3]")
+{
+    const size_t size = 2 * 1024 * 1024 + 3;
+    unsigned char* a = (unsigned char*)smalloc(size);
+    REQUIRE(a != nullptr);
+    for (size_t i = 0; i < size; i++)
+    {
+        a[i] = (unsigned char)(i % 251);
+    }
+    unsigned char* b = (unsigned char*)srealloc(a, 3 * size);
+    REQUIRE(b != nullptr);
+    for (size_t i = 0; i < size; i++)
+    {
+        REQUIRE(b[i] == (unsigned char)(i % 251));
+    }
+    unsigned char* c = (unsigned char*)srealloc(b, size / 2);
+    REQUIRE(c != nullptr);
+    for (size_t i = 0; i < size / 2; i++)
+    {
+        REQUIRE(c[i] == (unsigned char)(i % 251));
+    }
+    sfree(c);
+    verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 0, 0);
+}
+
+TEST_CASE("smalloc_stats snapshot", "[malloc3]")
+{
+    struct smalloc_stats stats;
+    void* small = smalloc(40);
+    REQUIRE(small != nullptr);
+    smalloc_stats(&stats);
+    REQUIRE(stats.used_blocks_by_order[0] == 1);
+    REQUIRE(stats.free_blocks_by_order[0] == 1);
+    REQUIRE(stats.free_blocks_by_order[9] == 1);
+    REQUIRE(stats.free_blocks_by_order[10] == 31);
+    REQUIRE(stats.num_splits == 10);
+    REQUIRE(stats.num_merges == 0);
+    REQUIRE(stats.used_bytes == 128 - _size_meta_data());
+
+    void* big = smalloc(MMAP_THRESHOLD + 100);
+    REQUIRE(big != nullptr);
+    REQUIRE(smalloc(MAX_ALLOCATION_SIZE + 1) == nullptr);
+    sfree(big);
+    sfree(small);
+    smalloc_stats(&stats);
+    REQUIRE(stats.free_blocks_by_order[10] == 32);
+    REQUIRE(stats.used_blocks_by_order[0] == 0);
+    REQUIRE(stats.num_merges == 10);
+#ifndef MALLOC_PAGE_HEAP
+    REQUIRE(stats.num_mmaps == 1);
+    REQUIRE(stats.num_munmaps == 1);
+    REQUIRE(stats.mmapped_bytes == MMAP_THRESHOLD + 100);
+    REQUIRE(stats.munmapped_bytes == MMAP_THRESHOLD + 100);
+#else
+    // the chunk was a span of the page heap.
+    REQUIRE(stats.num_mmaps == 0);
+    REQUIRE(stats.num_span_allocs == 1);
+    REQUIRE(stats.num_span_frees == 1);
+#endif
+    REQUIRE(stats.used_bytes == 0);
+    REQUIRE(stats.peak_used_bytes == 128 - _size_meta_data() + MMAP_THRESHOLD + 100);
+    REQUIRE(stats.num_failed_allocations == 0);
+
+#ifndef MALLOC_GROWABLE_HEAP
+    std::vector<void*> allocations;
+    for (int i = 0; i < 32; i++)
+    {
+        allocations.push_back(smalloc(MAX_ELEMENT_SIZE - _size_meta_data()));
+    }
+    REQUIRE(smalloc(40) == nullptr);
+    smalloc_stats(&stats);
+    REQUIRE(stats.num_failed_allocations == 1);
+    for (void* ptr : allocations)
+    {
+        sfree(ptr);
+    }
+#endif
+}
+
+#ifdef MALLOC_PAGE_HEAP
+TEST_CASE("page heap spans", "[malloc3]")
+{
+    const size_t page = 4096;
+    const size_t region = 64 * 1024 * 1024;
+    const size_t max_span = 32 * 1024 * 1024;
+    struct smalloc_stats stats;
+
+    // spans are carved out of the region one after the other, a chunk's metadata takes it to 33 pages.
+    char* a = (char*)smalloc(MMAP_THRESHOLD);
+    char* b = (char*)smalloc(MMAP_THRESHOLD);
+    REQUIRE(a != nullptr);
+    REQUIRE(b == a + 33 * page);
+    smalloc_stats(&stats);
+    REQUIRE(stats.num_mmaps == 0);
+    REQUIRE(stats.num_span_allocs == 2);
+    REQUIRE(stats.span_reserved_bytes == region);
+    verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 2, 2 * MMAP_THRESHOLD);
+
+    // freed spans coalesce: twice as much fits where a was.
+    sfree(a);
+    sfree(b);
+    char* c = (char*)smalloc(2 * MMAP_THRESHOLD);
+    REQUIRE(c == a);
+    memset(c, 'c', 2 * MMAP_THRESHOLD);
+
+    // srealloc grows a span into the free pages after it, and gives them back when it shrinks.
+    REQUIRE(srealloc(c, 4 * MMAP_THRESHOLD) == c);
+    REQUIRE(c[2 * MMAP_THRESHOLD - 1] == 'c');
+    REQUIRE(srealloc(c, MMAP_THRESHOLD + 100) == c);
+    char* d = (char*)smalloc(MMAP_THRESHOLD);
+    REQUIRE(d == c + 33 * page);
+    smalloc_stats(&stats);
+    REQUIRE(stats.num_span_allocs == 4);
+    verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 2, 2 * MMAP_THRESHOLD + 100);
+    sfree(c);
+    sfree(d);
+
+    // the largest span, two of them don't fit in a region.
+    char* e = (char*)smalloc(max_span - _size_meta_data());
+    char* f = (char*)smalloc(max_span - _size_meta_data());
+    REQUIRE(e != nullptr);
+    REQUIRE(f != nullptr);
+    e[max_span - _size_meta_data() - 1] = 'e';
+    f[max_span - _size_meta_data() - 1] = 'f';
+    smalloc_stats(&stats);
+    REQUIRE(stats.span_reserved_bytes == 2 * region);
+    // a region that's free again is unmapped, unless it's the last one.
+    sfree(e);
+    sfree(f);
+    smalloc_stats(&stats);
+    REQUIRE(stats.span_reserved_bytes == region);
+    REQUIRE(stats.num_mmaps == 0);
+
+    // past the largest span a chunk is mapped on its own.
+    char* g = (char*)smalloc(max_span);
+    REQUIRE(g != nullptr);
+    g[max_span - 1] = 'g';
+    sfree(g);
+    smalloc_stats(&stats);
+    REQUIRE(stats.num_mmaps == 1);
+    REQUIRE(stats.num_munmaps == 1);
+    verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 0, 0);
+}
+#endif
+
+#ifdef MALLOC_GROWABLE_HEAP
+TEST_CASE("growable heap", "[malloc3]")
+{
+    // a plain array: the test's own allocations mustn't move the program break.
+    void* allocations[64];
+    struct smalloc_stats stats;
+    for (int i = 0; i < 32; i++)
+    {
+        allocations[i] = smalloc(MAX_ELEMENT_SIZE - _size_meta_data());
+        REQUIRE(allocations[i] != nullptr);
+    }
+
+    // the region is full, 32 more roots are added right after it.
+    char* region_end = (char*)sbrk(0);
+    void* small = smalloc(40);
+    REQUIRE(small != nullptr);
+    REQUIRE((char*)small - _size_meta_data() == region_end);
+    REQUIRE((char*)sbrk(0) == region_end + 32 * MAX_ELEMENT_SIZE);
+    smalloc_stats(&stats);
+    REQUIRE(stats.used_blocks_by_order[10] == 32);
+    REQUIRE(stats.used_blocks_by_order[0] == 1);
+    REQUIRE(stats.free_blocks_by_order[0] == 1);
+    REQUIRE(stats.free_blocks_by_order[9] == 1);
+    REQUIRE(stats.free_blocks_by_order[10] == 31);
+    REQUIRE(stats.num_failed_allocations == 0);
+
+    // the new roots' blocks merge back like the first ones'.
+    sfree(small);
+    for (int i = 0; i < 32; i++)
+    {
+        sfree(allocations[i]);
+    }
+    smalloc_stats(&stats);
+    REQUIRE(stats.free_blocks_by_order[10] == 64);
+    REQUIRE(_num_free_blocks() == 64);
+    REQUIRE(_num_free_bytes() == 64 * (MAX_ELEMENT_SIZE - _size_meta_data()));
+
+    // once something else moved the program break the region can't grow.
+    for (int i = 0; i < 64; i++)
+    {
+        allocations[i] = smalloc(MAX_ELEMENT_SIZE - _size_meta_data());
+        REQUIRE(allocations[i] != nullptr);
+    }
+    REQUIRE(sbrk(4096) != (void*)(-1));
+    REQUIRE(smalloc(40) == nullptr);
+    REQUIRE(sbrk(-4096) != (void*)(-1));
+    smalloc_stats(&stats);
+    REQUIRE(stats.num_failed_allocations == 1);
+    for (int i = 0; i < 64; i++)
+    {
+        sfree(allocations[i]);
+    }
+    REQUIRE(_num_free_blocks() == 64);
+}
+#endif
+
+#ifdef MALLOC_LATENCY_STATS
+TEST_CASE("latency histograms", "[malloc3]")
+{
+    void* small = smalloc(40);
+    void* other = smalloc(40);
+    void* big = smalloc(MMAP_THRESHOLD + 100);
+    big = srealloc(big, 2 * MMAP_THRESHOLD);
+    sfree(big);
+    sfree(small);
+    sfree(other);
+
+    REQUIRE(smalloc_latency_samples(SMALLOC_OP_SMALLOC, SMALLOC_PATH_SPLIT) == 1);
+    REQUIRE(smalloc_latency_samples(SMALLOC_OP_SMALLOC, SMALLOC_PATH_BUDDY_HIT) == 1);
+    REQUIRE(smalloc_latency_samples(SMALLOC_OP_SMALLOC, SMALLOC_PATH_MMAP) == 1);
+    REQUIRE(smalloc_latency_samples(SMALLOC_OP_SREALLOC, SMALLOC_PATH_MMAP) == 1);
+    REQUIRE(smalloc_latency_samples(SMALLOC_OP_SFREE, SMALLOC_PATH_MUNMAP) == 1);
+    REQUIRE(smalloc_latency_samples(SMALLOC_OP_SFREE, SMALLOC_PATH_MERGE) == 1);
+    REQUIRE(smalloc_latency_samples(SMALLOC_OP_SFREE, SMALLOC_PATH_BUDDY_HIT) == 1);
+    size_t p50 = smalloc_latency_percentile(SMALLOC_OP_SFREE, SMALLOC_PATH_MERGE, 50);
+    REQUIRE(p50 > 0);
+    REQUIRE(smalloc_latency_percentile(SMALLOC_OP_SFREE, SMALLOC_PATH_MERGE, 99.9) == p50);
+}
+#endif
+
+#ifdef MALLOC_HEAP_PROFILER
+TEST_CASE("heap profiler", "[malloc3]")
+{
+    // big allocations are always sampled, the distance between samples is at most their size.
+    std::vector<void*> allocations;
+    for (int i = 0; i < 8; i++)
+    {
+        allocations.push_back(smalloc(32 * 1024 * 1024));
+    }
+    REQUIRE(smalloc_profile_live_samples() >= 1);
+    for (void* ptr : allocations)
+    {
+        sfree(ptr);
+    }
+    REQUIRE(smalloc_profile_live_samples() == 0);
+
+    char path[] = "/tmp/malloc_3_profileXXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    smalloc_profile_dump(fd);
+    char header[32] = {0};
+    REQUIRE(pread(fd, header, sizeof(header) - 1, 0) > 0);
+    close(fd);
+    unlink(path);
+    REQUIRE(strncmp(header, "heap profile: 0: 0 [", strlen("heap profile: 0: 0 [")) == 0);
+}
+#endif
+
+#ifdef MALLOC_TRACE
+TEST_CASE("allocation trace", "[malloc3]")
+{
+    char path[] = "/tmp/malloc_3_traceXXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    void* before = smalloc(100); // allocated before the trace, unknown to it.
+    REQUIRE(smalloc_trace_start(fd) == 0);
+    REQUIRE(smalloc_trace_start(fd) == -1);
+    void* a = smalloc(40);
+    void* b = scalloc(10, 30);
+    a = srealloc(a, 1000);
+    sfree(b);
+    sfree(before);
+    REQUIRE(smalloc(0) == NULL); // invalid, not traced
+    REQUIRE(smalloc(100000001) == NULL);
+    sfree(a);
+    REQUIRE(smalloc_trace_stop() == 0);
+    REQUIRE(smalloc_trace_stop() == -1);
+
+    uint8_t data[256];
+    ssize_t length = pread(fd, data, sizeof(data), 0);
+    close(fd);
+    unlink(path);
+    struct alloc_trace_header header;
+    REQUIRE(length > (ssize_t)sizeof(header));
+    memcpy(&header, data, sizeof(header));
+    REQUIRE(header.magic == ALLOC_TRACE_MAGIC);
+    REQUIRE(header.version == ALLOC_TRACE_VERSION);
+
+    // only the outermost calls are recorded: scalloc and srealloc don't show their smalloc/sfree.
+    const uint8_t expected_ops[] = {ALLOC_TRACE_SMALLOC, ALLOC_TRACE_SCALLOC, ALLOC_TRACE_SREALLOC,
+                                    ALLOC_TRACE_SFREE, ALLOC_TRACE_SFREE, ALLOC_TRACE_SFREE};
+    const uint64_t expected_distances[] = {0, 0, 2, 2, 0, 1};
+    const uint64_t expected_sizes[] = {40, 30, 1000, 0, 0, 0};
+    size_t offset = sizeof(header);
+    for (int i = 0; i < 6; i++)
+    {
+        struct alloc_trace_record record;
+        size_t record_length = allocTraceDecode(data + offset, length - offset, &record);
+        REQUIRE(record_length != 0);
+        REQUIRE(record.op == expected_ops[i]);
+        REQUIRE_FALSE(record.failed);
+        REQUIRE(record.id_distance == expected_distances[i]);
+        REQUIRE(record.size == expected_sizes[i]);
+        offset += record_length;
+    }
+    REQUIRE(offset == (size_t)length);
+}
+#endif
+
+TEST_CASE("fragmentation metrics", "[malloc3]")
+{
+    struct smalloc_fragmentation fragmentation;
+    void* ptr1 = smalloc(40);
+    REQUIRE(ptr1 != nullptr);
+    smalloc_fragmentation(&fragmentation);
+    REQUIRE(fragmentation.largest_free_order == 10);
+    REQUIRE(fragmentation.largest_free_block == MAX_ELEMENT_SIZE - _size_meta_data());
+    REQUIRE(fragmentation.free_bytes_by_order[0] == 128 - _size_meta_data());
+    REQUIRE(fragmentation.free_bytes_by_order[10] == 31 * (MAX_ELEMENT_SIZE - _size_meta_data()));
+    REQUIRE(fragmentation.fragmentation_index[10] == -1);
+    REQUIRE(fragmentation.requested_bytes == 40);
+    REQUIRE(fragmentation.granted_bytes == 128 - _size_meta_data());
+    REQUIRE(fragmentation.internal_fragmentation_bytes == 128 - _size_meta_data() - 40);
+
+    void* ptr2 = srealloc(ptr1, 60);
+    REQUIRE(ptr2 == ptr1);
+    smalloc_fragmentation(&fragmentation);
+    REQUIRE(fragmentation.requested_bytes == 60);
+
+    // fill the heap with order 9 blocks, then free every other one: half of the memory is free but no
+    // order 10 block can be allocated.
+    sfree(ptr2);
+    std::vector<void*> allocations;
+    for (int i = 0; i < 64; i++)
+    {
+        allocations.push_back(smalloc(128 * 256));
+    }
+    for (int i = 0; i < 64; i += 2)
+    {
+        sfree(allocations[i]);
+    }
+    smalloc_fragmentation(&fragmentation);
+    REQUIRE(fragmentation.largest_free_order == 9);
+    REQUIRE(fragmentation.fragmentation_index[9] == -1);
+    REQUIRE(fragmentation.fragmentation_index[10] > 0.4);
+    REQUIRE(fragmentation.requested_bytes == 32 * 128 * 256);
+}
+
+TEST_CASE("heap snapshot", "[malloc3]")
+{
+    void* small = smalloc(40);
+    void* big = smalloc(MMAP_THRESHOLD + 100);
+    REQUIRE(small != nullptr);
+    REQUIRE(big != nullptr);
+
+    char path[] = "/tmp/malloc_3_snapshotXXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE(smalloc_snapshot_write(fd) == 0);
+    lseek(fd, 0, SEEK_SET);
+    struct heap_snapshot_header header;
+    REQUIRE(read(fd, &header, sizeof(header)) == sizeof(header));
+    REQUIRE(header.magic == HEAP_SNAPSHOT_MAGIC);
+    REQUIRE(header.num_roots == 32);
+    REQUIRE(header.region_base == (uint64_t)small - _size_meta_data());
+
+    // order 0 (used and free) up to order 9 after the split, 31 roots, the chunk and the end record.
+    struct heap_snapshot_record record;
+    int blocks = 0, used = 0, chunks = 0, ends = 0;
+    while (read(fd, &record, sizeof(record)) == sizeof(record))
+    {
+        blocks += (record.type == HEAP_SNAPSHOT_BLOCK);
+        used += (record.type == HEAP_SNAPSHOT_BLOCK && !record.is_free);
+        chunks += (record.type == HEAP_SNAPSHOT_CHUNK);
+        ends += (record.type == HEAP_SNAPSHOT_END);
+    }
+    close(fd);
+    unlink(path);
+    REQUIRE(blocks == 11 + 31);
+    REQUIRE(used == 1);
+    REQUIRE(chunks == 1);
+    REQUIRE(ends == 1);
+    sfree(big);
+    sfree(small);
+}
+
+TEST_CASE("smemalign", "[malloc3]")
+{
+    void* small = smemalign(16, 40);
+    REQUIRE(small != nullptr);
+    REQUIRE((size_t)small % 16 == 0);
+    REQUIRE(smalloc_usable_size(small) == 128 - _size_meta_data());
+
+    char* aligned = (char*)smemalign(4096, 1000);
+    REQUIRE(aligned != nullptr);
+    REQUIRE((size_t)aligned % 4096 == 0);
+    REQUIRE(smalloc_usable_size(aligned) >= 1000);
+    memset(aligned, 7, 1000);
+    char* grown = (char*)srealloc(aligned, 3000);
+    REQUIRE(grown != nullptr);
+    for (int i = 0; i < 1000; i++)
+    {
+        REQUIRE(grown[i] == 7);
+    }
+    sfree(grown);
+
+    void* big = smemalign(64, MMAP_THRESHOLD + 100);
+    REQUIRE(big != nullptr);
+    REQUIRE((size_t)big % 64 == 0);
+    REQUIRE(smalloc_usable_size(big) >= MMAP_THRESHOLD + 100);
+    sfree(big);
+    sfree(small);
+    REQUIRE(smalloc_usable_size(nullptr) == 0);
+    verify_block_by_order(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 0, 0);
+}
@@ -0,0 +1,233 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define HEAP_GROW_SIZE (128 * 1024)
+#define ALIGNMENT 16
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == allocated_bytes);                                                            \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == free_bytes);                                                                      \
+        REQUIRE(_num_meta_data_bytes() == _size_meta_data() * allocated_blocks);                                       \
+    } while (0)
+
+// the payload of the first area: it ends with an empty block that's never counted.
+#define AREA_BYTES (HEAP_GROW_SIZE - _size_meta_data())
+
+TEST_CASE("Sanity", "[malloc4]")
+{
+    verify_blocks(0, 0, 0, 0);
+    char *a = (char *)smalloc(10);
+    REQUIRE(a != nullptr);
+    REQUIRE((uintptr_t)a % ALIGNMENT == 0);
+    memset(a, 'x', 10);
+
+    // the heap grows by a whole area, what isn't used is one free block.
+    verify_blocks(2, AREA_BYTES - _size_meta_data(), 1, AREA_BYTES - 16 - _size_meta_data());
+    sfree(a);
+    verify_blocks(1, AREA_BYTES, 1, AREA_BYTES);
+}
+
+TEST_CASE("0 size and Max size", "[malloc4]")
+{
+    REQUIRE(smalloc(0) == nullptr);
+    REQUIRE(smalloc(MAX_ALLOCATION_SIZE + 1) == nullptr);
+    REQUIRE(scalloc(0, 10) == nullptr);
+    REQUIRE(scalloc((size_t)1 << 40, (size_t)1 << 40) == nullptr);
+    verify_blocks(0, 0, 0, 0);
+
+    char *a = (char *)smalloc(MAX_ALLOCATION_SIZE);
+    REQUIRE(a != nullptr);
+    memset(a, 'x', MAX_ALLOCATION_SIZE);
+    verify_blocks(1, MAX_ALLOCATION_SIZE, 0, 0);
+    sfree(a);
+    verify_blocks(0, 0, 0, 0);
+}
+
+TEST_CASE("Split and coalesce", "[malloc4]")
+{
+    char *a = (char *)smalloc(1000);
+    char *b = (char *)smalloc(1000);
+    char *c = (char *)smalloc(1000);
+    REQUIRE(a != nullptr);
+    REQUIRE(b == a + 1008 + _size_meta_data());
+    REQUIRE(c == b + 1008 + _size_meta_data());
+    size_t rest = AREA_BYTES - 3 * (1008 + _size_meta_data());
+    verify_blocks(4, 3 * 1008 + rest, 1, rest);
+
+    sfree(b);
+    verify_blocks(4, 3 * 1008 + rest, 2, 1008 + rest);
+    // merged with the next free block.
+    sfree(a);
+    verify_blocks(3, 3 * 1008 + rest + _size_meta_data(), 2, 2 * 1008 + _size_meta_data() + rest);
+    // merged with both neighbors.
+    sfree(c);
+    verify_blocks(1, AREA_BYTES, 1, AREA_BYTES);
+}
+
+TEST_CASE("Good fit", "[malloc4]")
+{
+    // the lower free block is large, the higher one is the size of the request: the higher one is taken.
+    char *large = (char *)smalloc(4000);
+    char *guard1 = (char *)smalloc(16);
+    char *small = (char *)smalloc(1008);
+    char *guard2 = (char *)smalloc(16);
+    REQUIRE(large != nullptr);
+    REQUIRE(guard1 != nullptr);
+    REQUIRE(small != nullptr);
+    REQUIRE(guard2 != nullptr);
+    sfree(large);
+    sfree(small);
+
+    char *a = (char *)smalloc(900);
+    REQUIRE(a == small);
+    char *b = (char *)smalloc(3000);
+    REQUIRE(b == large);
+}
+
+TEST_CASE("Heap growth", "[malloc4]")
+{
+    // more than an area, in pieces that all stay used.
+    std::vector<char *> blocks;
+    blocks.reserve(100);
+    for (int i = 0; i < 100; i++)
+    {
+        char *p = (char *)smalloc(100000);
+        REQUIRE(p != nullptr);
+        memset(p, (char)i, 100000);
+        blocks.push_back(p);
+    }
+    size_t overwritten = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        for (int k = 0; k < 100000; k++)
+        {
+            overwritten += (blocks[i][k] != (char)i);
+        }
+    }
+    REQUIRE(overwritten == 0);
+    for (char *p : blocks)
+    {
+        sfree(p);
+    }
+    // the areas follow each other, they merged into one free block.
+    REQUIRE(_num_free_blocks() == 1);
+    REQUIRE(_num_allocated_blocks() == 1);
+}
+
+TEST_CASE("Mapped allocations", "[malloc4]")
+{
+    char *a = (char *)smalloc(MMAP_THRESHOLD);
+    REQUIRE(a != nullptr);
+    void *base = sbrk(0);
+    verify_blocks(1, MMAP_THRESHOLD, 0, 0);
+    char *b = (char *)scalloc(1, MMAP_THRESHOLD * 2);
+    REQUIRE(b != nullptr);
+    for (int i = 0; i < MMAP_THRESHOLD * 2; i++)
+    {
+        REQUIRE(b[i] == 0);
+    }
+    REQUIRE(sbrk(0) == base);
+    verify_blocks(2, MMAP_THRESHOLD * 3, 0, 0);
+
+    sfree(a);
+    sfree(b);
+    verify_blocks(0, 0, 0, 0);
+}
+
+TEST_CASE("scalloc reused block", "[malloc4]")
+{
+    // 1024 is where a second level range starts, a request for it takes the block back.
+    char *a = (char *)smalloc(1024);
+    char *guard = (char *)smalloc(16);
+    REQUIRE(a != nullptr);
+    REQUIRE(guard != nullptr);
+    memset(a, 'x', 1024);
+    sfree(a);
+
+    char *b = (char *)scalloc(64, 16);
+    REQUIRE(b == a);
+    for (int i = 0; i < 1024; i++)
+    {
+        REQUIRE(b[i] == 0);
+    }
+}
+
+TEST_CASE("srealloc", "[malloc4]")
+{
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(1000);
+    char *guard = (char *)smalloc(16);
+    char *guard2 = (char *)smalloc(16);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(guard != nullptr);
+    REQUIRE(guard2 != nullptr);
+    memset(a, 'x', 100);
+    REQUIRE(srealloc(a, 50) == a);
+    REQUIRE(srealloc(a, MAX_ALLOCATION_SIZE + 1) == nullptr);
+
+    // the free block after it is taken, what's left of it is split off again.
+    sfree(b);
+    char *c = (char *)srealloc(a, 500);
+    REQUIRE(c == a);
+    REQUIRE(_num_free_blocks() == 2);
+
+    // the block after it is used, the data moves.
+    char *d = (char *)srealloc(guard, 5000);
+    REQUIRE(d != guard);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(c[i] == 'x');
+    }
+    sfree(c);
+    sfree(d);
+    sfree(guard2);
+    verify_blocks(1, AREA_BYTES, 1, AREA_BYTES);
+}
+
+TEST_CASE("Random workload", "[malloc4]")
+{
+    std::vector<std::pair<unsigned char *, size_t>> live;
+    unsigned int state = 12345;
+    size_t overwritten = 0;
+    for (int op = 0; op < 20000; op++)
+    {
+        state = state * 1103515245 + 12345;
+        if (live.empty() || (state >> 16) % 100 < 55)
+        {
+            size_t size = 1 + (state >> 8) % ((state % 8 == 0) ? 200000 : 2000);
+            unsigned char *p = (unsigned char *)smalloc(size);
+            REQUIRE(p != nullptr);
+            memset(p, (unsigned char)size, size);
+            live.push_back({p, size});
+        }
+        else
+        {
+            size_t i = (state >> 8) % live.size();
+            for (size_t k = 0; k < live[i].second; k++)
+            {
+                overwritten += (live[i].first[k] != (unsigned char)live[i].second);
+            }
+            sfree(live[i].first);
+            live[i] = live.back();
+            live.pop_back();
+        }
+    }
+    REQUIRE(overwritten == 0);
+    for (auto &object : live)
+    {
+        sfree(object.first);
+    }
+    REQUIRE(_num_allocated_blocks() == _num_free_blocks());
+}
@@ -0,0 +1,469 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/reporters/catch_reporter_event_listener.hpp>
+#include <catch2/reporters/catch_reporter_registrars.hpp>
+
+#include "bench_allocators.h"
+#include "perf_counters.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+Microbenchmarks of every implementation against the system malloc (see bench_allocators.h).
+Besides Catch2's report, every benchmark is appended to a CSV file (MALLOC_BENCH_CSV, malloc_bench.csv
+by default): implementation,pattern,ops,ns_per_op,ops_per_sec,<perf counters per op, see perf_counters.h>
+The counters come from a separate pass of COUNTED_RUNS runs, Catch2's own sampling and analysis would be
+counted with them otherwise.
+*/
+
+#define BATCH 256 // allocations alive at once in the batch patterns
+#define COUNTED_RUNS 100
+#define FRAGMENTED_HOLES 4096 // free blocks the fit search has to pick from in the fragmented pattern
+#define SCATTERED_FREES 16384 // freed blocks pinned apart by live ones in the scattered frees pattern
+#define MEDIUM_BUFFERS 64 // alive at once in the medium buffers pattern
+
+// pseudo random sizes, the same sequence for every implementation.
+static std::vector<size_t> getSizes(size_t count, size_t min_size, size_t max_size)
+{
+    std::vector<size_t> sizes(count);
+    unsigned int state = 12345;
+    for (size_t i = 0; i < count; i++)
+    {
+        state = state * 1103515245 + 12345;
+        sizes[i] = min_size + (state >> 8) % (max_size - min_size + 1);
+    }
+    return sizes;
+}
+
+// operations (allocations, frees, reallocations) done by one run of each benchmark, for the CSV.
+static std::map<std::string, size_t>& getOpsPerRun()
+{
+    static std::map<std::string, size_t> ops_per_run;
+    return ops_per_run;
+}
+
+// counted over COUNTED_RUNS runs of each benchmark.
+static std::map<std::string, std::array<long long, NUM_PERF_EVENTS>>& getPerfValues()
+{
+    static std::map<std::string, std::array<long long, NUM_PERF_EVENTS>> perf_values;
+    return perf_values;
+}
+
+// records what the CSV needs about a benchmark before Catch2 runs it, returns its name.
+template <typename Run>
+static std::string prepareBenchmark(const Allocator& allocator, const std::string& pattern, size_t ops, Run run)
+{
+    std::string name = allocator.name + "/" + pattern;
+    getOpsPerRun()[name] = ops;
+    PerfCounters counters(false);
+    run(); // warm up
+    counters.start();
+    for (int i = 0; i < COUNTED_RUNS; i++)
+    {
+        run();
+    }
+    counters.stop();
+    std::copy(counters.values, counters.values + NUM_PERF_EVENTS, getPerfValues()[name].begin());
+    return name;
+}
+
+class CsvListener : public Catch::EventListenerBase
+{
+public:
+    using Catch::EventListenerBase::EventListenerBase;
+
+    void benchmarkEnded(Catch::BenchmarkStats<> const& stats) override
+    {
+        const char* path = getenv("MALLOC_BENCH_CSV");
+        FILE* csv = fopen(path ? path : "malloc_bench.csv", "a");
+        if (csv == NULL)
+        {
+            return;
+        }
+        if (ftell(csv) == 0)
+        {
+            fprintf(csv, "implementation,pattern,ops,ns_per_op,ops_per_sec");
+            printPerfCsvHeader(csv);
+            fprintf(csv, "\n");
+        }
+        std::string name = stats.info.name;
+        size_t slash = name.find('/');
+        size_t ops = getOpsPerRun()[name];
+        double ns_per_op = stats.mean.point.count() / (ops ? ops : 1);
+        fprintf(csv, "%s,%s,%zu,%.3f,%.0f", name.substr(0, slash).c_str(), name.substr(slash + 1).c_str(), ops,
+                ns_per_op, 1e9 / ns_per_op);
+        printPerfCsvValues(csv, getPerfValues()[name].data(), (double)ops * COUNTED_RUNS);
+        fprintf(csv, "\n");
+        fclose(csv);
+    }
+};
+
+CATCH_REGISTER_LISTENER(CsvListener)
+
+TEST_CASE("fixed size", "[malloc_bench]")
+{
+    for (const Allocator& allocator : getAllocators())
+    {
+        auto run = [&]()
+        {
+            size_t failed = 0;
+            for (int i = 0; i < BATCH; i++)
+            {
+                char* p = (char*)allocator.malloc_fn(64);
+                failed += (p == NULL);
+                allocator.free_fn(p);
+            }
+            return failed;
+        };
+        BENCHMARK(prepareBenchmark(allocator, "fixed_64", 2 * BATCH, run))
+        {
+            return run();
+        };
+    }
+}
+
+TEST_CASE("random size", "[malloc_bench]")
+{
+    std::vector<size_t> sizes = getSizes(BATCH, 16, 1024);
+    // free in a shuffled order (Fisher-Yates over the same pseudo random sequence).
+    std::vector<size_t> swaps = getSizes(BATCH, 0, BATCH - 1);
+    std::vector<size_t> order(BATCH);
+    for (size_t i = 0; i < BATCH; i++)
+    {
+        order[i] = i;
+    }
+    for (size_t i = BATCH - 1; i > 0; i--)
+    {
+        std::swap(order[i], order[swaps[i] % (i + 1)]);
+    }
+    for (const Allocator& allocator : getAllocators())
+    {
+        std::vector<void*> pointers(BATCH);
+        auto run = [&]()
+        {
+            for (int i = 0; i < BATCH; i++)
+            {
+                pointers[i] = allocator.malloc_fn(sizes[i]);
+            }
+            for (int i = 0; i < BATCH; i++)
+            {
+                allocator.free_fn(pointers[order[i]]);
+            }
+            return pointers[0];
+        };
+        BENCHMARK(prepareBenchmark(allocator, "random_16_1024", 2 * BATCH, run))
+        {
+            return run();
+        };
+    }
+}
+
+TEST_CASE("lifo", "[malloc_bench]")
+{
+    std::vector<size_t> sizes = getSizes(BATCH, 16, 512);
+    for (const Allocator& allocator : getAllocators())
+    {
+        std::vector<void*> pointers(BATCH);
+        auto run = [&]()
+        {
+            for (int i = 0; i < BATCH; i++)
+            {
+                pointers[i] = allocator.malloc_fn(sizes[i]);
+            }
+            for (int i = BATCH - 1; i >= 0; i--)
+            {
+                allocator.free_fn(pointers[i]);
+            }
+            return pointers[0];
+        };
+        BENCHMARK(prepareBenchmark(allocator, "lifo_16_512", 2 * BATCH, run))
+        {
+            return run();
+        };
+    }
+}
+
+TEST_CASE("fifo", "[malloc_bench]")
+{
+    std::vector<size_t> sizes = getSizes(BATCH, 16, 512);
+    for (const Allocator& allocator : getAllocators())
+    {
+        std::vector<void*> pointers(BATCH);
+        auto run = [&]()
+        {
+            for (int i = 0; i < BATCH; i++)
+            {
+                pointers[i] = allocator.malloc_fn(sizes[i]);
+            }
+            for (int i = 0; i < BATCH; i++)
+            {
+                allocator.free_fn(pointers[i]);
+            }
+            return pointers[0];
+        };
+        BENCHMARK(prepareBenchmark(allocator, "fifo_16_512", 2 * BATCH, run))
+        {
+            return run();
+        };
+    }
+}
+
+TEST_CASE("realloc growth", "[malloc_bench]")
+{
+    const int steps = 64;
+    for (const Allocator& allocator : getAllocators())
+    {
+        if (allocator.realloc_fn == NULL)
+        {
+            continue;
+        }
+        auto run = [&]()
+        {
+            char* p = (char*)allocator.malloc_fn(64);
+            for (int i = 1; i <= steps; i++)
+            {
+                char* grown = (char*)allocator.realloc_fn(p, 64 * i);
+                if (grown == NULL)
+                {
+                    break;
+                }
+                p = grown;
+                p[64 * i - 1] = (char)i;
+            }
+            allocator.free_fn(p);
+            return p;
+        };
+        BENCHMARK(prepareBenchmark(allocator, "realloc_64_to_4096", steps + 2, run))
+        {
+            return run();
+        };
+    }
+}
+
+TEST_CASE("calloc", "[malloc_bench]")
+{
+    for (const Allocator& allocator : getAllocators())
+    {
+        if (allocator.calloc_fn == NULL)
+        {
+            continue;
+        }
+        std::vector<void*> pointers(BATCH);
+        auto run = [&]()
+        {
+            for (int i = 0; i < BATCH; i++)
+            {
+                pointers[i] = allocator.calloc_fn(16, 64);
+            }
+            for (int i = 0; i < BATCH; i++)
+            {
+                allocator.free_fn(pointers[i]);
+            }
+            return pointers[0];
+        };
+        BENCHMARK(prepareBenchmark(allocator, "calloc_16x64", 2 * BATCH, run))
+        {
+            return run();
+        };
+    }
+}
+
+// a heap full of free holes of every size, pinned apart by live blocks: what the fit search costs with
+// malloc_2's size class lists, its tree and its simd index. The other implementations don't search a free list.
+TEST_CASE("fragmented heap", "[malloc_bench]")
+{
+    std::vector<size_t> hole_sizes = getSizes(FRAGMENTED_HOLES, 16, 4096);
+    std::vector<size_t> sizes = getSizes(BATCH, 16, 4096);
+    std::reverse(sizes.begin(), sizes.end()); // not the holes' own order
+    for (const Allocator& allocator : getAllocators())
+    {
+        if (allocator.name != "system" && allocator.name.compare(0, 8, "malloc_2") != 0)
+        {
+            continue;
+        }
+        std::vector<void*> holes(FRAGMENTED_HOLES), pins(FRAGMENTED_HOLES);
+        for (int i = 0; i < FRAGMENTED_HOLES; i++)
+        {
+            holes[i] = allocator.malloc_fn(hole_sizes[i]);
+            pins[i] = allocator.malloc_fn(16);
+        }
+        for (void* hole : holes)
+        {
+            allocator.free_fn(hole);
+        }
+        auto run = [&]()
+        {
+            size_t failed = 0;
+            for (int i = 0; i < BATCH; i++)
+            {
+                char* p = (char*)allocator.malloc_fn(sizes[i]);
+                failed += (p == NULL);
+                allocator.free_fn(p);
+            }
+            return failed;
+        };
+        BENCHMARK(prepareBenchmark(allocator, "fragmented_16_4096", 2 * BATCH, run))
+        {
+            return run();
+        };
+        for (void* pin : pins)
+        {
+            allocator.free_fn(pin);
+        }
+    }
+}
+
+// frees in a shuffled order into a heap that keeps SCATTERED_FREES free blocks apart: what putting a block
+// back costs with malloc_2's size class lists, its tree and its simd index.
+TEST_CASE("scattered frees", "[malloc_bench]")
+{
+    std::vector<size_t> sizes = getSizes(SCATTERED_FREES, 16, 64);
+    std::vector<size_t> swaps = getSizes(SCATTERED_FREES, 0, SCATTERED_FREES - 1);
+    std::vector<size_t> order(SCATTERED_FREES);
+    for (size_t i = 0; i < SCATTERED_FREES; i++)
+    {
+        order[i] = i;
+    }
+    for (size_t i = SCATTERED_FREES - 1; i > 0; i--)
+    {
+        std::swap(order[i], order[swaps[i] % (i + 1)]);
+    }
+    for (const Allocator& allocator : getAllocators())
+    {
+        if (allocator.name != "system" && allocator.name.compare(0, 8, "malloc_2") != 0)
+        {
+            continue;
+        }
+        std::vector<void*> blocks(SCATTERED_FREES), pins(SCATTERED_FREES);
+        for (int i = 0; i < SCATTERED_FREES; i++)
+        {
+            blocks[i] = allocator.malloc_fn(sizes[i]);
+            pins[i] = allocator.malloc_fn(16);
+        }
+        auto run = [&]()
+        {
+            size_t failed = 0;
+            for (int i = 0; i < SCATTERED_FREES; i++)
+            {
+                allocator.free_fn(blocks[order[i]]);
+            }
+            for (int i = 0; i < SCATTERED_FREES; i++)
+            {
+                blocks[i] = allocator.malloc_fn(sizes[i]);
+                failed += (blocks[i] == NULL);
+            }
+            return failed;
+        };
+        BENCHMARK(prepareBenchmark(allocator, "scattered_16_64", 2 * SCATTERED_FREES, run))
+        {
+            return run();
+        };
+        for (int i = 0; i < SCATTERED_FREES; i++)
+        {
+            allocator.free_fn(blocks[i]);
+            allocator.free_fn(pins[i]);
+        }
+    }
+}
+
+// buffers of 128KB to 1MB, past the mmap threshold of malloc_3 and malloc_4. Only their first page is touched.
+TEST_CASE("medium buffers", "[malloc_bench]")
+{
+    std::vector<size_t> sizes = getSizes(MEDIUM_BUFFERS, 128 * 1024, 1024 * 1024);
+    for (const Allocator& allocator : getAllocators())
+    {
+        if (allocator.name.compare(0, 8, "malloc_1") == 0 || allocator.name.compare(0, 8, "malloc_2") == 0)
+        {
+            continue; // malloc_1 never gives them back, malloc_2 has no threshold.
+        }
+        std::vector<char*> pointers(MEDIUM_BUFFERS);
+        auto run = [&]()
+        {
+            for (int i = 0; i < MEDIUM_BUFFERS; i++)
+            {
+                pointers[i] = (char*)allocator.malloc_fn(sizes[i]);
+                if (pointers[i] != NULL)
+                {
+                    pointers[i][0] = (char)i;
+                }
+            }
+            for (int i = 0; i < MEDIUM_BUFFERS; i++)
+            {
+                allocator.free_fn(pointers[i]);
+            }
+            return pointers[0];
+        };
+        BENCHMARK(prepareBenchmark(allocator, "medium_128k_1m", 2 * MEDIUM_BUFFERS, run))
+        {
+            return run();
+        };
+    }
+}
+
+// many small objects that all die together: one by one through each allocator, or from a malloc_1 region
+// that lets them all go with one region_reset(). Either way an object costs an allocation and a release.
+TEST_CASE("request arena", "[malloc_bench]")
+{
+    std::vector<size_t> sizes = getSizes(BATCH, 16, 128);
+    std::vector<void*> pointers(BATCH);
+    for (const Allocator& allocator : getAllocators())
+    {
+        if (allocator.name.compare(0, 8, "malloc_1") == 0)
+        {
+            continue;
+        }
+        auto run = [&]()
+        {
+            for (int i = 0; i < BATCH; i++)
+            {
+                pointers[i] = allocator.malloc_fn(sizes[i]);
+            }
+            for (int i = 0; i < BATCH; i++)
+            {
+                allocator.free_fn(pointers[i]);
+            }
+            return pointers[0];
+        };
+        BENCHMARK(prepareBenchmark(allocator, "arena_16_128", 2 * BATCH, run))
+        {
+            return run();
+        };
+    }
+
+    std::string path = std::string(MALLOC_BENCH_MODULE_DIR) + "/libbench_malloc_1.so";
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+    {
+        return;
+    }
+    auto region_create_fn = (void* (*)(size_t))dlsym(handle, "_Z13region_createm");
+    auto region_alloc_fn = (void* (*)(void*, size_t, size_t))dlsym(handle, "_Z12region_allocP6regionmm");
+    auto region_reset_fn = (void (*)(void*))dlsym(handle, "_Z12region_resetP6region");
+    auto region_destroy_fn = (void (*)(void*))dlsym(handle, "_Z14region_destroyP6region");
+    void* region = (region_create_fn != NULL) ? region_create_fn(BATCH * 128) : NULL;
+    if (region == NULL || region_alloc_fn == NULL || region_reset_fn == NULL || region_destroy_fn == NULL)
+    {
+        return;
+    }
+    Allocator regions = {"malloc_1_region", NULL, NULL, NULL, NULL, false, NULL, NULL};
+    auto run = [&]()
+    {
+        for (int i = 0; i < BATCH; i++)
+        {
+            pointers[i] = region_alloc_fn(region, sizes[i], 0);
+        }
+        region_reset_fn(region);
+        return pointers[0];
+    };
+    BENCHMARK(prepareBenchmark(regions, "arena_16_128", 2 * BATCH, run))
+    {
+        return run();
+    };
+    region_destroy_fn(region);
+}
@@ -0,0 +1,343 @@
+#include "bench_allocators.h"
+#include "perf_counters.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Multithreaded workloads, swept over 1..N threads for every implementation:
+    malloc_mt_bench [max threads] [seconds per run]
+threadtest: every thread allocates and frees batches of its own objects.
+larson: every thread replaces random objects in a set of slots, and the sets move on to the next thread
+        every round, so most objects are freed by another thread than the one that allocated them.
+xmalloc: every thread allocates a batch that the next thread frees (producer/consumer).
+Each run is a forked child, so its peak RSS is its own. Only the system malloc is thread-safe, the others are
+called under one lock: their curves are the baseline any thread-safety or caching work gets measured against.
+malloc_1 is left out, it never frees so the workloads would only measure sbrk().
+Besides the table, every run is appended to a CSV file (MALLOC_MT_BENCH_CSV, malloc_mt_bench.csv by default):
+implementation,workload,threads,ops,ops_per_sec,scaling,peak_rss_kb,<perf counters per op, see perf_counters.h>
+The counters cover every thread of the run, time spent waiting for the lock in the kernel isn't counted.
+*/
+
+#define BATCH 100 // objects per batch (threadtest, xmalloc)
+#define SLOTS 100 // objects per set (larson)
+#define ROUND_OPS 400 // replacements per larson round
+#define MIN_OBJECT 16
+#define MAX_OBJECT 512
+#define DEFAULT_MAX_THREADS 8
+#define DEFAULT_SECONDS 1.0
+
+struct Run
+{
+    const Allocator* allocator;
+    int num_threads;
+    unsigned long long deadline; // ns
+    pthread_barrier_t barrier;
+    bool running;
+    std::vector<std::vector<void*>> sets; // larson's slots / xmalloc's batches, one per thread
+};
+
+struct RunResult
+{
+    size_t ops;
+    size_t failed;
+    unsigned long long elapsed; // ns
+    size_t peak_rss_kb; // growth of the peak RSS over the run
+    long long perf_values[NUM_PERF_EVENTS];
+};
+
+static std::mutex allocator_mutex;
+
+static unsigned long long readTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static unsigned int nextRandom(unsigned int* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// allocates and writes the object, so the RSS is what the allocator really needed.
+static void* benchMalloc(const Allocator& allocator, size_t size, size_t* failed)
+{
+    void* p;
+    if (allocator.thread_safe)
+    {
+        p = allocator.malloc_fn(size);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(allocator_mutex);
+        p = allocator.malloc_fn(size);
+    }
+    if (p == NULL)
+    {
+        *failed += 1;
+        return NULL;
+    }
+    memset(p, 0xa5, size);
+    return p;
+}
+
+static void benchFree(const Allocator& allocator, void* p)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+    if (allocator.thread_safe)
+    {
+        allocator.free_fn(p);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(allocator_mutex);
+    allocator.free_fn(p);
+}
+
+// every thread waits for the others, then they all go on or all stop.
+static bool nextRound(Run* run)
+{
+    if (pthread_barrier_wait(&run->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        run->running = readTime() < run->deadline;
+    }
+    pthread_barrier_wait(&run->barrier);
+    return run->running;
+}
+
+static void threadtest(Run* run, int, size_t* ops, size_t* failed)
+{
+    std::vector<void*> objects(BATCH);
+    while (readTime() < run->deadline)
+    {
+        for (int i = 0; i < BATCH; i++)
+        {
+            objects[i] = benchMalloc(*run->allocator, 64, failed);
+        }
+        for (int i = 0; i < BATCH; i++)
+        {
+            benchFree(*run->allocator, objects[i]);
+        }
+        *ops += 2 * BATCH;
+    }
+}
+
+static void larson(Run* run, int id, size_t* ops, size_t* failed)
+{
+    unsigned int state = 12345 + id;
+    for (void*& object : run->sets[id])
+    {
+        object = benchMalloc(*run->allocator, MIN_OBJECT + nextRandom(&state) % (MAX_OBJECT - MIN_OBJECT + 1), failed);
+    }
+    int round = 0;
+    do
+    {
+        std::vector<void*>& set = run->sets[(id + round) % run->num_threads];
+        for (int i = 0; i < ROUND_OPS; i++)
+        {
+            void*& object = set[nextRandom(&state) % SLOTS];
+            benchFree(*run->allocator, object);
+            object = benchMalloc(*run->allocator, MIN_OBJECT + nextRandom(&state) % (MAX_OBJECT - MIN_OBJECT + 1), failed);
+        }
+        *ops += 2 * ROUND_OPS;
+        round++;
+    } while (nextRound(run));
+    // every thread is on a different set in the last round, so each one is freed once.
+    for (void* object : run->sets[(id + round) % run->num_threads])
+    {
+        benchFree(*run->allocator, object);
+    }
+}
+
+static void xmalloc(Run* run, int id, size_t* ops, size_t* failed)
+{
+    unsigned int state = 12345 + id;
+    do
+    {
+        for (void*& object : run->sets[id])
+        {
+            object = benchMalloc(*run->allocator, MIN_OBJECT + nextRandom(&state) % (MAX_OBJECT - MIN_OBJECT + 1), failed);
+        }
+        pthread_barrier_wait(&run->barrier);
+        for (void* object : run->sets[(id + 1) % run->num_threads])
+        {
+            benchFree(*run->allocator, object);
+        }
+        *ops += 2 * BATCH;
+    } while (nextRound(run));
+}
+
+struct Workload
+{
+    const char* name;
+    void (*thread_fn)(Run*, int, size_t*, size_t*);
+    size_t set_size;
+};
+
+static const Workload workloads[] = {
+    {"threadtest", threadtest, 0},
+    {"larson", larson, SLOTS},
+    {"xmalloc", xmalloc, BATCH},
+};
+
+static RunResult runWorkload(const Allocator& allocator, const Workload& workload, int num_threads, double seconds)
+{
+    Run run;
+    run.allocator = &allocator;
+    run.num_threads = num_threads;
+    run.running = true;
+    run.sets.assign(num_threads, std::vector<void*>(workload.set_size, NULL));
+    pthread_barrier_init(&run.barrier, NULL, num_threads);
+
+    bool peak_rss_reset = resetPeakRss();
+    size_t base_rss_kb = readStatusKb("VmRSS:");
+    std::vector<size_t> ops(num_threads, 0), failed(num_threads, 0);
+    std::vector<std::thread> threads;
+    PerfCounters counters(true); // opened before the threads are created, so they inherit them
+    counters.start();
+    unsigned long long start = readTime();
+    run.deadline = start + (unsigned long long)(seconds * 1e9);
+    for (int id = 0; id < num_threads; id++)
+    {
+        threads.emplace_back(workload.thread_fn, &run, id, &ops[id], &failed[id]);
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    RunResult result = {0, 0, readTime() - start, 0, {}};
+    counters.stop();
+    std::copy(counters.values, counters.values + NUM_PERF_EVENTS, result.perf_values);
+    pthread_barrier_destroy(&run.barrier);
+    for (int id = 0; id < num_threads; id++)
+    {
+        result.ops += ops[id];
+        result.failed += failed[id];
+    }
+    size_t peak_rss_kb = readStatusKb("VmHWM:");
+    result.peak_rss_kb = (peak_rss_reset && peak_rss_kb > base_rss_kb) ? peak_rss_kb - base_rss_kb : 0;
+    return result;
+}
+
+// runs in a child process, returns false if the child didn't report back.
+static bool runForked(const Allocator& allocator, const Workload& workload, int num_threads, double seconds,
+                      RunResult* result)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        RunResult child_result = runWorkload(allocator, workload, num_threads, seconds);
+        _exit(write(fds[1], &child_result, sizeof(child_result)) == sizeof(child_result) ? 0 : 1);
+    }
+    close(fds[1]);
+    bool reported = (pid > 0 && read(fds[0], result, sizeof(*result)) == sizeof(*result));
+    close(fds[0]);
+    if (pid > 0)
+    {
+        waitpid(pid, NULL, 0);
+    }
+    return reported;
+}
+
+// "-" for an event that wasn't counted.
+static std::string formatPerOp(long long value, size_t ops)
+{
+    if (value < 0)
+    {
+        return "-";
+    }
+    char formatted[32];
+    snprintf(formatted, sizeof(formatted), "%.3f", (double)value / (ops ? ops : 1));
+    return formatted;
+}
+
+int main(int argc, char* argv[])
+{
+    int max_threads = (argc > 1) ? atoi(argv[1]) : DEFAULT_MAX_THREADS;
+    double seconds = (argc > 2) ? atof(argv[2]) : DEFAULT_SECONDS;
+    if (max_threads < 1 || seconds <= 0)
+    {
+        fprintf(stderr, "usage: %s [max threads] [seconds per run]\n", argv[0]);
+        return 1;
+    }
+    std::vector<int> sweep;
+    for (int threads = 1; threads < max_threads; threads *= 2)
+    {
+        sweep.push_back(threads);
+    }
+    sweep.push_back(max_threads);
+
+    const char* path = getenv("MALLOC_MT_BENCH_CSV");
+    FILE* csv = fopen(path ? path : "malloc_mt_bench.csv", "a");
+    if (csv != NULL && ftell(csv) == 0)
+    {
+        fprintf(csv, "implementation,workload,threads,ops,ops_per_sec,scaling,peak_rss_kb");
+        printPerfCsvHeader(csv);
+        fprintf(csv, "\n");
+    }
+    printf("%u hardware threads\n", std::thread::hardware_concurrency());
+    printf("%-17s %-10s %7s %14s %8s %12s %8s %10s %10s\n", "allocator", "workload", "threads", "ops/sec", "scaling",
+           "peak RSS kB", "failed", "cycles/op", "faults/op");
+    for (const Allocator& allocator : getAllocators())
+    {
+        if (allocator.name.compare(0, 8, "malloc_1") == 0)
+        {
+            continue;
+        }
+        for (const Workload& workload : workloads)
+        {
+            double single_thread = 0;
+            for (int threads : sweep)
+            {
+                RunResult result;
+                if (!runForked(allocator, workload, threads, seconds, &result))
+                {
+                    printf("%-17s %-10s %7d %14s\n", allocator.name.c_str(), workload.name, threads, "crashed");
+                    continue;
+                }
+                double ops_per_sec = result.ops / (result.elapsed / 1e9);
+                single_thread = (threads == 1) ? ops_per_sec : single_thread;
+                double scaling = (single_thread > 0) ? ops_per_sec / single_thread : 0;
+                printf("%-17s %-10s %7d %14.0f %8.2f %12zu %8zu %10s %10s\n", allocator.name.c_str(), workload.name,
+                       threads, ops_per_sec, scaling, result.peak_rss_kb, result.failed,
+                       formatPerOp(result.perf_values[PERF_CYCLES], result.ops).c_str(),
+                       formatPerOp(result.perf_values[PERF_PAGE_FAULTS], result.ops).c_str());
+                fflush(stdout);
+                if (csv != NULL)
+                {
+                    fprintf(csv, "%s,%s,%d,%zu,%.0f,%.3f,%zu", allocator.name.c_str(), workload.name, threads,
+                            result.ops, ops_per_sec, scaling, result.peak_rss_kb);
+                    printPerfCsvValues(csv, result.perf_values, result.ops);
+                    fprintf(csv, "\n");
+                }
+            }
+        }
+    }
+    if (csv != NULL)
+    {
+        fclose(csv);
+    }
+    return 0;
+}
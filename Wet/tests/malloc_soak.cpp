@@ -0,0 +1,245 @@
+#include "bench_allocators.h"
+#include "perf_counters.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+/*
+Soak benchmark: a cache that warms up, churns, changes its object sizes, drains and fills up again,
+run for a long time against every implementation (or the ones named):
+    malloc_soak [ops] [capacity in objects] [implementation...]
+Live bytes, the allocator's footprint (its own counters, mallinfo2() for the system malloc) and the RSS
+(/proc/self/statm, growth over the start of the run) are sampled 200 times per run, with the overhead of
+each over the live bytes. Every implementation runs in a forked child, so the RSS is its own.
+Samples go to stdout and to a CSV file (MALLOC_SOAK_CSV, malloc_soak.csv by default):
+implementation,phase,ops,seconds,live_bytes,footprint_bytes,rss_bytes,footprint_ratio,rss_ratio,
+<perf counters per op since the previous sample, see perf_counters.h>
+malloc_1 never frees, so it isn't soaked. malloc_3 keeps its blocks in sorted lists, large capacities
+make it very slow.
+*/
+
+#define DEFAULT_OPS 20000000
+#define DEFAULT_CAPACITY 5000
+#define NUM_SAMPLES 200
+
+struct Phase
+{
+    const char* name;
+    double ops_fraction; // of the run
+    double capacity_fraction; // the cache grows or shrinks to it
+    size_t min_size;
+    size_t max_size;
+};
+
+static const Phase phases[] = {
+    {"warmup", 0.1, 1.0, 16, 256},
+    {"eviction", 0.3, 1.0, 16, 256},
+    {"phase change", 0.3, 0.1, 512, 4096},
+    {"drain", 0.15, 0.02, 16, 256},
+    {"regrow", 0.15, 1.0, 16, 256},
+};
+
+struct CachedObject
+{
+    void* p;
+    size_t size;
+};
+
+static unsigned long long readTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static size_t readRssBytes()
+{
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+    {
+        return 0;
+    }
+    size_t total_pages = 0, resident_pages = 0;
+    if (fscanf(statm, "%zu %zu", &total_pages, &resident_pages) != 2)
+    {
+        resident_pages = 0;
+    }
+    fclose(statm);
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+static unsigned int nextRandom(unsigned int* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+class Soak
+{
+public:
+    const Allocator& allocator;
+    std::vector<CachedObject> cache;
+    size_t live_bytes;
+    size_t failed;
+    unsigned int state;
+
+    Soak(const Allocator& allocator): allocator(allocator), live_bytes(0), failed(0), state(12345)
+    {}
+
+    void insert(const Phase& phase)
+    {
+        size_t size = phase.min_size + nextRandom(&this->state) % (phase.max_size - phase.min_size + 1);
+        void* p = this->allocator.malloc_fn(size);
+        if (p == NULL)
+        {
+            this->failed += 1;
+            return;
+        }
+        memset(p, 0xa5, size); // the RSS is what the allocator really needed.
+        this->cache.push_back({p, size});
+        this->live_bytes += size;
+    }
+
+    void evict()
+    {
+        size_t i = nextRandom(&this->state) % this->cache.size();
+        this->allocator.free_fn(this->cache[i].p);
+        this->live_bytes -= this->cache[i].size;
+        this->cache[i] = this->cache.back();
+        this->cache.pop_back();
+    }
+};
+
+static void printSample(FILE* csv, const Allocator& allocator, const Phase& phase, size_t ops, double seconds,
+                        size_t live_bytes, size_t base_rss, const long long* perf_values, size_t interval_ops)
+{
+    size_t footprint = getFootprint(allocator);
+    size_t rss = readRssBytes();
+    rss = (rss > base_rss) ? rss - base_rss : 0;
+    double footprint_ratio = live_bytes ? (double)footprint / live_bytes : 0;
+    double rss_ratio = live_bytes ? (double)rss / live_bytes : 0;
+    printf("%-17s %-13s %12zu %9.1f %12zu %12zu %12zu %9.2f %9.2f\n", allocator.name.c_str(), phase.name, ops,
+           seconds, live_bytes, footprint, rss, footprint_ratio, rss_ratio);
+    if (csv != NULL)
+    {
+        fprintf(csv, "%s,%s,%zu,%.3f,%zu,%zu,%zu,%.4f,%.4f", allocator.name.c_str(), phase.name, ops, seconds,
+                live_bytes, footprint, rss, footprint_ratio, rss_ratio);
+        printPerfCsvValues(csv, perf_values, interval_ops);
+        fprintf(csv, "\n");
+    }
+}
+
+static void soak(const Allocator& allocator, size_t total_ops, size_t capacity, FILE* csv)
+{
+    Soak soak(allocator);
+    size_t sample_interval = (total_ops / NUM_SAMPLES) ? total_ops / NUM_SAMPLES : 1;
+    size_t base_rss = readRssBytes();
+    unsigned long long start = readTime();
+    size_t ops = 0;
+    PerfCounters counters(false);
+    counters.start();
+    for (const Phase& phase : phases)
+    {
+        size_t target = (size_t)(capacity * phase.capacity_fraction);
+        size_t phase_end = ops + (size_t)(total_ops * phase.ops_fraction);
+        while (ops < phase_end)
+        {
+            // one allocator call per step: the cache grows or shrinks to the target, then churns at it.
+            if (soak.cache.size() > target || (soak.cache.size() == target && (ops & 1)))
+            {
+                soak.evict();
+            }
+            else
+            {
+                soak.insert(phase);
+            }
+            ops++;
+            if (ops % sample_interval == 0)
+            {
+                counters.stop();
+                printSample(csv, allocator, phase, ops, (readTime() - start) / 1e9, soak.live_bytes, base_rss,
+                            counters.values, sample_interval);
+                counters.start();
+            }
+        }
+    }
+    size_t remaining = soak.cache.size();
+    while (!soak.cache.empty())
+    {
+        soak.evict();
+    }
+    counters.stop();
+    printSample(csv, allocator, phases[sizeof(phases) / sizeof(phases[0]) - 1], ops, (readTime() - start) / 1e9, 0,
+                base_rss, counters.values, remaining);
+    if (soak.failed != 0)
+    {
+        printf("%-17s %zu allocations failed\n", allocator.name.c_str(), soak.failed);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t total_ops = (argc > 1) ? strtoull(argv[1], NULL, 10) : DEFAULT_OPS;
+    size_t capacity = (argc > 2) ? strtoull(argv[2], NULL, 10) : DEFAULT_CAPACITY;
+    if (total_ops == 0 || capacity == 0)
+    {
+        fprintf(stderr, "usage: %s [ops] [capacity in objects] [implementation...]\n", argv[0]);
+        return 1;
+    }
+    const char* path = getenv("MALLOC_SOAK_CSV");
+    FILE* csv = fopen(path ? path : "malloc_soak.csv", "a");
+    if (csv != NULL && ftell(csv) == 0)
+    {
+        fprintf(csv, "implementation,phase,ops,seconds,live_bytes,footprint_bytes,rss_bytes,footprint_ratio,rss_ratio");
+        printPerfCsvHeader(csv);
+        fprintf(csv, "\n");
+    }
+    printf("%-17s %-13s %12s %9s %12s %12s %12s %9s %9s\n", "allocator", "phase", "ops", "seconds", "live",
+           "footprint", "RSS", "fp/live", "rss/live");
+    for (const Allocator& allocator : getAllocators())
+    {
+        bool selected = (argc <= 3);
+        for (int i = 3; i < argc; i++)
+        {
+            selected = selected || allocator.name == argv[i];
+        }
+        if (!selected || allocator.name.compare(0, 8, "malloc_1") == 0)
+        {
+            continue;
+        }
+        fflush(stdout);
+        if (csv != NULL)
+        {
+            fflush(csv);
+        }
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            soak(allocator, total_ops, capacity, csv);
+            fflush(stdout);
+            if (csv != NULL)
+            {
+                fflush(csv);
+            }
+            _exit(0);
+        }
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        {
+            printf("%-17s crashed\n", allocator.name.c_str());
+        }
+    }
+    if (csv != NULL)
+    {
+        fclose(csv);
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "mem_kernels.h"
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <string.h>
+#include <vector>
+
+#define MB (1024 * 1024)
+
+TEST_CASE("bulk memset", "[mem_kernels]")
+{
+    for (size_t size : {1 * MB, 16 * MB, 64 * MB})
+    {
+        std::vector<char> buffer(size + 1, 'a');
+        bulkMemset(buffer.data() + 1, 0, size);
+        REQUIRE(buffer[0] == 'a');
+        REQUIRE(buffer[1] == 0);
+        REQUIRE(buffer[size] == 0);
+
+        BENCHMARK("libc memset " + std::to_string(size / MB) + "MB")
+        {
+            memset(buffer.data() + 1, 0, size);
+            return buffer[size];
+        };
+        BENCHMARK("bulkMemset " + std::to_string(size / MB) + "MB")
+        {
+            bulkMemset(buffer.data() + 1, 0, size);
+            return buffer[size];
+        };
+    }
+}
+
+TEST_CASE("bulk memmove", "[mem_kernels]")
+{
+    for (size_t size : {1 * MB, 16 * MB, 64 * MB})
+    {
+        std::vector<char> src(size + 1);
+        std::vector<char> dst(size + 1, 0);
+        for (size_t i = 0; i < size + 1; i++)
+        {
+            src[i] = (char)i;
+        }
+        bulkMemmove(dst.data() + 1, src.data(), size);
+        REQUIRE(dst[0] == 0);
+        REQUIRE(memcmp(dst.data() + 1, src.data(), size) == 0);
+
+        BENCHMARK("libc memmove " + std::to_string(size / MB) + "MB")
+        {
+            memmove(dst.data() + 1, src.data(), size);
+            return dst[size];
+        };
+        BENCHMARK("bulkMemmove " + std::to_string(size / MB) + "MB")
+        {
+            bulkMemmove(dst.data() + 1, src.data(), size);
+            return dst[size];
+        };
+    }
+}
+
+TEST_CASE("bulk memmove overlap", "[mem_kernels]")
+{
+    size_t size = 4 * MB;
+    std::vector<char> buffer(size + 4096);
+    for (size_t i = 0; i < buffer.size(); i++)
+    {
+        buffer[i] = (char)(i % 251);
+    }
+    std::vector<char> expected(buffer);
+    memmove(expected.data(), expected.data() + 100, size);
+    bulkMemmove(buffer.data(), buffer.data() + 100, size);
+    REQUIRE(buffer == expected);
+
+    memmove(expected.data() + 100, expected.data(), size);
+    bulkMemmove(buffer.data() + 100, buffer.data(), size);
+    REQUIRE(buffer == expected);
+}
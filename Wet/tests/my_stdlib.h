@@ -15,4 +15,11 @@ size_t _num_allocated_bytes();
 size_t _num_meta_data_bytes();
 size_t _size_meta_data();
 
+/* malloc_2, malloc_3 and malloc_4, built with -DMALLOC_HUGE_ALLOCATIONS (0 otherwise) */
+size_t _num_huge_allocations();
+size_t _num_huge_allocation_bytes();
+
+/* malloc_3 only */
+size_t _num_huge_page_bytes();
+
 #endif /* MY_STDLIB_H */
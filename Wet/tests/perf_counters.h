@@ -0,0 +1,205 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+Hardware counters for the benchmarks through perf_event_open(2), user space only, for this thread and (with
+inherit) the threads it creates after the counters are opened:
+    PerfCounters counters(false);
+    counters.start(); <work> counters.stop();
+    counters.values[PERF_L1D_MISSES] / ops
+An event the CPU doesn't have or that we aren't allowed to count (perf_event_paranoid, VMs, containers) reads
+as -1. Page faults and the task clock are software events, if perf_event_open() is denied altogether they
+come from getrusage() and the CPU time clock instead.
+*/
+
+enum PerfEvent
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_PAGE_FAULTS,
+    PERF_TASK_CLOCK, // ns
+    NUM_PERF_EVENTS
+};
+
+static const char* const perf_event_names[NUM_PERF_EVENTS] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "page_faults", "task_clock_ns"};
+
+static inline int openPerfEvent(PerfEvent event, bool inherit)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.inherit = inherit;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // the hardware counters are shared, events that had to take turns are scaled by the time they ran.
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    const unsigned long long cache_read_miss =
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    switch (event)
+    {
+    case PERF_CYCLES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERF_INSTRUCTIONS:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PERF_L1D_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D | cache_read_miss;
+        break;
+    case PERF_LLC_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL | cache_read_miss;
+        break;
+    case PERF_DTLB_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | cache_read_miss;
+        break;
+    case PERF_PAGE_FAULTS:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+        break;
+    default:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_TASK_CLOCK;
+        break;
+    }
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+class PerfCounters
+{
+public:
+    int fds[NUM_PERF_EVENTS];
+    long long values[NUM_PERF_EVENTS];
+    bool software_fallback; // perf_event_open() is denied, faults and time come from getrusage()
+    long long fallback_faults;
+    long long fallback_clock;
+
+    explicit PerfCounters(bool inherit): software_fallback(true), fallback_faults(0), fallback_clock(0)
+    {
+        for (int event = 0; event < NUM_PERF_EVENTS; event++)
+        {
+            this->fds[event] = openPerfEvent((PerfEvent)event, inherit);
+            this->values[event] = -1;
+            this->software_fallback = this->software_fallback && this->fds[event] < 0;
+        }
+    }
+
+    ~PerfCounters()
+    {
+        for (int event = 0; event < NUM_PERF_EVENTS; event++)
+        {
+            if (this->fds[event] >= 0)
+            {
+                close(this->fds[event]);
+            }
+        }
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool hasHardware() const
+    {
+        return this->fds[PERF_CYCLES] >= 0;
+    }
+
+    void start()
+    {
+        for (int event = 0; event < NUM_PERF_EVENTS; event++)
+        {
+            if (this->fds[event] >= 0)
+            {
+                ioctl(this->fds[event], PERF_EVENT_IOC_RESET, 0);
+                ioctl(this->fds[event], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+        if (this->software_fallback)
+        {
+            this->fallback_faults = readFaults();
+            this->fallback_clock = readCpuClock();
+        }
+    }
+
+    void stop()
+    {
+        for (int event = 0; event < NUM_PERF_EVENTS; event++)
+        {
+            this->values[event] = -1;
+            if (this->fds[event] < 0)
+            {
+                continue;
+            }
+            ioctl(this->fds[event], PERF_EVENT_IOC_DISABLE, 0);
+            unsigned long long data[3]; // value, time enabled, time running
+            if (read(this->fds[event], data, sizeof(data)) == sizeof(data) && data[2] != 0)
+            {
+                this->values[event] = (long long)((double)data[0] * data[1] / data[2]);
+            }
+        }
+        if (this->software_fallback)
+        {
+            this->values[PERF_PAGE_FAULTS] = readFaults() - this->fallback_faults;
+            this->values[PERF_TASK_CLOCK] = readCpuClock() - this->fallback_clock;
+        }
+    }
+
+private:
+    static long long readFaults()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_minflt + usage.ru_majflt;
+    }
+
+    static long long readCpuClock()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+        return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+    }
+};
+
+// ",cycles_per_op,instructions_per_op,..." for a CSV header.
+static inline void printPerfCsvHeader(FILE* file)
+{
+    for (int event = 0; event < NUM_PERF_EVENTS; event++)
+    {
+        fprintf(file, ",%s_per_op", perf_event_names[event]);
+    }
+}
+
+// the values divided by ops, an event that wasn't counted is left empty.
+static inline void printPerfCsvValues(FILE* file, const long long* values, double ops)
+{
+    for (int event = 0; event < NUM_PERF_EVENTS; event++)
+    {
+        if (values[event] < 0)
+        {
+            fprintf(file, ",");
+        }
+        else
+        {
+            fprintf(file, ",%.4f", values[event] / (ops ? ops : 1));
+        }
+    }
+}
+
+#endif /* PERF_COUNTERS_H */
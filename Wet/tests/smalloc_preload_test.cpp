@@ -0,0 +1,56 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <string>
+#include <vector>
+
+/*
+Linked against libsmalloc.so, which comes before libc: the standard names resolve to it as they would under
+LD_PRELOAD, for the test and for Catch2 alike.
+*/
+
+#define MB ((size_t)1 << 20)
+
+TEST_CASE("Buffer above MAX_SIZE", "[smalloc_preload]")
+{
+    size_t huge = _num_huge_allocations();
+    char *a = (char *)malloc(200 * MB);
+    REQUIRE(a != nullptr);
+    REQUIRE(_num_huge_allocations() == huge + 1);
+    a[0] = 'a';
+    a[200 * MB - 1] = 'z';
+    REQUIRE(malloc_usable_size(a) >= 200 * MB);
+
+    char *b = (char *)realloc(a, 300 * MB);
+    REQUIRE(b != nullptr);
+    REQUIRE(b[0] == 'a');
+    REQUIRE(b[200 * MB - 1] == 'z');
+    b[300 * MB - 1] = 'y';
+    free(b);
+    REQUIRE(_num_huge_allocations() == huge);
+
+    char *c = (char *)calloc(150, MB);
+    REQUIRE(c != nullptr);
+    REQUIRE(c[0] == 0);
+    REQUIRE(c[150 * MB - 1] == 0);
+    free(c);
+    REQUIRE(_num_huge_allocations() == huge);
+}
+
+TEST_CASE("Many small objects", "[smalloc_preload]")
+{
+    // more than the fixed 4MB buddy region holds, and more than vm.max_map_count mappings would allow.
+    std::vector<std::string *> strings;
+    for (int i = 0; i < 100000; i++)
+    {
+        strings.push_back(new std::string(40, 'a' + i % 26));
+    }
+    for (int i = 0; i < 100000; i++)
+    {
+        REQUIRE((*strings[i])[39] == 'a' + i % 26);
+        delete strings[i];
+    }
+}
@@ -0,0 +1,245 @@
+#include "alloc_trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+Replays an allocation trace recorded with smalloc_trace_start():
+    alloc_trace_replay_<allocator> <trace file>
+The driver is built once per allocator (see tools/CMakeLists.txt). Every allocation is written to, so the
+footprint is the resident memory the allocator really needed; it's measured as the growth of the peak RSS
+over the replay, fragmentation is the part of it that wasn't live data at the peak.
+*/
+
+#ifdef REPLAY_SYSTEM_MALLOC
+#define REPLAY_ALLOCATOR "system"
+static void* smalloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void* scalloc(size_t num, size_t size)
+{
+    return calloc(num, size);
+}
+
+static void* srealloc(void* oldp, size_t size)
+{
+    return realloc(oldp, size);
+}
+
+static void sfree(void* p)
+{
+    free(p);
+}
+#else
+void* smalloc(size_t size);
+void* scalloc(size_t num, size_t size);
+void* srealloc(void* oldp, size_t size);
+void sfree(void* p);
+#endif
+
+class ReplayEntry
+{
+public:
+    struct alloc_trace_record record;
+    size_t id; // of the allocation this record makes, 0 if it makes none
+};
+
+static size_t readStatusKb(const char* key)
+{
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status == NULL)
+    {
+        return 0;
+    }
+    char line[256];
+    size_t value = 0;
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, key, strlen(key)) == 0)
+        {
+            value = strtoul(line + strlen(key), NULL, 10);
+            break;
+        }
+    }
+    fclose(status);
+    return value;
+}
+
+// resets VmHWM to the current RSS (linux >= 4.0), returns false if it couldn't.
+static bool resetPeakRss()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool reset = (write(fd, "5", 1) == 1);
+    close(fd);
+    return reset;
+}
+
+static unsigned long long readTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static bool loadTrace(const char* path, std::vector<ReplayEntry>* entries, size_t* num_ids)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[64 * 1024];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        data.insert(data.end(), chunk, chunk + read);
+    }
+    fclose(file);
+
+    struct alloc_trace_header header;
+    if (data.size() < sizeof(header))
+    {
+        fprintf(stderr, "%s: not an allocation trace\n", path);
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != ALLOC_TRACE_MAGIC || header.version != ALLOC_TRACE_VERSION)
+    {
+        fprintf(stderr, "%s: not an allocation trace\n", path);
+        return false;
+    }
+
+    // ids are resolved up front, the replay only indexes the pointer table.
+    size_t offset = sizeof(header);
+    size_t next_id = 1;
+    while (offset < data.size())
+    {
+        ReplayEntry entry;
+        size_t length = allocTraceDecode(data.data() + offset, data.size() - offset, &entry.record);
+        if (length == 0)
+        {
+            fprintf(stderr, "%s: truncated at byte %zu, replaying what was read\n", path, offset);
+            break;
+        }
+        offset += length;
+        if (entry.record.id_distance > next_id)
+        {
+            entry.record.id_distance = 0; // corrupted, treat it as an unknown block.
+        }
+        // the distance is turned into an absolute id.
+        entry.record.id_distance = (entry.record.id_distance != 0) ? next_id - entry.record.id_distance : 0;
+        entry.id = (entry.record.op != ALLOC_TRACE_SFREE && !entry.record.failed) ? next_id++ : 0;
+        entries->push_back(entry);
+    }
+    *num_ids = next_id;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+    std::vector<ReplayEntry> entries;
+    size_t num_ids = 0;
+    if (!loadTrace(argv[1], &entries, &num_ids))
+    {
+        return 1;
+    }
+    std::vector<void*> pointers(num_ids, NULL);
+    std::vector<size_t> sizes(num_ids, 0);
+
+    bool peak_rss_reset = resetPeakRss();
+    size_t base_rss_kb = readStatusKb("VmRSS:");
+    size_t live_bytes = 0, peak_live_bytes = 0, num_failed = 0;
+    unsigned long long allocator_time = 0, trace_time = 0;
+    for (const ReplayEntry& entry : entries)
+    {
+        const struct alloc_trace_record& record = entry.record;
+        void* old_pointer = pointers[record.id_distance];
+        size_t size = record.num * record.size;
+        void* pointer = NULL;
+        trace_time += record.time_delta;
+
+        unsigned long long start = readTime();
+        switch (record.op)
+        {
+        case ALLOC_TRACE_SMALLOC:
+            pointer = smalloc(record.size);
+            break;
+        case ALLOC_TRACE_SCALLOC:
+            pointer = scalloc(record.num, record.size);
+            break;
+        case ALLOC_TRACE_SREALLOC:
+            pointer = srealloc(old_pointer, record.size);
+            break;
+        case ALLOC_TRACE_SFREE:
+            sfree(old_pointer);
+            break;
+        }
+        allocator_time += readTime() - start;
+
+        if (record.op != ALLOC_TRACE_SFREE && pointer == NULL)
+        {
+            num_failed += 1;
+        }
+        if (record.op == ALLOC_TRACE_SFREE || (record.op == ALLOC_TRACE_SREALLOC && pointer != NULL))
+        {
+            live_bytes -= sizes[record.id_distance];
+            pointers[record.id_distance] = NULL;
+            sizes[record.id_distance] = 0;
+        }
+        if (pointer == NULL)
+        {
+            continue;
+        }
+        // a call that failed when it was recorded gets no id: the program never saw the block, unless
+        // it was a srealloc, then it still has the old one.
+        size_t id = entry.id;
+        if (record.failed && record.op == ALLOC_TRACE_SREALLOC)
+        {
+            id = record.id_distance;
+        }
+        else if (record.failed)
+        {
+            sfree(pointer);
+            continue;
+        }
+        memset(pointer, 0xa5, size);
+        pointers[id] = pointer;
+        sizes[id] = size;
+        live_bytes += size;
+        peak_live_bytes = (live_bytes > peak_live_bytes) ? live_bytes : peak_live_bytes;
+    }
+    size_t peak_rss_kb = readStatusKb("VmHWM:");
+    size_t footprint = (peak_rss_kb > base_rss_kb) ? (peak_rss_kb - base_rss_kb) * 1024 : 0;
+
+    printf("allocator:        %s\n", REPLAY_ALLOCATOR);
+    printf("operations:       %zu (%zu failed)\n", entries.size(), num_failed);
+    printf("allocator time:   %.3f ms (%.1f ns/op)\n", allocator_time / 1e6,
+           entries.empty() ? 0.0 : (double)allocator_time / entries.size());
+    printf("recorded time:    %.3f ms\n", trace_time / 1e6);
+    printf("peak live bytes:  %zu\n", peak_live_bytes);
+    if (!peak_rss_reset)
+    {
+        printf("warning: couldn't reset the peak RSS, the footprint includes loading the trace\n");
+    }
+    printf("peak footprint:   %zu\n", footprint);
+    printf("fragmentation:    %.3f\n", (footprint > peak_live_bytes) ? 1.0 - (double)peak_live_bytes / footprint : 0.0);
+    return 0;
+}
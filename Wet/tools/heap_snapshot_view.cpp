@@ -0,0 +1,162 @@
+#include "heap_snapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/*
+Offline viewer of the snapshots written by smalloc_snapshot_write():
+    heap_snapshot_view <snapshot file>
+Prints an occupancy map per buddy root and a summary per order.
+*/
+
+#define MAP_CELLS 64
+#define NUM_ORDERS 11
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <snapshot file>\n", argv[0]);
+        return 1;
+    }
+    FILE* file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    struct heap_snapshot_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != HEAP_SNAPSHOT_MAGIC ||
+        header.version != HEAP_SNAPSHOT_VERSION)
+    {
+        fprintf(stderr, "%s: not a heap snapshot\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    std::vector<struct heap_snapshot_record> blocks;
+    std::vector<struct heap_snapshot_record> chunks;
+    struct heap_snapshot_record record;
+    bool complete = false;
+    bool corrupted = false;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (record.type == HEAP_SNAPSHOT_BLOCK)
+        {
+            blocks.push_back(record);
+        }
+        else if (record.type == HEAP_SNAPSHOT_CHUNK)
+        {
+            chunks.push_back(record);
+        }
+        else
+        {
+            complete = true;
+            corrupted = (record.type == HEAP_SNAPSHOT_CORRUPTED);
+            break;
+        }
+    }
+    fclose(file);
+
+    printf("heap snapshot: %u roots of %u bytes at 0x%llx, metadata %u bytes\n", header.num_roots, header.root_size,
+           (unsigned long long)header.region_base, header.meta_data_size);
+    if (!complete)
+    {
+        printf("warning: the snapshot is truncated\n");
+    }
+    if (corrupted)
+    {
+        printf("warning: the heap walk stopped at a corrupted block\n");
+    }
+
+    // occupancy map: every cell covers root_size / MAP_CELLS bytes.
+    size_t cell_size = header.root_size / MAP_CELLS;
+    std::vector<size_t> used_bytes(header.num_roots * MAP_CELLS, 0);
+    std::vector<size_t> known_bytes(header.num_roots * MAP_CELLS, 0);
+    size_t free_blocks[NUM_ORDERS] = {0};
+    size_t used_blocks[NUM_ORDERS] = {0};
+    size_t free_bytes[NUM_ORDERS] = {0};
+    size_t largest_free = 0;
+    size_t requested = 0;
+    size_t granted = 0;
+    for (const struct heap_snapshot_record& block : blocks)
+    {
+        if (block.order < NUM_ORDERS)
+        {
+            (block.is_free ? free_blocks : used_blocks)[block.order] += 1;
+            if (block.is_free)
+            {
+                free_bytes[block.order] += block.size;
+            }
+        }
+        if (block.is_free && block.size > largest_free)
+        {
+            largest_free = block.size;
+        }
+        if (!block.is_free)
+        {
+            requested += block.requested_size;
+            granted += block.size;
+        }
+        size_t begin = block.address - header.region_base;
+        size_t end = begin + block.size + header.meta_data_size;
+        for (size_t cell = begin / cell_size; cell < used_bytes.size() && cell * cell_size < end; cell++)
+        {
+            size_t cell_begin = cell * cell_size;
+            size_t overlap = ((end < cell_begin + cell_size) ? end : cell_begin + cell_size) -
+                             ((begin > cell_begin) ? begin : cell_begin);
+            known_bytes[cell] += overlap;
+            if (!block.is_free)
+            {
+                used_bytes[cell] += overlap;
+            }
+        }
+    }
+
+    printf("\noccupancy ('#' used, '+' partly used, '.' free, '?' not walked), %zu bytes per cell:\n", cell_size);
+    for (size_t root = 0; root < header.num_roots; root++)
+    {
+        char map[MAP_CELLS + 1];
+        size_t root_used = 0;
+        for (size_t i = 0; i < MAP_CELLS; i++)
+        {
+            size_t cell = root * MAP_CELLS + i;
+            root_used += used_bytes[cell];
+            if (known_bytes[cell] < cell_size)
+            {
+                map[i] = '?';
+            }
+            else if (used_bytes[cell] == 0)
+            {
+                map[i] = '.';
+            }
+            else if (used_bytes[cell] == cell_size)
+            {
+                map[i] = '#';
+            }
+            else
+            {
+                map[i] = '+';
+            }
+        }
+        map[MAP_CELLS] = '\0';
+        printf("root %2zu [%s] %5.1f%% used\n", root, map, 100.0 * root_used / header.root_size);
+    }
+
+    printf("\n%5s %10s %10s %14s\n", "order", "free", "used", "free bytes");
+    for (int order = 0; order < NUM_ORDERS; order++)
+    {
+        printf("%5d %10zu %10zu %14zu\n", order, free_blocks[order], used_blocks[order], free_bytes[order]);
+    }
+    size_t chunk_bytes = 0;
+    for (const struct heap_snapshot_record& chunk : chunks)
+    {
+        chunk_bytes += chunk.size;
+    }
+    printf("\nlargest free block: %zu bytes\n", largest_free);
+    printf("requested / granted: %zu / %zu bytes (%zu bytes of internal fragmentation)\n", requested, granted,
+           granted - requested);
+    printf("mmap chunks: %zu, %zu bytes\n", chunks.size(), chunk_bytes);
+    return 0;
+}